@@ -39,7 +39,7 @@ void memrev16(void *p);
 void memrev32(void *p);
 void memrev64(void *p);
 
-uint16_t intrev16(uint64_t v);
+uint16_t intrev16(uint16_t v);
 uint32_t intrev32(uint32_t v);
 uint64_t intrev64(uint64_t v);
 
@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "demo_intset_2.h"
 #include "demo_intset_2_endianconv.h"
 
@@ -16,71 +22,164 @@ uint8_t _intsetValueEncoding(int64_t v) {
     }
 }
 
-// 根据给定的编码方式，返回给定位置上的值
-int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
+// 创建一个空的 intset
+intset *intsetNew(void) {
 
-    int64_t v64;
-    int32_t v32;
-    int16_t v16;
+    intset *is = (intset *)malloc(sizeof(intset));
 
-    if (enc == INTSET_ENC_INT64) {
-        memcpy(&v64, ((int64_t*)is->contents) + pos, sizeof(v64));
-        memrev64ifbe(&v64);
-        return v64;
-    } else if (enc == INTSET_ENC_INT32) {
-        memcpy(&v32, ((int32_t*)is->contents) + pos, sizeof(v32));
-        memrev32ifbe(&v32);
-        return v32;
-    } else {
-        memcpy(&v16, ((int16_t*)is->contents) + pos, sizeof(v16));
-        memrev16ifbe(&v16);
-        return v16;
+    is->encoding = intrev32ifbe(INTSET_ENC_INT16);
+    is->length = 0;
+
+    return is;
+}
+
+// 调整intset的大小
+intset *intsetResize(intset *is, uint32_t len) {
+
+    uint32_t size = len * intrev32ifbe(is->encoding);
+    is = (intset *)realloc(is, sizeof(intset) + size);
+    return is;
+}
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+/**
+ * 小端机器上 contents 中的元素就是本机字节序，可以直接按类型访问，不需要 memcpy 和字节序转换
+ * 下面的函数都返回数组中小于 value 的元素个数，也就是 value 应该插入的位置
+ *  1. 元素较少时线性扫描：数组有序，逐块比较直到遇到不小于 value 的元素，SSE2 每次比较 8 个 int16 或 4 个 int32
+ *  2. 元素较多时无分支二分查找：每一步只根据比较结果选择下半段或上半段，编译器可以生成 cmov，没有分支预测失败
+ */
+static uint32_t intsetLinearSearch16(const int16_t *a, uint32_t n, int16_t value) {
+
+    uint32_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i v = _mm_set1_epi16(value);
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi16(_mm_loadu_si128((const __m128i *)(a + i)), v));
+        if (mask != 0xffff) return i + __builtin_popcount(mask) / 2;
     }
+#endif
+
+    while (i < n && a[i] < value) i++;
+    return i;
 }
 
-// 返回intset 上给定的pos值
-int64_t _intsetGet(intset *is, int pos) {
+static uint32_t intsetLinearSearch32(const int32_t *a, uint32_t n, int32_t value) {
+
+    uint32_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i v = _mm_set1_epi32(value);
+    for (; i + 4 <= n; i += 4) {
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)(a + i)), v));
+        if (mask != 0xffff) return i + __builtin_popcount(mask) / 4;
+    }
+#endif
 
-    int64_t ret =  _intsetGetEncoded(is, pos, intrev32ifbe(is->encoding));
-    return ret;
+    while (i < n && a[i] < value) i++;
+    return i;
 }
 
-// 将 inset 上给定pos的值设置为value
-void _intsetSet(intset *is, int pos, int64_t value) {
+static uint32_t intsetLinearSearch64(const int64_t *a, uint32_t n, int64_t value) {
 
-    uint32_t encoding = intrev32ifbe(is->encoding);
+    uint32_t i = 0;
 
-    if (encoding == INTSET_ENC_INT64) {
-        ((int64_t*)is->contents)[pos] = value;
-        memrev64ifbe(((int64_t*)is->contents) + pos);
-    } else if (encoding == INTSET_ENC_INT32) {
-        ((int32_t*)is->contents)[pos] = value;
-        memrev32ifbe(((int32_t*)is->contents) + pos);
-    } else {
-        ((int16_t*)is->contents)[pos] = value;
-       memrev16ifbe(((int16_t*)is->contents) + pos);
+#if defined(__SSE4_2__)
+    const __m128i v = _mm_set1_epi64x(value);
+    for (; i + 2 <= n; i += 2) {
+        int mask = _mm_movemask_epi8(_mm_cmpgt_epi64(v, _mm_loadu_si128((const __m128i *)(a + i))));
+        if (mask != 0xffff) return i + __builtin_popcount(mask) / 8;
     }
+#endif
+
+    while (i < n && a[i] < value) i++;
+    return i;
 }
 
-// 创建一个空的 intset
-intset *intsetNew(void) {
+static uint32_t intsetBinarySearch16(const int16_t *a, uint32_t n, int16_t value) {
 
-    intset *is = (intset *)malloc(sizeof(intset));
+    const int16_t *base = a;
+    uint32_t half;
 
-    is->encoding = intrev32ifbe(INTSET_ENC_INT16);
-    is->length = 0;
+    while (n > 1) {
+        half = n / 2;
+        base = (base[half] < value) ? base + half : base;
+        n -= half;
+    }
+    return (base - a) + (*base < value);
+}
 
-    return is;
+static uint32_t intsetBinarySearch32(const int32_t *a, uint32_t n, int32_t value) {
+
+    const int32_t *base = a;
+    uint32_t half;
+
+    while (n > 1) {
+        half = n / 2;
+        base = (base[half] < value) ? base + half : base;
+        n -= half;
+    }
+    return (base - a) + (*base < value);
 }
 
-// 调整intset的大小
-intset *intsetResize(intset *is, uint32_t len) {
+static uint32_t intsetBinarySearch64(const int64_t *a, uint32_t n, int64_t value) {
 
-    uint32_t size = len * intrev32ifbe(is->encoding);
-    is = (intset *)realloc(is, sizeof(intset) + size);
-    return is;
+    const int64_t *base = a;
+    uint32_t half;
+
+    while (n > 1) {
+        half = n / 2;
+        base = (base[half] < value) ? base + half : base;
+        n -= half;
+    }
+    return (base - a) + (*base < value);
 }
 
+/**
+ * 查找 value 在 is 中的索引
+ *  查找成功时，将索引保存到pos，并返回1
+ *  查找失败时，返回0，并将value可以插入的索引保存到pos
+ */
+uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
+
+    uint32_t len = intrev32ifbe(is->length), idx;
+    uint32_t encoding = intrev32ifbe(is->encoding);
+    uint8_t found;
+
+    if (len == 0) {
+        if (pos) *pos = 0;
+        return 0;
+    }
+
+    // value 超出当前编码能表示的范围时，一定不在集合中
+    if (_intsetValueEncoding(value) > encoding) {
+        if (pos) *pos = value < 0 ? 0 : len;
+        return 0;
+    }
+
+    if (encoding == INTSET_ENC_INT64) {
+        const int64_t *a = (const int64_t *)is->contents;
+        idx = (len <= INTSET_LINEAR_SEARCH_MAX) ? intsetLinearSearch64(a, len, value) : intsetBinarySearch64(a, len, value);
+        found = idx < len && a[idx] == value;
+    } else if (encoding == INTSET_ENC_INT32) {
+        const int32_t *a = (const int32_t *)is->contents;
+        idx = (len <= INTSET_LINEAR_SEARCH_MAX) ? intsetLinearSearch32(a, len, value) : intsetBinarySearch32(a, len, value);
+        found = idx < len && a[idx] == value;
+    } else {
+        const int16_t *a = (const int16_t *)is->contents;
+        idx = (len <= INTSET_LINEAR_SEARCH_MAX) ? intsetLinearSearch16(a, len, value) : intsetBinarySearch16(a, len, value);
+        found = idx < len && a[idx] == value;
+    }
+
+    if (pos) *pos = idx;
+    return found;
+}
+#else
+/**
+ * 查找 value 在 is 中的索引
+ *  查找成功时，将索引保存到pos，并返回1
+ *  查找失败时，返回0，并将value可以插入的索引保存到pos
+ */
 uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
 
     int min = 0, max = intrev32ifbe(is->length) - 1, mid = -1;
@@ -112,7 +211,7 @@ uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
 
     // 在 is元素数组中进行二分查找
     while (max >= min) {
-        mid = ((unsigned int) + (unsigned int)max) >> 1;
+        mid = ((unsigned int)min + (unsigned int)max) >> 1;
         cur = _intsetGet(is, mid);
         if (value > cur) {
             min = mid + 1;
@@ -135,6 +234,7 @@ uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
         return 0;
     }
 }
+#endif
 
 /**
  * 根据value， 对intset所使用的编码方式进行升级，并扩容intset
@@ -271,6 +371,141 @@ intset *intsetAdd(intset *is, int64_t value, uint8_t *success) {
     return is;
 }
 
+// qsort 使用的比较函数
+static int intsetCompareInt64(const void *a, const void *b) {
+
+    int64_t va = *(const int64_t *)a, vb = *(const int64_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+// 复制 vals 并排序去重，返回去重后的元素个数，*sorted 需要调用者释放
+static size_t intsetSortUnique(const int64_t *vals, size_t n, int64_t **sorted) {
+
+    int64_t *tmp;
+    size_t i, m = 0;
+
+    *sorted = NULL;
+    if (n == 0) return 0;
+
+    tmp = (int64_t *)malloc(sizeof(int64_t) * n);
+    if (tmp == NULL) return 0;
+
+    memcpy(tmp, vals, sizeof(int64_t) * n);
+    qsort(tmp, n, sizeof(int64_t), intsetCompareInt64);
+
+    for (i = 0; i < n; i++) {
+        if (m == 0 || tmp[m - 1] != tmp[i]) tmp[m++] = tmp[i];
+    }
+
+    *sorted = tmp;
+    return m;
+}
+
+/**
+ * 批量添加 n 个元素
+ *  1. 复制并排序去重输入，根据最小值和最大值确定新的编码，最多升级一次
+ *  2. 归并计数真正需要添加的元素，只扩容一次
+ *  3. 从后向前归并：新位置和新编码的宽度都不小于旧的，从后向前写入不会覆盖还没有读取的元素
+ * 复杂度 O(N + KlogK)，如果 added 不为 NULL，把新添加的元素个数写入 added
+ */
+intset *intsetAddMany(intset *is, const int64_t *vals, size_t n, size_t *added) {
+
+    uint32_t len = intrev32ifbe(is->length);
+    uint8_t oldenc = intrev32ifbe(is->encoding), newenc = oldenc;
+    int64_t *sorted, cur;
+    size_t m, k = 0, j;
+    uint32_t i;
+    int64_t ri, rj, d;
+
+    if (added) *added = 0;
+
+    m = intsetSortUnique(vals, n, &sorted);
+    if (m == 0) return is;
+
+    if (_intsetValueEncoding(sorted[0]) > newenc) newenc = _intsetValueEncoding(sorted[0]);
+    if (_intsetValueEncoding(sorted[m - 1]) > newenc) newenc = _intsetValueEncoding(sorted[m - 1]);
+
+    // 计算需要添加的元素个数
+    for (i = 0, j = 0; j < m; ) {
+        if (i < len && (cur = _intsetGetEncoded(is, i, oldenc)) <= sorted[j]) {
+            if (cur == sorted[j]) j++;
+            i++;
+        } else {
+            k++;
+            j++;
+        }
+    }
+
+    if (k == 0 && newenc == oldenc) {
+        free(sorted);
+        return is;
+    }
+
+    is->encoding = intrev32ifbe(newenc);
+    is = intsetResize(is, len + k);
+
+    // 从后向前归并
+    ri = (int64_t)len - 1;
+    rj = (int64_t)m - 1;
+    d = (int64_t)(len + k) - 1;
+    while (rj >= 0) {
+        if (ri >= 0 && (cur = _intsetGetEncoded(is, ri, oldenc)) >= sorted[rj]) {
+            if (cur == sorted[rj]) rj--;
+            _intsetSet(is, d--, cur);
+            ri--;
+        } else {
+            _intsetSet(is, d--, sorted[rj--]);
+        }
+    }
+
+    // 编码没有变化时，剩下的元素已经在正确的位置上
+    if (newenc != oldenc) {
+        while (ri >= 0) {
+            _intsetSet(is, d--, _intsetGetEncoded(is, ri, oldenc));
+            ri--;
+        }
+    }
+
+    is->length = intrev32ifbe(len + k);
+    if (added) *added = k;
+    free(sorted);
+    return is;
+}
+
+/**
+ * 批量移除 n 个元素
+ * 复制并排序去重输入之后，一次从前向后的遍历把保留的元素压缩到数组前部，最后只缩容一次
+ * 如果 removed 不为 NULL，把移除的元素个数写入 removed
+ */
+intset *intsetRemoveMany(intset *is, const int64_t *vals, size_t n, size_t *removed) {
+
+    uint32_t len = intrev32ifbe(is->length), i, w = 0;
+    int64_t *sorted, cur;
+    size_t m, j = 0;
+
+    if (removed) *removed = 0;
+
+    m = intsetSortUnique(vals, n, &sorted);
+    if (m == 0) return is;
+
+    for (i = 0; i < len; i++) {
+        cur = _intsetGet(is, i);
+        while (j < m && sorted[j] < cur) j++;
+
+        if (j < m && sorted[j] == cur) continue;
+        if (w != i) _intsetSet(is, w, cur);
+        w++;
+    }
+    free(sorted);
+
+    if (w == len) return is;
+
+    is = intsetResize(is, w);
+    is->length = intrev32ifbe(w);
+    if (removed) *removed = len - w;
+    return intsetDowngrade(is);
+}
+
 /**
  * 把 value 从 intset中移除
  * 移除成功将 *success 设置为1，失败则设置为0
@@ -302,11 +537,44 @@ intset *intsetRemove(intset *is, int64_t value, int *success) {
         // 紧缩空间，并更新数量计数器
         is = intsetResize(is, len - 1);
         is->length = intrev32ifbe(len - 1);
+
+        // 只有删除最小值或最大值时，编码才可能变窄
+        if (pos == 0 || pos == len - 1) is = intsetDowngrade(is);
     }
 
     return is;
 }
 
+/**
+ * 如果剩余元素的最小值和最大值可以用更窄的编码表示，就对 is 进行降级
+ * 数组有序，最小值和最大值就是第一个和最后一个元素，所以检查是 O(1) 的
+ * 降级时从前向后逐个改写：新位置的字节偏移不大于旧位置，不会覆盖还没有读取的元素
+ * 每次降级之前一定发生过一次同样是 O(N) 的升级，所以均摊下来不会增加复杂度
+ */
+intset *intsetDowngrade(intset *is) {
+
+    uint32_t len = intrev32ifbe(is->length), i;
+    uint8_t oldenc = intrev32ifbe(is->encoding), newenc;
+
+    if (oldenc == INTSET_ENC_INT16) return is;
+
+    if (len == 0) {
+        newenc = INTSET_ENC_INT16;
+    } else {
+        uint8_t minenc = _intsetValueEncoding(_intsetGetEncoded(is, 0, oldenc));
+        uint8_t maxenc = _intsetValueEncoding(_intsetGetEncoded(is, len - 1, oldenc));
+        newenc = minenc > maxenc ? minenc : maxenc;
+    }
+
+    if (newenc >= oldenc) return is;
+
+    is->encoding = intrev32ifbe(newenc);
+    for (i = 0; i < len; i++) {
+        _intsetSet(is, i, _intsetGetEncoded(is, i, oldenc));
+    }
+    return intsetResize(is, len);
+}
+
 /**
  * 查看value 是否存在于 is
  */
@@ -317,12 +585,134 @@ uint8_t intsetFind(intset *is, int64_t value) {
         intsetSearch(is, value, NULL);              // 查找value
 }
 
+/**
+ * 随机数生成器：每个线程一份 xoshiro256** 状态，不需要像 rand() 那样经过 libc 的全局锁
+ * 第一次使用时用 splitmix64 把时间和线程局部变量的地址扩展成初始状态
+ */
+static __thread uint64_t intsetRngState[4];
+static __thread int intsetRngSeeded = 0;
+
+static uint64_t intsetSplitMix64(uint64_t *x) {
+
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// 使用给定的种子初始化当前线程的随机数生成器
+void intsetRandomSeed(uint64_t seed) {
+
+    int i;
+
+    for (i = 0; i < 4; i++) intsetRngState[i] = intsetSplitMix64(&seed);
+    intsetRngSeeded = 1;
+}
+
+static inline uint64_t intsetRotl(uint64_t x, int k) {
+
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t intsetRandomNext(void) {
+
+    uint64_t *s = intsetRngState, result, t;
+
+    if (!intsetRngSeeded) intsetRandomSeed((uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&intsetRngSeeded);
+
+    result = intsetRotl(s[1] * 5, 7) * 9;
+    t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = intsetRotl(s[3], 45);
+    return result;
+}
+
+/**
+ * 返回 [0, range) 内均匀分布的随机数(Lemire 的无偏区间映射)
+ * 用乘法的高32位代替取模，只有低32位落在 2^32 % range 以内时才重新生成，几乎不需要除法
+ */
+static uint32_t intsetRandomBounded(uint32_t range) {
+
+    uint64_t m = (intsetRandomNext() >> 32) * range;
+    uint32_t l = (uint32_t)m, t;
+
+    if (l < range) {
+        t = -range % range;
+        while (l < t) {
+            m = (intsetRandomNext() >> 32) * range;
+            l = (uint32_t)m;
+        }
+    }
+    return m >> 32;
+}
+
 /**
  * 随机返回一个 intset 里的元素
  */
 int64_t intsetRandom(intset *is) {
 
-    return _intsetGet(is, rand() % intrev32ifbe(is->length));
+    return _intsetGet(is, intsetRandomBounded(intrev32ifbe(is->length)));
+}
+
+/**
+ * 随机取出 k 个元素写入 out，返回写入的个数
+ *  unique 为0时：有放回地抽取，一定写入 k 个元素
+ *  unique 不为0时：不放回地抽取，最多写入 intsetLen(is) 个元素
+ *      1. k 接近集合大小时使用选择抽样(Knuth 算法S)，一次顺序遍历，结果有序
+ *      2. k 远小于集合大小时使用 Floyd 算法，只生成 k 个随机数，用一个开放寻址的小哈希表判断位置是否已经被选中
+ */
+size_t intsetRandomMany(intset *is, size_t k, int unique, int64_t *out) {
+
+    uint32_t len = intrev32ifbe(is->length), i, j, pos;
+    uint32_t *table, mask, size, slot;
+    size_t n = 0;
+
+    if (len == 0 || k == 0) return 0;
+
+    if (!unique) {
+        for (n = 0; n < k; n++) out[n] = _intsetGet(is, intsetRandomBounded(len));
+        return k;
+    }
+
+    if (k >= len) {
+        for (i = 0; i < len; i++) out[i] = _intsetGet(is, i);
+        return len;
+    }
+
+    if (k * 4 >= len) {
+        // 还剩 len - i 个元素，需要从中选出 k - n 个，当前元素被选中的概率为 (k - n) / (len - i)
+        for (i = 0; i < len && n < k; i++) {
+            if (intsetRandomBounded(len - i) < k - n) out[n++] = _intsetGet(is, i);
+        }
+        return n;
+    }
+
+    for (size = 16; size < k * 2; size <<= 1);
+    mask = size - 1;
+    table = (uint32_t *)malloc(sizeof(uint32_t) * size);
+    if (table == NULL) return 0;
+    // 表中保存 位置+1，0 表示空槽
+    memset(table, 0, sizeof(uint32_t) * size);
+
+    for (j = len - k; j < len; j++) {
+        pos = intsetRandomBounded(j + 1);
+
+        for (slot = (pos * 2654435761U) & mask; table[slot] && table[slot] != pos + 1; slot = (slot + 1) & mask);
+        // pos 已经被选中过，改为选择 j，j 在之前的轮次中不可能被选中
+        if (table[slot]) {
+            pos = j;
+            for (slot = (pos * 2654435761U) & mask; table[slot]; slot = (slot + 1) & mask);
+        }
+        table[slot] = pos + 1;
+        out[n++] = _intsetGet(is, pos);
+    }
+
+    free(table);
+    return n;
 }
 
 /**
@@ -350,4 +740,487 @@ uint32_t intsetLen(intset *is) {
 size_t intsetBlobLen(intset *is) {
 
     return sizeof(intset) + intrev32ifbe(is->length) * intrev32ifbe(is->encoding);
+}
+
+// 返回集合中小于 value 的元素个数，value 存在时就是它的索引, O(logN)
+uint32_t intsetRank(intset *is, int64_t value) {
+
+    uint32_t pos;
+
+    intsetSearch(is, value, &pos);
+    return pos;
+}
+
+/**
+ * 返回 [min, max] 在 is 中对应的索引区间 [*from, *to)
+ * 两次 lower bound 查找：to 取 max 的插入位置，max 存在时再加一，避免计算 max + 1 时溢出
+ */
+static void intsetRangeBounds(intset *is, int64_t min, int64_t max, uint32_t *from, uint32_t *to) {
+
+    if (min > max) {
+        *from = *to = 0;
+        return;
+    }
+
+    intsetSearch(is, min, from);
+    if (intsetSearch(is, max, to)) (*to)++;
+}
+
+// 返回值在 [min, max] 之间(包含两端)的元素个数, O(logN)
+uint32_t intsetRangeCount(intset *is, int64_t min, int64_t max) {
+
+    uint32_t from, to;
+
+    intsetRangeBounds(is, min, max, &from, &to);
+    return to - from;
+}
+
+/**
+ * 把位置 [from, from + n) 上的元素连续解码到 out 中
+ * 小端机器上直接按类型读取数组，循环里没有分支，编译器可以向量化为整段的符号扩展
+ */
+static void intsetDecodeRange(intset *is, uint32_t from, uint32_t n, int64_t *out) {
+
+    uint32_t i;
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    uint32_t encoding = intrev32ifbe(is->encoding);
+
+    if (encoding == INTSET_ENC_INT64) {
+        memcpy(out, (const int64_t *)is->contents + from, n * sizeof(int64_t));
+    } else if (encoding == INTSET_ENC_INT32) {
+        const int32_t *a = (const int32_t *)is->contents + from;
+        for (i = 0; i < n; i++) out[i] = a[i];
+    } else {
+        const int16_t *a = (const int16_t *)is->contents + from;
+        for (i = 0; i < n; i++) out[i] = a[i];
+    }
+#else
+    for (i = 0; i < n; i++) out[i] = _intsetGet(is, from + i);
+#endif
+}
+
+// 初始化范围迭代器，之后按升序返回值在 [min, max] 之间的元素, O(logN)
+void intsetRangeIterInit(intset *is, int64_t min, int64_t max, intsetRangeIter *it) {
+
+    it->is = is;
+    intsetRangeBounds(is, min, max, &it->pos, &it->end);
+}
+
+// 取出范围中的下一个元素，没有更多元素时返回0
+uint8_t intsetRangeIterNext(intsetRangeIter *it, int64_t *value) {
+
+    if (it->pos >= it->end) return 0;
+    *value = _intsetGet(it->is, it->pos++);
+    return 1;
+}
+
+// 一次取出最多 n 个元素写入 out，返回取出的个数，返回0表示迭代结束
+uint32_t intsetRangeIterNextMany(intsetRangeIter *it, int64_t *out, uint32_t n) {
+
+    uint32_t left = it->end - it->pos;
+
+    if (n > left) n = left;
+    intsetDecodeRange(it->is, it->pos, n, out);
+    it->pos += n;
+    return n;
+}
+
+/**
+ * 按 Eytzinger(BFS) 顺序递归填充：values[k] 的左孩子是 values[2k]，右孩子是 values[2k+1]
+ * 对这棵隐式完全二叉树做中序遍历，依次放入有序数组中的元素
+ */
+static uint32_t intsetEytzingerFill(intsetEytzinger *ez, intset *is, uint32_t i, uint32_t k) {
+
+    if (k <= ez->length) {
+        i = intsetEytzingerFill(ez, is, i, 2 * k);
+        ez->values[k] = _intsetGet(is, i++);
+        i = intsetEytzingerFill(ez, is, i, 2 * k + 1);
+    }
+    return i;
+}
+
+// 根据 is 创建一个 Eytzinger 布局的只读查找副本
+intsetEytzinger *intsetEytzingerNew(intset *is) {
+
+    uint32_t len = intrev32ifbe(is->length);
+    intsetEytzinger *ez = (intsetEytzinger *)malloc(sizeof(intsetEytzinger) + (len + 1) * sizeof(int64_t));
+
+    if (ez == NULL) return NULL;
+
+    ez->length = len;
+    ez->values[0] = 0;
+    intsetEytzingerFill(ez, is, 0, 1);
+    return ez;
+}
+
+// 释放 Eytzinger 查找副本
+void intsetEytzingerFree(intsetEytzinger *ez) {
+
+    free(ez);
+}
+
+/**
+ * 在 Eytzinger 布局中查找 value
+ * 从根开始，每一步根据比较结果走向左孩子或右孩子，同一层的节点在内存中相邻，预取的效果比普通二分查找好
+ * 循环结束后 k 的二进制表示中，末尾的 1 对应向右走的步数，去掉它们以及最后一个 0 就得到第一个不小于 value 的节点
+ */
+uint8_t intsetEytzingerFind(const intsetEytzinger *ez, int64_t value) {
+
+    uint32_t k = 1;
+
+    while (k <= ez->length) {
+        __builtin_prefetch(ez->values + k * 8);
+        k = 2 * k + (ez->values[k] < value);
+    }
+    k >>= __builtin_ffs(~k);
+
+    return k != 0 && ez->values[k] == value;
+}
+
+/**
+ * 集合运算
+ * 两个集合的编码相同时(并且是小端机器)，直接在有序的 contents 数组上运行按类型展开的内核：
+ *  1. 归并：同时遍历两个数组，O(n + m)
+ *  2. 倍增查找(galloping)：一个集合比另一个小很多时，对小集合中的每个元素在大集合中做指数查找，O(n log m)
+ *  3. SIMD 块比较(Schlegel)：int16/int32 求交集时，每次把两个数组各取一块做全对比较
+ * 编码不同时退化为通过 _intsetGetEncoded 读取元素的归并
+ * 所有内核的 out 为 NULL 时只计数，不输出元素
+ */
+#define INTSET_OP_INTERSECT 0
+#define INTSET_OP_UNION 1
+#define INTSET_OP_DIFF 2
+
+// 大集合的元素数量超过小集合的这么多倍时，使用倍增查找
+#define INTSET_GALLOP_RATIO 32
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+
+#define INTSET_SETOP_KERNELS(T) \
+/* 在 b[from..nb) 中查找第一个不小于 value 的位置，先按 1, 2, 4... 的步长向前跳，再在最后一段中二分 */ \
+static uint32_t intsetGallop##T(const int##T##_t *b, uint32_t from, uint32_t nb, int##T##_t value) { \
+    uint32_t lo = from, step = 1, hi; \
+    while (from + step < nb && b[from + step] < value) { \
+        lo = from + step; \
+        step <<= 1; \
+    } \
+    hi = (from + step < nb) ? from + step + 1 : nb; \
+    while (lo < hi) { \
+        uint32_t mid = lo + (hi - lo) / 2; \
+        if (b[mid] < value) lo = mid + 1; else hi = mid; \
+    } \
+    return lo; \
+} \
+\
+static uint32_t intsetIntersectMerge##T(const int##T##_t *a, uint32_t na, const int##T##_t *b, uint32_t nb, int##T##_t *out) { \
+    uint32_t i = 0, j = 0, k = 0; \
+    while (i < na && j < nb) { \
+        if (a[i] < b[j]) { \
+            i++; \
+        } else if (a[i] > b[j]) { \
+            j++; \
+        } else { \
+            if (out) out[k] = a[i]; \
+            k++; i++; j++; \
+        } \
+    } \
+    return k; \
+} \
+\
+/* a 是较小的集合 */ \
+static uint32_t intsetIntersectGallop##T(const int##T##_t *a, uint32_t na, const int##T##_t *b, uint32_t nb, int##T##_t *out) { \
+    uint32_t i, j = 0, k = 0; \
+    for (i = 0; i < na && j < nb; i++) { \
+        j = intsetGallop##T(b, j, nb, a[i]); \
+        if (j < nb && b[j] == a[i]) { \
+            if (out) out[k] = a[i]; \
+            k++; \
+        } \
+    } \
+    return k; \
+} \
+\
+static uint32_t intsetUnionMerge##T(const int##T##_t *a, uint32_t na, const int##T##_t *b, uint32_t nb, int##T##_t *out) { \
+    uint32_t i = 0, j = 0, k = 0; \
+    while (i < na && j < nb) { \
+        int##T##_t v; \
+        if (a[i] < b[j]) { \
+            v = a[i++]; \
+        } else if (a[i] > b[j]) { \
+            v = b[j++]; \
+        } else { \
+            v = a[i++]; j++; \
+        } \
+        if (out) out[k] = v; \
+        k++; \
+    } \
+    if (out) { \
+        memcpy(out + k, a + i, (na - i) * sizeof(*a)); \
+        memcpy(out + k + (na - i), b + j, (nb - j) * sizeof(*b)); \
+    } \
+    return k + (na - i) + (nb - j); \
+} \
+\
+static uint32_t intsetDiffMerge##T(const int##T##_t *a, uint32_t na, const int##T##_t *b, uint32_t nb, int##T##_t *out) { \
+    uint32_t i = 0, j = 0, k = 0; \
+    while (i < na && j < nb) { \
+        if (a[i] < b[j]) { \
+            if (out) out[k] = a[i]; \
+            k++; i++; \
+        } else if (a[i] > b[j]) { \
+            j++; \
+        } else { \
+            i++; j++; \
+        } \
+    } \
+    if (out) memcpy(out + k, a + i, (na - i) * sizeof(*a)); \
+    return k + (na - i); \
+} \
+\
+/* b 比 a 大很多 */ \
+static uint32_t intsetDiffGallop##T(const int##T##_t *a, uint32_t na, const int##T##_t *b, uint32_t nb, int##T##_t *out) { \
+    uint32_t i, j = 0, k = 0; \
+    for (i = 0; i < na; i++) { \
+        if (j < nb) j = intsetGallop##T(b, j, nb, a[i]); \
+        if (j < nb && b[j] == a[i]) continue; \
+        if (out) out[k] = a[i]; \
+        k++; \
+    } \
+    return k; \
+} \
+\
+static uint32_t intsetSetOp##T(int op, const int##T##_t *a, uint32_t na, const int##T##_t *b, uint32_t nb, int##T##_t *out) { \
+    switch (op) { \
+        case INTSET_OP_INTERSECT: \
+            if (na > nb) return intsetSetOp##T(op, b, nb, a, na, out); \
+            if (nb / INTSET_GALLOP_RATIO > na) return intsetIntersectGallop##T(a, na, b, nb, out); \
+            return intsetIntersectBlock##T(a, na, b, nb, out); \
+        case INTSET_OP_UNION: \
+            return intsetUnionMerge##T(a, na, b, nb, out); \
+        default: \
+            if (nb / INTSET_GALLOP_RATIO > na) return intsetDiffGallop##T(a, na, b, nb, out); \
+            return intsetDiffMerge##T(a, na, b, nb, out); \
+    } \
+}
+
+static uint32_t intsetIntersectMerge16(const int16_t *a, uint32_t na, const int16_t *b, uint32_t nb, int16_t *out);
+static uint32_t intsetIntersectMerge32(const int32_t *a, uint32_t na, const int32_t *b, uint32_t nb, int32_t *out);
+
+/**
+ * SIMD 块比较求交集：从两个数组各取一块(8个int16或4个int32)，通过循环移位让 a 块的每个元素和 b 块的每个元素都比较一次
+ * 块中的元素互不相同，所以比较结果的掩码就是 a 块中出现在 b 块里的元素
+ * 比较完之后，最大值较小的那一块向前推进，最大值相等时两块都推进
+ */
+#if defined(__SSE2__)
+static uint32_t intsetIntersectBlock16(const int16_t *a, uint32_t na, const int16_t *b, uint32_t nb, int16_t *out) {
+
+    uint32_t i = 0, j = 0, k = 0;
+
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i cmp = _mm_cmpeq_epi16(va, vb);
+        int r, mask;
+
+        for (r = 1; r < 8; r++) {
+            vb = _mm_or_si128(_mm_srli_si128(vb, 2), _mm_slli_si128(vb, 14));
+            cmp = _mm_or_si128(cmp, _mm_cmpeq_epi16(va, vb));
+        }
+        mask = _mm_movemask_epi8(_mm_packs_epi16(cmp, _mm_setzero_si128()));
+
+        if (out) {
+            while (mask) {
+                out[k++] = a[i + __builtin_ctz(mask)];
+                mask &= mask - 1;
+            }
+        } else {
+            k += __builtin_popcount(mask);
+        }
+
+        int16_t amax = a[i + 7], bmax = b[j + 7];
+        if (amax <= bmax) i += 8;
+        if (bmax <= amax) j += 8;
+    }
+
+    return k + intsetIntersectMerge16(a + i, na - i, b + j, nb - j, out ? out + k : NULL);
+}
+
+static uint32_t intsetIntersectBlock32(const int32_t *a, uint32_t na, const int32_t *b, uint32_t nb, int32_t *out) {
+
+    uint32_t i = 0, j = 0, k = 0;
+
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i cmp = _mm_cmpeq_epi32(va, vb);
+        int mask;
+
+        cmp = _mm_or_si128(cmp, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+        cmp = _mm_or_si128(cmp, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+        cmp = _mm_or_si128(cmp, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+        mask = _mm_movemask_ps(_mm_castsi128_ps(cmp));
+
+        if (out) {
+            while (mask) {
+                out[k++] = a[i + __builtin_ctz(mask)];
+                mask &= mask - 1;
+            }
+        } else {
+            k += __builtin_popcount(mask);
+        }
+
+        int32_t amax = a[i + 3], bmax = b[j + 3];
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+
+    return k + intsetIntersectMerge32(a + i, na - i, b + j, nb - j, out ? out + k : NULL);
+}
+#else
+#define intsetIntersectBlock16 intsetIntersectMerge16
+#define intsetIntersectBlock32 intsetIntersectMerge32
+#endif
+#define intsetIntersectBlock64 intsetIntersectMerge64
+
+INTSET_SETOP_KERNELS(16)
+INTSET_SETOP_KERNELS(32)
+INTSET_SETOP_KERNELS(64)
+
+#endif
+
+// 编码不同(或者大端机器)时使用的归并，通过 _intsetGetEncoded 读取元素
+static uint32_t intsetSetOpGeneric(int op, intset *a, intset *b, intset *dst) {
+
+    uint32_t na = intrev32ifbe(a->length), nb = intrev32ifbe(b->length);
+    uint8_t enca = intrev32ifbe(a->encoding), encb = intrev32ifbe(b->encoding);
+    uint32_t i = 0, j = 0, k = 0;
+    int64_t va, vb;
+
+    while (i < na && j < nb) {
+        va = _intsetGetEncoded(a, i, enca);
+        vb = _intsetGetEncoded(b, j, encb);
+
+        if (va < vb) {
+            i++;
+            if (op == INTSET_OP_INTERSECT) continue;
+            if (dst) _intsetSet(dst, k, va);
+        } else if (va > vb) {
+            j++;
+            if (op != INTSET_OP_UNION) continue;
+            if (dst) _intsetSet(dst, k, vb);
+        } else {
+            i++;
+            j++;
+            if (op == INTSET_OP_DIFF) continue;
+            if (dst) _intsetSet(dst, k, va);
+        }
+        k++;
+    }
+
+    if (op != INTSET_OP_INTERSECT) {
+        for (; i < na; i++, k++) {
+            if (dst) _intsetSet(dst, k, _intsetGetEncoded(a, i, enca));
+        }
+    }
+    if (op == INTSET_OP_UNION) {
+        for (; j < nb; j++, k++) {
+            if (dst) _intsetSet(dst, k, _intsetGetEncoded(b, j, encb));
+        }
+    }
+    return k;
+}
+
+// 对 a 和 b 执行集合运算，dst 为 NULL 时只返回结果的元素个数
+static uint32_t intsetSetOp(int op, intset *a, intset *b, intset *dst) {
+
+    uint32_t na = intrev32ifbe(a->length), nb = intrev32ifbe(b->length);
+    uint32_t enc = intrev32ifbe(a->encoding);
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    if (enc == b->encoding && (dst == NULL || dst->encoding == enc)) {
+        if (enc == INTSET_ENC_INT64) {
+            return intsetSetOp64(op, (int64_t *)a->contents, na, (int64_t *)b->contents, nb, dst ? (int64_t *)dst->contents : NULL);
+        } else if (enc == INTSET_ENC_INT32) {
+            return intsetSetOp32(op, (int32_t *)a->contents, na, (int32_t *)b->contents, nb, dst ? (int32_t *)dst->contents : NULL);
+        } else {
+            return intsetSetOp16(op, (int16_t *)a->contents, na, (int16_t *)b->contents, nb, dst ? (int16_t *)dst->contents : NULL);
+        }
+    }
+#else
+    (void)enc;
+    (void)na;
+    (void)nb;
+#endif
+
+    return intsetSetOpGeneric(op, a, b, dst);
+}
+
+/**
+ * 按结果大小的上界一次分配新的 intset，运算完成后把多余的空间还给分配器
+ *  交集：元素同时属于两个集合，使用较窄的编码
+ *  并集：使用较宽的编码
+ *  差集：结果是 a 的子集，使用 a 的编码
+ */
+static intset *intsetSetOpNew(int op, intset *a, intset *b) {
+
+    uint32_t na = intrev32ifbe(a->length), nb = intrev32ifbe(b->length);
+    uint32_t enca = intrev32ifbe(a->encoding), encb = intrev32ifbe(b->encoding);
+    uint32_t enc, cap, len;
+    intset *dst;
+
+    if (op == INTSET_OP_INTERSECT) {
+        enc = enca < encb ? enca : encb;
+        cap = na < nb ? na : nb;
+    } else if (op == INTSET_OP_UNION) {
+        enc = enca > encb ? enca : encb;
+        cap = na + nb;
+    } else {
+        enc = enca;
+        cap = na;
+    }
+
+    dst = (intset *)malloc(sizeof(intset) + (size_t)cap * enc);
+    if (dst == NULL) return NULL;
+    dst->encoding = intrev32ifbe(enc);
+
+    len = intsetSetOp(op, a, b, dst);
+    dst->length = intrev32ifbe(len);
+    if (len < cap) dst = intsetResize(dst, len);
+    return dst;
+}
+
+// 返回 a 和 b 的交集
+intset *intsetIntersect(intset *a, intset *b) {
+
+    return intsetSetOpNew(INTSET_OP_INTERSECT, a, b);
+}
+
+// 返回 a 和 b 的并集
+intset *intsetUnion(intset *a, intset *b) {
+
+    return intsetSetOpNew(INTSET_OP_UNION, a, b);
+}
+
+// 返回 a 和 b 的差集(属于 a 但不属于 b 的元素)
+intset *intsetDifference(intset *a, intset *b) {
+
+    return intsetSetOpNew(INTSET_OP_DIFF, a, b);
+}
+
+// 返回 a 和 b 的交集的元素个数，不创建新的集合
+uint32_t intsetIntersectCard(intset *a, intset *b) {
+
+    return intsetSetOp(INTSET_OP_INTERSECT, a, b, NULL);
+}
+
+// 返回 a 和 b 的并集的元素个数，不创建新的集合
+uint32_t intsetUnionCard(intset *a, intset *b) {
+
+    return intsetSetOp(INTSET_OP_UNION, a, b, NULL);
+}
+
+// 返回 a 和 b 的差集的元素个数，不创建新的集合
+uint32_t intsetDifferenceCard(intset *a, intset *b) {
+
+    return intsetSetOp(INTSET_OP_DIFF, a, b, NULL);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define __INTSET_2_H
 
 #include <stdint.h>
+#include "demo_intset_2_endianconv.h"
 
 /* Note that these encodings are ordered, so:
  * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
@@ -15,13 +16,63 @@ typedef struct intset {
     int8_t contents[];
 } intset;
 
-uint8_t _intsetValueEncoding(int64_t v);
+// 元素数量不超过这个值时，intsetSearch 使用线性扫描代替二分查找
+#define INTSET_LINEAR_SEARCH_MAX 16
+
+/**
+ * intset 的 Eytzinger 布局副本，只用于查找
+ * values[1..length] 按照完全二叉树的层序保存所有元素，values[0] 不使用
+ * 副本不会随 intset 一起更新，intset 修改之后需要重新创建
+ */
+typedef struct intsetEytzinger {
+    uint32_t length;
+    int64_t values[];
+} intsetEytzinger;
 
-int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc);
+// 范围迭代器，返回索引区间 [pos, end) 中的元素
+typedef struct intsetRangeIter {
+    intset *is;
+    uint32_t pos;           // 下一个要返回的元素的索引
+    uint32_t end;           // 范围之后第一个元素的索引
+} intsetRangeIter;
 
-int64_t _intsetGet(intset *is, int pos);
+uint8_t _intsetValueEncoding(int64_t v);
 
-void _intsetSet(intset *is, int pos, int64_t value);
+/**
+ * 元素读写是所有操作的热点，定义为头文件中的 static inline 函数
+ * contents 总是以小端保存，按编码读写对应宽度的整数，字节序在编译期确定，小端机器上就是普通的数组访问
+ */
+// 根据给定的编码方式，返回给定位置上的值
+static inline __attribute__((always_inline)) int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
+
+    if (enc == INTSET_ENC_INT64) {
+        return (int64_t)memload64le((int64_t *)is->contents + pos);
+    } else if (enc == INTSET_ENC_INT32) {
+        return (int32_t)memload32le((int32_t *)is->contents + pos);
+    } else {
+        return (int16_t)memload16le((int16_t *)is->contents + pos);
+    }
+}
+
+// 返回intset 上给定的pos值
+static inline __attribute__((always_inline)) int64_t _intsetGet(intset *is, int pos) {
+
+    return _intsetGetEncoded(is, pos, intrev32ifbe(is->encoding));
+}
+
+// 将 inset 上给定pos的值设置为value
+static inline __attribute__((always_inline)) void _intsetSet(intset *is, int pos, int64_t value) {
+
+    uint32_t encoding = intrev32ifbe(is->encoding);
+
+    if (encoding == INTSET_ENC_INT64) {
+        memstore64le((int64_t *)is->contents + pos, (uint64_t)value);
+    } else if (encoding == INTSET_ENC_INT32) {
+        memstore32le((int32_t *)is->contents + pos, (uint32_t)value);
+    } else {
+        memstore16le((int16_t *)is->contents + pos, (uint16_t)value);
+    }
+}
 
 // 创建一个新的整数集合, O(1)
 intset *intsetNew(void);
@@ -29,6 +80,11 @@ intset *intsetNew(void);
 // 调整intset的大小
 intset *intsetResize(intset *is, uint32_t len);
 
+/**
+ * 查找 value 在 is 中的索引
+ *  查找成功时，将索引保存到pos，并返回1
+ *  查找失败时，返回0，并将value可以插入的索引保存到pos
+ */
 uint8_t intsetSearch(intset *s, int64_t value, uint32_t *pos);
 
 intset *intsetUpgradeAnAdd(intset *s, int64_t value);
@@ -38,15 +94,40 @@ void intsetMoveTail(intset *is, uint32_t from, uint32_t to);
 // 将给定的元素添加到整数集合中, O(N)
 intset *intsetAdd(intset *is, int64_t value, uint8_t *success);
 
-// 从整数集合中移除给定元素, O(N)
+// 从整数集合中移除给定元素, O(N)。移除最小值或最大值之后，如果可能会自动降级编码
 intset *intsetRemove(intset *is, int64_t value, int *success);
 
+// 如果剩余元素可以用更窄的编码表示，就原地降级并释放多余的空间
+intset *intsetDowngrade(intset *is);
+
+/**
+ * 批量添加 n 个元素，编码最多升级一次，内存只扩容一次，O(N + KlogK)
+ * 如果 added 不为 NULL，把新添加的元素个数写入 added
+ */
+intset *intsetAddMany(intset *is, const int64_t *vals, size_t n, size_t *added);
+
+/**
+ * 批量移除 n 个元素，一次遍历完成压缩，内存只缩容一次，O(N + KlogK)
+ * 如果 removed 不为 NULL，把移除的元素个数写入 removed
+ */
+intset *intsetRemoveMany(intset *is, const int64_t *vals, size_t n, size_t *removed);
+
 // 检查给定值是否存在于集合，因为底层数组有序，查找可以通过二分查找来进行。所以复杂度为O(logN)
 uint8_t insetFind(intset *is, int64_t value);
 
 // 从整数集合中随机返回一个元素
 int64_t intsetRandom(intset *is);
 
+/**
+ * 随机取出 k 个元素写入 out，返回写入的个数
+ * unique 不为0时元素不会重复，最多返回 intsetLen(is) 个元素(对应 SRANDMEMBER 的正数 count)
+ * unique 为0时元素可能重复，总是返回 k 个元素(对应 SRANDMEMBER 的负数 count)
+ */
+size_t intsetRandomMany(intset *is, size_t k, int unique, int64_t *out);
+
+// 使用给定的种子初始化当前线程的随机数生成器，不调用时使用时间作为种子
+void intsetRandomSeed(uint64_t seed);
+
 // 取出底层数组在给定索引上的元素, O(1)
 uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);
 
@@ -58,4 +139,46 @@ size_t intsetBlobLen(intset *s);
 
 uint8_t intsetFind(intset *is, int64_t value);
 
+// 返回集合中小于 value 的元素个数，value 存在时就是它的索引, O(logN)
+uint32_t intsetRank(intset *is, int64_t value);
+
+// 返回值在 [min, max] 之间(包含两端)的元素个数，min > max 时返回0, O(logN)
+uint32_t intsetRangeCount(intset *is, int64_t min, int64_t max);
+
+// 初始化范围迭代器，之后按升序返回值在 [min, max] 之间的元素, O(logN)
+void intsetRangeIterInit(intset *is, int64_t min, int64_t max, intsetRangeIter *it);
+
+// 取出范围中的下一个元素，没有更多元素时返回0
+uint8_t intsetRangeIterNext(intsetRangeIter *it, int64_t *value);
+
+// 一次取出最多 n 个元素写入 out(连续解码)，返回取出的个数，返回0表示迭代结束
+uint32_t intsetRangeIterNextMany(intsetRangeIter *it, int64_t *out, uint32_t n);
+
+/**
+ * 集合运算，结果是新创建的 intset，只分配一次内存(多余的空间会在运算完成后归还)
+ * 两个集合编码相同时直接在有序数组上归并，大小悬殊时使用倍增查找，int16/int32 求交集使用 SIMD 块比较
+ */
+intset *intsetIntersect(intset *a, intset *b);
+
+intset *intsetUnion(intset *a, intset *b);
+
+// 属于 a 但不属于 b 的元素
+intset *intsetDifference(intset *a, intset *b);
+
+// 只计算集合运算结果的元素个数，不创建新的集合
+uint32_t intsetIntersectCard(intset *a, intset *b);
+
+uint32_t intsetUnionCard(intset *a, intset *b);
+
+uint32_t intsetDifferenceCard(intset *a, intset *b);
+
+// 根据 is 创建一个 Eytzinger 布局的只读查找副本，适合元素很多且很少修改的集合
+intsetEytzinger *intsetEytzingerNew(intset *is);
+
+// 释放 Eytzinger 查找副本
+void intsetEytzingerFree(intsetEytzinger *ez);
+
+// 在 Eytzinger 布局中查找 value, O(logN)
+uint8_t intsetEytzingerFind(const intsetEytzinger *ez, int64_t value);
+
 #endif
\ No newline at end of file
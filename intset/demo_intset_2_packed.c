@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "demo_intset_2_packed.h"
+#include "demo_intset_2_endianconv.h"
+
+// 块中 data 的字节数，末尾多留8个字节，读取时总是可以一次读8个字节
+static size_t pintsetBlockDataLen(uint32_t count, uint8_t bits) {
+
+    return ((size_t)count * bits + 7) / 8 + 8;
+}
+
+// 块占用的内存字节数
+static size_t pintsetBlockSize(const pintsetBlock *b) {
+
+    return sizeof(pintsetBlock) + pintsetBlockDataLen(b->count, b->bits);
+}
+
+// 从第 bitpos 位开始读取 bits 位
+static uint64_t pintsetUnpack(const uint8_t *data, uint8_t bits, uint64_t bitpos) {
+
+    const uint8_t *p = data + bitpos / 8;
+    uint32_t shift = bitpos & 7;
+    uint64_t w, v;
+
+    memcpy(&w, p, sizeof(w));
+    memrev64ifbe(&w);
+    v = w >> shift;
+
+    // 跨越了9个字节
+    if (shift + bits > 64) v |= (uint64_t)p[8] << (64 - shift);
+
+    return bits == 64 ? v : v & ((1ULL << bits) - 1);
+}
+
+// 从第 bitpos 位开始写入 bits 位，data 必须已经清零
+static void pintsetPack(uint8_t *data, uint8_t bits, uint64_t bitpos, uint64_t v) {
+
+    uint8_t *p = data + bitpos / 8;
+    uint32_t shift = bitpos & 7;
+    uint64_t w;
+
+    memcpy(&w, p, sizeof(w));
+    memrev64ifbe(&w);
+    w |= v << shift;
+    memrev64ifbe(&w);
+    memcpy(p, &w, sizeof(w));
+
+    if (shift + bits > 64) p[8] |= (uint8_t)(v >> (64 - shift));
+}
+
+// 返回块中第 i 个元素
+static int64_t pintsetBlockGet(const pintsetBlock *b, uint32_t i) {
+
+    if (b->bits == 0) return b->base;
+    return (int64_t)((uint64_t)b->base + pintsetUnpack(b->data, b->bits, (uint64_t)i * b->bits));
+}
+
+/**
+ * 把有序的 vals 编码为一个块
+ * 差值的范围可能超过 int64，所以使用无符号减法
+ */
+static pintsetBlock *pintsetBlockEncode(const int64_t *vals, uint32_t n) {
+
+    uint64_t range = (uint64_t)vals[n - 1] - (uint64_t)vals[0];
+    uint8_t bits = range ? 64 - __builtin_clzll(range) : 0;
+    size_t datalen = pintsetBlockDataLen(n, bits);
+    pintsetBlock *b = (pintsetBlock *)malloc(sizeof(pintsetBlock) + datalen);
+    uint32_t i;
+
+    b->base = vals[0];
+    b->count = n;
+    b->bits = bits;
+    memset(b->data, 0, datalen);
+
+    if (bits) {
+        for (i = 1; i < n; i++) {
+            pintsetPack(b->data, bits, (uint64_t)i * bits, (uint64_t)vals[i] - (uint64_t)vals[0]);
+        }
+    }
+    return b;
+}
+
+/**
+ * 把一整块解码到 out 中
+ * 常见的字节对齐宽度使用按类型读取的循环，编译器可以把它们向量化
+ * 其他不超过 56 位的宽度顺序解码：acc 中始终缓存至少 56 位，每次补充时读取8个字节，
+ * 每个元素只需要一次移位和一次与运算，不需要像 pintsetUnpack 那样重新计算位置
+ */
+uint32_t pintsetBlockDecode(const pintsetBlock *b, int64_t *out) {
+
+    uint64_t base = b->base;
+    uint32_t i, n = b->count;
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    if (b->bits == 8) {
+        for (i = 0; i < n; i++) out[i] = (int64_t)(base + b->data[i]);
+        return n;
+    } else if (b->bits == 16) {
+        uint16_t d[PINTSET_BLOCK_MAX];
+        memcpy(d, b->data, n * sizeof(uint16_t));
+        for (i = 0; i < n; i++) out[i] = (int64_t)(base + d[i]);
+        return n;
+    } else if (b->bits == 32) {
+        uint32_t d[PINTSET_BLOCK_MAX];
+        memcpy(d, b->data, n * sizeof(uint32_t));
+        for (i = 0; i < n; i++) out[i] = (int64_t)(base + d[i]);
+        return n;
+    }
+#endif
+
+    if (b->bits > 0 && b->bits <= 56) {
+        const uint8_t *p = b->data;
+        uint64_t acc = 0, w, mask = (1ULL << b->bits) - 1;
+        uint32_t avail = 0, bytes;
+
+        for (i = 0; i < n; i++) {
+            if (avail < b->bits) {
+                // 补充到至少 56 位，data 末尾多留的8个字节保证这里不会越界
+                memcpy(&w, p, sizeof(w));
+                memrev64ifbe(&w);
+                acc |= w << avail;
+                bytes = (63 - avail) >> 3;
+                p += bytes;
+                avail += bytes * 8;
+            }
+            out[i] = (int64_t)(base + (acc & mask));
+            acc >>= b->bits;
+            avail -= b->bits;
+        }
+        return n;
+    }
+
+    for (i = 0; i < n; i++) out[i] = pintsetBlockGet(b, i);
+    return n;
+}
+
+// 在块中查找第一个不小于 value 的位置
+static uint32_t pintsetBlockSearch(const pintsetBlock *b, int64_t value) {
+
+    uint32_t lo = 0, hi = b->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (pintsetBlockGet(b, mid) < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// 返回 base 不大于 value 的最后一个块，所有块的 base 都比 value 大时返回0
+static uint32_t pintsetFindBlock(pintset *pis, int64_t value) {
+
+    uint32_t lo = 0, hi = pis->nblocks, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (pis->blocks[mid]->base <= value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? lo - 1 : 0;
+}
+
+// 从第 idx 块开始重新计算 offsets
+static void pintsetUpdateOffsets(pintset *pis, uint32_t idx) {
+
+    uint32_t i;
+
+    for (i = idx; i < pis->nblocks; i++) {
+        pis->offsets[i] = i ? pis->offsets[i - 1] + pis->blocks[i - 1]->count : 0;
+    }
+}
+
+// 在 blocks 的 idx 处插入 count 个空位，offsets 由调用者在填好块之后更新
+static void pintsetInsertBlocks(pintset *pis, uint32_t idx, uint32_t count) {
+
+    pis->blocks = (pintsetBlock **)realloc(pis->blocks, sizeof(pintsetBlock *) * (pis->nblocks + count));
+    pis->offsets = (uint32_t *)realloc(pis->offsets, sizeof(uint32_t) * (pis->nblocks + count));
+
+    memmove(pis->blocks + idx + count, pis->blocks + idx, sizeof(pintsetBlock *) * (pis->nblocks - idx));
+    pis->nblocks += count;
+}
+
+// 删除 blocks 中 idx 处的块指针
+static void pintsetDeleteBlock(pintset *pis, uint32_t idx) {
+
+    memmove(pis->blocks + idx, pis->blocks + idx + 1, sizeof(pintsetBlock *) * (pis->nblocks - idx - 1));
+    pis->nblocks--;
+}
+
+// 创建一个空的 pintset
+pintset *pintsetNew(void) {
+
+    pintset *pis = (pintset *)malloc(sizeof(pintset));
+
+    pis->length = 0;
+    pis->nblocks = 0;
+    pis->blocks = NULL;
+    pis->offsets = NULL;
+    return pis;
+}
+
+// 释放 pintset
+void pintsetFree(pintset *pis) {
+
+    uint32_t i;
+
+    if (pis == NULL) return;
+    for (i = 0; i < pis->nblocks; i++) free(pis->blocks[i]);
+    free(pis->blocks);
+    free(pis->offsets);
+    free(pis);
+}
+
+// 根据 intset 创建 pintset，每 PINTSET_BLOCK_MAX 个元素编码为一块
+pintset *pintsetFromIntset(intset *is) {
+
+    pintset *pis = pintsetNew();
+    uint32_t len = intsetLen(is), i, j, k, n;
+    int64_t buf[PINTSET_BLOCK_MAX];
+
+    pis->nblocks = (len + PINTSET_BLOCK_MAX - 1) / PINTSET_BLOCK_MAX;
+    pis->blocks = (pintsetBlock **)malloc(sizeof(pintsetBlock *) * (pis->nblocks ? pis->nblocks : 1));
+    pis->offsets = (uint32_t *)malloc(sizeof(uint32_t) * (pis->nblocks ? pis->nblocks : 1));
+    pis->length = len;
+
+    for (i = 0, j = 0; i < len; i += n, j++) {
+        n = len - i < PINTSET_BLOCK_MAX ? len - i : PINTSET_BLOCK_MAX;
+        for (k = 0; k < n; k++) buf[k] = _intsetGet(is, i + k);
+        pis->blocks[j] = pintsetBlockEncode(buf, n);
+        pis->offsets[j] = i;
+    }
+    return pis;
+}
+
+/**
+ * 将 value 添加到集合中
+ * 解码目标块，插入新元素后重新编码；元素超过 PINTSET_BLOCK_MAX 时把块平分为两块
+ */
+pintset *pintsetAdd(pintset *pis, int64_t value, uint8_t *success) {
+
+    int64_t buf[PINTSET_BLOCK_MAX + 1];
+    uint32_t idx, pos, n, half;
+    pintsetBlock *b;
+
+    if (success) *success = 0;
+
+    if (pis->nblocks == 0) {
+        pintsetInsertBlocks(pis, 0, 1);
+        pis->blocks[0] = pintsetBlockEncode(&value, 1);
+        pis->offsets[0] = 0;
+        pis->length = 1;
+        if (success) *success = 1;
+        return pis;
+    }
+
+    idx = pintsetFindBlock(pis, value);
+    b = pis->blocks[idx];
+    pos = pintsetBlockSearch(b, value);
+    if (pos < b->count && pintsetBlockGet(b, pos) == value) return pis;
+
+    n = pintsetBlockDecode(b, buf);
+    memmove(buf + pos + 1, buf + pos, sizeof(int64_t) * (n - pos));
+    buf[pos] = value;
+    n++;
+
+    if (n <= PINTSET_BLOCK_MAX) {
+        pis->blocks[idx] = pintsetBlockEncode(buf, n);
+    } else {
+        pintsetInsertBlocks(pis, idx + 1, 1);
+        half = n / 2;
+        pis->blocks[idx] = pintsetBlockEncode(buf, half);
+        pis->blocks[idx + 1] = pintsetBlockEncode(buf + half, n - half);
+    }
+    free(b);
+    pintsetUpdateOffsets(pis, idx + 1);
+
+    pis->length++;
+    if (success) *success = 1;
+    return pis;
+}
+
+/**
+ * 把 value 从集合中移除
+ * 块变空时删除该块；块中的元素少于 PINTSET_BLOCK_MAX / 4 时，如果能和后一块放进一块，就合并它们
+ */
+pintset *pintsetRemove(pintset *pis, int64_t value, int *success) {
+
+    int64_t buf[PINTSET_BLOCK_MAX * 2];
+    uint32_t idx, pos, n;
+    pintsetBlock *b;
+
+    if (success) *success = 0;
+    if (pis->nblocks == 0) return pis;
+
+    idx = pintsetFindBlock(pis, value);
+    b = pis->blocks[idx];
+    pos = pintsetBlockSearch(b, value);
+    if (pos >= b->count || pintsetBlockGet(b, pos) != value) return pis;
+
+    n = pintsetBlockDecode(b, buf);
+    memmove(buf + pos, buf + pos + 1, sizeof(int64_t) * (n - pos - 1));
+    n--;
+    free(b);
+
+    if (n == 0) {
+        pintsetDeleteBlock(pis, idx);
+    } else if (n < PINTSET_BLOCK_MAX / 4 && idx + 1 < pis->nblocks &&
+               n + pis->blocks[idx + 1]->count <= PINTSET_BLOCK_MAX) {
+        pintsetBlock *next = pis->blocks[idx + 1];
+        n += pintsetBlockDecode(next, buf + n);
+        free(next);
+        pintsetDeleteBlock(pis, idx + 1);
+        pis->blocks[idx] = pintsetBlockEncode(buf, n);
+    } else {
+        pis->blocks[idx] = pintsetBlockEncode(buf, n);
+    }
+    pintsetUpdateOffsets(pis, idx);
+
+    pis->length--;
+    if (success) *success = 1;
+    return pis;
+}
+
+// 先按 base 二分找到块，再在块内二分
+uint8_t pintsetFind(pintset *pis, int64_t value) {
+
+    pintsetBlock *b;
+    uint32_t pos;
+
+    if (pis->nblocks == 0) return 0;
+
+    b = pis->blocks[pintsetFindBlock(pis, value)];
+    pos = pintsetBlockSearch(b, value);
+    return pos < b->count && pintsetBlockGet(b, pos) == value;
+}
+
+// 取出第 pos 个元素，先按 offsets 二分找到块，再在块内 O(1) 解码
+uint8_t pintsetGet(pintset *pis, uint32_t pos, int64_t *value) {
+
+    uint32_t lo = 0, hi = pis->nblocks, mid;
+
+    if (pos >= pis->length) return 0;
+
+    // 找到 offsets 不大于 pos 的最后一个块
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (pis->offsets[mid] <= pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    lo--;
+    *value = pintsetBlockGet(pis->blocks[lo], pos - pis->offsets[lo]);
+    return 1;
+}
+
+// 返回元素个数
+uint32_t pintsetLen(pintset *pis) {
+
+    return pis->length;
+}
+
+// 返回 pintset 占用的内存字节数
+size_t pintsetBlobLen(pintset *pis) {
+
+    size_t size = sizeof(pintset) + (sizeof(pintsetBlock *) + sizeof(uint32_t)) * pis->nblocks;
+    uint32_t i;
+
+    for (i = 0; i < pis->nblocks; i++) size += pintsetBlockSize(pis->blocks[i]);
+    return size;
+}
+
+// 初始化迭代器
+void pintsetIterInit(pintset *pis, pintsetIter *it) {
+
+    it->pis = pis;
+    it->block = 0;
+    it->index = 0;
+    it->count = 0;
+}
+
+// 按升序取出下一个元素，当前块用完时解码下一块
+uint8_t pintsetNext(pintsetIter *it, int64_t *value) {
+
+    if (it->index >= it->count) {
+        if (it->block >= it->pis->nblocks) return 0;
+        it->count = pintsetBlockDecode(it->pis->blocks[it->block++], it->buf);
+        it->index = 0;
+    }
+    *value = it->buf[it->index++];
+    return 1;
+}
@@ -0,0 +1,83 @@
+#ifndef __INTSET_2_PACKED_H
+#define __INTSET_2_PACKED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "demo_intset_2.h"
+
+/**
+ * pintset: 分块位压缩的整数集合
+ *
+ * intset 的所有元素使用同一个宽度，只要有一个值超出 int32 的范围，所有元素都会占用8个字节
+ * pintset 把有序的元素按每 PINTSET_BLOCK_MAX 个分为一块，每块单独编码(frame-of-reference)：
+ *  1. base 是块中的最小值
+ *  2. 其他元素只保存与 base 的差值，所有差值使用能容纳块中最大差值的最少位数(bits)紧密排列
+ * 块内任意位置的元素都可以 O(1) 解码，所以块内可以直接二分查找
+ *
+ * | blocks[0] | blocks[1] | ... |
+ *      |
+ *      v
+ * | base | count | bits | 位压缩的差值 ... |
+ */
+#define PINTSET_BLOCK_MAX 128
+
+typedef struct __attribute__((__packed__)) pintsetBlock {
+    int64_t base;           // 块中的最小值
+    uint16_t count;         // 块中的元素个数
+    uint8_t bits;           // 每个差值占用的位数，0 表示块中只有一个元素
+    uint8_t data[];         // 位压缩的差值，末尾多分配8个字节，方便一次读取8个字节
+} pintsetBlock;
+
+typedef struct pintset {
+    uint32_t length;        // 元素总数
+    uint32_t nblocks;       // 块的数量
+    pintsetBlock **blocks;  // 按 base 升序排列的块
+    uint32_t *offsets;      // offsets[i] 是第 i 块之前的元素个数，用于按位置二分查找
+} pintset;
+
+// 迭代器每次把一整块解码到 buf 中，之后的元素直接从 buf 中读取
+typedef struct pintsetIter {
+    pintset *pis;
+    uint32_t block;         // 下一个要解码的块
+    uint32_t index;         // buf 中下一个元素的位置
+    uint32_t count;         // buf 中的元素个数
+    int64_t buf[PINTSET_BLOCK_MAX];
+} pintsetIter;
+
+// 创建一个空的 pintset
+pintset *pintsetNew(void);
+
+// 释放 pintset
+void pintsetFree(pintset *pis);
+
+// 根据 intset 创建 pintset，O(N)
+pintset *pintsetFromIntset(intset *is);
+
+// 将给定的元素添加到集合中，已经存在时 *success 设置为0
+pintset *pintsetAdd(pintset *pis, int64_t value, uint8_t *success);
+
+// 从集合中移除给定元素，不存在时 *success 设置为0
+pintset *pintsetRemove(pintset *pis, int64_t value, int *success);
+
+// 检查给定值是否存在于集合, O(logN)
+uint8_t pintsetFind(pintset *pis, int64_t value);
+
+// 取出第 pos 个元素，pos 超出范围时返回0, O(logN)
+uint8_t pintsetGet(pintset *pis, uint32_t pos, int64_t *value);
+
+// 返回元素个数
+uint32_t pintsetLen(pintset *pis);
+
+// 返回 pintset 占用的内存字节数
+size_t pintsetBlobLen(pintset *pis);
+
+// 把一整块解码到 out 中，返回元素个数。8、16、32 位直接按类型读取，其他不超过 56 位的宽度顺序解码，更宽的块逐个读取
+uint32_t pintsetBlockDecode(const pintsetBlock *b, int64_t *out);
+
+// 初始化迭代器
+void pintsetIterInit(pintset *pis, pintsetIter *it);
+
+// 按升序取出下一个元素，没有更多元素时返回0
+uint8_t pintsetNext(pintsetIter *it, int64_t *value);
+
+#endif
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
-#include "demo_intset_1.h"
-#include "demo_intset_1_endianconv.h"
+#include "demo_intset_2.h"
+#include "demo_intset_2_packed.h"
+#include "demo_intset_2_endianconv.h"
 #include <sys/time.h>
 
 void test_case_endianconv() {
@@ -36,7 +38,7 @@ void ok(void) {
 void checkConsistency(intset *is) {
     int i;
 
-    for (i = 0; i < (intrev32ifbe(is->length)-1); i++) {
+    for (i = 0; i + 1 < intrev32ifbe(is->length); i++) {
         uint32_t encoding = intrev32ifbe(is->encoding);
 
         if (encoding == INTSET_ENC_INT16) {
@@ -74,6 +76,103 @@ intset *createSet(int bits, int size) {
     return is;
 }
 
+/**
+ * 原来的二分查找，每次比较都通过 _intsetGet 读取元素
+ * 用来验证 intsetSearch 的结果，并作为性能对比的基准
+ */
+uint8_t intsetSearchReference(intset *is, int64_t value, uint32_t *pos) {
+
+    int min = 0, max = intrev32ifbe(is->length) - 1, mid = -1;
+    int64_t cur = -1;
+
+    if (intrev32ifbe(is->length) == 0) {
+        if (pos) *pos = 0;
+        return 0;
+    } else if (value > _intsetGet(is, max)) {
+        if (pos) *pos = intrev32ifbe(is->length);
+        return 0;
+    } else if (value < _intsetGet(is, 0)) {
+        if (pos) *pos = 0;
+        return 0;
+    }
+
+    while (max >= min) {
+        mid = ((unsigned int)min + (unsigned int)max) >> 1;
+        cur = _intsetGet(is, mid);
+        if (value > cur) {
+            min = mid + 1;
+        } else if (value < cur) {
+            max = mid - 1;
+        } else {
+            break;
+        }
+    }
+
+    if (value == cur) {
+        if (pos) *pos = mid;
+        return 1;
+    }
+    if (pos) *pos = min;
+    return 0;
+}
+
+// 按升序添加 size 个元素，第 i 个元素为 base + i * stride
+intset *createSequentialSet(int64_t base, int64_t stride, int size) {
+
+    intset *is = intsetNew();
+    int i;
+
+    for (i = 0; i < size; i++) {
+        is = intsetAdd(is, base + i * stride, NULL);
+    }
+    return is;
+}
+
+// 用逐个探测的方式计算集合运算，作为验证和性能对比的基准
+intset *intsetSetOpProbe(int op, intset *a, intset *b) {
+
+    intset *dst = intsetNew();
+    uint32_t i;
+    int64_t v;
+
+    for (i = 0; i < intsetLen(a); i++) {
+        intsetGet(a, i, &v);
+        if (intsetFind(b, v) == (op == 0) || op == 1) dst = intsetAdd(dst, v, NULL);
+    }
+    if (op == 1) {
+        for (i = 0; i < intsetLen(b); i++) {
+            intsetGet(b, i, &v);
+            dst = intsetAdd(dst, v, NULL);
+        }
+    }
+    return dst;
+}
+
+int intsetEqual(intset *a, intset *b) {
+
+    uint32_t i;
+    int64_t va, vb;
+
+    if (intsetLen(a) != intsetLen(b)) return 0;
+    for (i = 0; i < intsetLen(a); i++) {
+        intsetGet(a, i, &va);
+        intsetGet(b, i, &vb);
+        if (va != vb) return 0;
+    }
+    return 1;
+}
+
+// 创建 size 个元素的随机集合，元素取自 [base, base + range)
+intset *createRandomSet(int64_t base, int64_t range, int size) {
+
+    intset *is = intsetNew();
+    int i;
+
+    for (i = 0; i < size; i++) {
+        is = intsetAdd(is, base + ((int64_t)rand() * RAND_MAX + rand()) % range, NULL);
+    }
+    return is;
+}
 
 void test_case_intset() {
 
@@ -110,7 +209,7 @@ void test_case_intset() {
         is = intsetAdd(is, 6, &success); assert(success);
         is = intsetAdd(is, 4, &success); assert(success);
         is = intsetAdd(is, 4, &success); assert(!success);
-        
+        free(is);
         ok();
     }
 
@@ -126,6 +225,7 @@ void test_case_intset() {
 
         assert(intrev32ifbe(is->length) == inserts);
         checkConsistency(is);
+        free(is);
         ok();
     }
 
@@ -141,6 +241,7 @@ void test_case_intset() {
         assert(intsetFind(is, 32));
         assert(intsetFind(is, 65535));
         checkConsistency(is);
+        free(is);
 
         is = intsetNew();
         is = intsetAdd(is, 32, NULL);
@@ -152,6 +253,7 @@ void test_case_intset() {
         assert(intsetFind(is, 32));
         assert(intsetFind(is, -65535));
         checkConsistency(is);
+        free(is);
         ok();
     }
 
@@ -167,6 +269,7 @@ void test_case_intset() {
         assert(intsetFind(is, 32));
         assert(intsetFind(is, 4294967295));
         checkConsistency(is);
+        free(is);
 
         is = intsetNew();
         is = intsetAdd(is, 32, NULL);
@@ -177,6 +280,7 @@ void test_case_intset() {
         assert(intsetFind(is, 32));
         assert(intsetFind(is, -4294967295));
         checkConsistency(is);
+        free(is);
         ok();
     }
 
@@ -192,6 +296,7 @@ void test_case_intset() {
         assert(intsetFind(is, 65535));
         assert(intsetFind(is, 4294967295));
         checkConsistency(is);
+        free(is);
 
         is = intsetNew();
         is = intsetAdd(is, 65535, NULL);
@@ -203,6 +308,7 @@ void test_case_intset() {
         assert(intsetFind(is, 65535));
         assert(intsetFind(is, -4294967295));
         checkConsistency(is);
+        free(is);
         ok();
     }
 
@@ -219,6 +325,689 @@ void test_case_intset() {
             intsetSearch(is, rand() % ((1 << bits) - 1), NULL);
         }
         printf("%ld, lookups, %ld element set, %lld used\n", num, size, usec() - start);
+        free(is);
+    }
+
+    printf("Search kernels match reference: ");
+    {
+        int64_t bases[3] = {-1000, -100000, -10000000000LL};
+        int64_t strides[3] = {3, 3000, 3000000000LL};
+        int sizes[8] = {1, 2, 7, 8, 63, 64, 65, 1000};
+        int e, j, k;
+
+        for (e = 0; e < 3; e++) {
+            for (j = 0; j < 8; j++) {
+                is = createSequentialSet(bases[e], strides[e], sizes[j]);
+                intsetEytzinger *ez = intsetEytzingerNew(is);
+
+                for (k = -2; k < sizes[j] * 3 + 2; k++) {
+                    int64_t value = bases[e] + k * (strides[e] / 3);
+                    uint32_t pos1, pos2;
+                    uint8_t found1 = intsetSearch(is, value, &pos1);
+                    uint8_t found2 = intsetSearchReference(is, value, &pos2);
+
+                    assert(found1 == found2 && pos1 == pos2);
+                    assert(intsetEytzingerFind(ez, value) == found2);
+                }
+
+                // 超出当前编码范围的值
+                assert(!intsetSearch(is, INT64_MAX, NULL));
+                assert(!intsetSearch(is, INT64_MIN, NULL));
+
+                intsetEytzingerFree(ez);
+                free(is);
+            }
+        }
+        ok();
+    }
+
+    printf("Search benchmark:\n");
+    {
+        int64_t bases[3] = {-32768, INT32_MIN, INT64_MIN / 2};
+        int64_t strides[3] = {1, 32768, 1LL << 33};
+        const char *names[3] = {"int16", "int32", "int64"};
+        int e, size, j, lookups = 200000;
+        long long start, t1, t2, t3;
+        uint32_t hits1, hits2, hits3;
+
+        for (e = 0; e < 3; e++) {
+            for (size = 8; size <= 65536; size *= 2) {
+                is = createSequentialSet(bases[e], strides[e], size);
+                intsetEytzinger *ez = intsetEytzingerNew(is);
+                int64_t *values = (int64_t *)malloc(sizeof(int64_t) * lookups);
+
+                // 一半命中，一半不命中
+                for (j = 0; j < lookups; j++) {
+                    values[j] = bases[e] + (int64_t)(rand() % size) * strides[e] + (j & 1);
+                }
+
+                hits1 = hits2 = hits3 = 0;
+                start = usec();
+                for (j = 0; j < lookups; j++) hits1 += intsetSearchReference(is, values[j], NULL);
+                t1 = usec() - start;
+
+                start = usec();
+                for (j = 0; j < lookups; j++) hits2 += intsetFind(is, values[j]);
+                t2 = usec() - start;
+
+                start = usec();
+                for (j = 0; j < lookups; j++) hits3 += intsetEytzingerFind(ez, values[j]);
+                t3 = usec() - start;
+
+                assert(hits1 == hits2 && hits1 == hits3);
+                printf("  %s %6d elements: reference %4.1f ns, intsetFind %4.1f ns, eytzinger %4.1f ns\n",
+                    names[e], size, t1 * 1000.0 / lookups, t2 * 1000.0 / lookups, t3 * 1000.0 / lookups);
+
+                free(values);
+                intsetEytzingerFree(ez);
+                free(is);
+            }
+        }
+    }
+
+    printf("Accessor benchmark:\n");
+    {
+        int64_t bases[3] = {-32768, INT32_MIN, INT64_MIN / 2};
+        int64_t strides[3] = {1, 32768, 1LL << 33};
+        const char *names[3] = {"int16", "int32", "int64"};
+        int e, j, round, rounds = 50, size = 65536, lookups = 1000000;
+        int64_t *values = (int64_t *)malloc(sizeof(int64_t) * lookups);
+        uint64_t sum = 0;                   // 无符号累加，溢出时回绕而不是未定义行为
+        long long start, t1, t2;
+        uint32_t hits = 0;
+
+        for (e = 0; e < 3; e++) {
+            is = createSequentialSet(bases[e], strides[e], size);
+            for (j = 0; j < lookups; j++) values[j] = bases[e] + (int64_t)(rand() % size) * strides[e] + (j & 1);
+
+            // 顺序读取所有元素，衡量 _intsetGet 本身的开销
+            start = usec();
+            for (round = 0; round < rounds; round++) {
+                for (j = 0; j < size; j++) sum += (uint64_t)_intsetGet(is, j);
+            }
+            t1 = usec() - start;
+
+            start = usec();
+            for (j = 0; j < lookups; j++) hits += intsetSearch(is, values[j], NULL);
+            t2 = usec() - start;
+
+            printf("  %s: _intsetGet %.2f ns/element, intsetSearch %.1f ns/lookup\n",
+                names[e], t1 * 1000.0 / ((double)rounds * size), t2 * 1000.0 / lookups);
+            free(is);
+        }
+        assert(sum != 0 && hits != 0);
+        free(values);
+    }
+
+    printf("Set algebra matches probe loop: ");
+    {
+        int64_t bases[3] = {-2000, -200000, -20000000000LL};
+        int sizes[5] = {0, 3, 17, 200, 3000};
+        int ea, eb, sa, sb, op;
+
+        for (ea = 0; ea < 3; ea++) {
+            for (eb = 0; eb < 3; eb++) {
+                for (sa = 0; sa < 5; sa++) {
+                    for (sb = 0; sb < 5; sb++) {
+                        intset *a = createRandomSet(bases[ea], 4000, sizes[sa]);
+                        intset *b = createRandomSet(bases[eb] + 1000, 4000, sizes[sb]);
+
+                        // 让集合编码一定符合预期
+                        a = intsetAdd(a, bases[ea], NULL);
+                        b = intsetAdd(b, bases[eb], NULL);
+
+                        for (op = 0; op < 3; op++) {
+                            intset *expect = intsetSetOpProbe(op, a, b);
+                            intset *got = op == 0 ? intsetIntersect(a, b) : (op == 1 ? intsetUnion(a, b) : intsetDifference(a, b));
+                            uint32_t card = op == 0 ? intsetIntersectCard(a, b) : (op == 1 ? intsetUnionCard(a, b) : intsetDifferenceCard(a, b));
+
+                            assert(intsetEqual(expect, got));
+                            assert(card == intsetLen(expect));
+                            assert(intsetBlobLen(got) == sizeof(intset) + intsetLen(got) * intrev32ifbe(got->encoding));
+                            checkConsistency(got);
+                            free(expect);
+                            free(got);
+                        }
+                        free(a);
+                        free(b);
+                    }
+                }
+            }
+        }
+        ok();
+    }
+
+    printf("Set algebra benchmark:\n");
+    {
+        int64_t bases[3] = {-32768, -1000000, -10000000000LL};
+        int64_t ranges[3] = {65536, 2000000, 2000000};
+        const char *names[3] = {"int16", "int32", "int64"};
+        int sizes[2][2] = {{10000, 10000}, {100, 50000}};
+        int e, sz, rounds = 20, r;
+        long long start, t1, t2, t3;
+        uint32_t card = 0;
+
+        for (e = 0; e < 3; e++) {
+            for (sz = 0; sz < 2; sz++) {
+                intset *a = createRandomSet(bases[e], ranges[e], sizes[sz][0]);
+                intset *b = createRandomSet(bases[e], ranges[e], sizes[sz][1]);
+                a = intsetAdd(a, bases[e], NULL);
+                b = intsetAdd(b, bases[e], NULL);
+
+                start = usec();
+                for (r = 0; r < rounds; r++) free(intsetSetOpProbe(0, a, b));
+                t1 = usec() - start;
+
+                start = usec();
+                for (r = 0; r < rounds; r++) free(intsetIntersect(a, b));
+                t2 = usec() - start;
+
+                start = usec();
+                for (r = 0; r < rounds; r++) card += intsetIntersectCard(a, b);
+                t3 = usec() - start;
+
+                printf("  %s SINTER %d x %d: probe %lld us, intsetIntersect %lld us, intsetIntersectCard %lld us\n",
+                    names[e], sizes[sz][0], sizes[sz][1], t1 / rounds, t2 / rounds, t3 / rounds);
+
+                start = usec();
+                for (r = 0; r < rounds; r++) free(intsetSetOpProbe(1, a, b));
+                t1 = usec() - start;
+
+                start = usec();
+                for (r = 0; r < rounds; r++) free(intsetUnion(a, b));
+                t2 = usec() - start;
+
+                printf("  %s SUNION %d x %d: probe %lld us, intsetUnion %lld us\n",
+                    names[e], sizes[sz][0], sizes[sz][1], t1 / rounds, t2 / rounds);
+
+                start = usec();
+                for (r = 0; r < rounds; r++) free(intsetSetOpProbe(2, a, b));
+                t1 = usec() - start;
+
+                start = usec();
+                for (r = 0; r < rounds; r++) free(intsetDifference(a, b));
+                t2 = usec() - start;
+
+                printf("  %s SDIFF %d x %d: probe %lld us, intsetDifference %lld us\n",
+                    names[e], sizes[sz][0], sizes[sz][1], t1 / rounds, t2 / rounds);
+
+                free(a);
+                free(b);
+            }
+        }
+        assert(card > 0);
+    }
+
+    printf("Batch add/remove matches single operations: ");
+    {
+        int64_t bases[3] = {-2000, -200000, -20000000000LL};
+        int e1, e2, round;
+
+        for (round = 0; round < 20; round++) {
+            for (e1 = 0; e1 < 3; e1++) {
+                for (e2 = 0; e2 < 3; e2++) {
+                    intset *a = createRandomSet(bases[e1], 4000, rand() % 300);
+                    intset *b = intsetNew();
+                    int64_t vals[400];
+                    size_t n = rand() % 400, j, added, removed;
+                    uint32_t k;
+
+                    for (k = 0; k < intsetLen(a); k++) {
+                        int64_t v;
+                        intsetGet(a, k, &v);
+                        b = intsetAdd(b, v, NULL);
+                    }
+
+                    // 输入中包含重复值，以及集合中已经存在的值
+                    for (j = 0; j < n; j++) vals[j] = bases[e2] + rand() % 4000;
+
+                    uint8_t success;
+                    size_t expect = 0;
+                    for (j = 0; j < n; j++) {
+                        a = intsetAdd(a, vals[j], &success);
+                        expect += success;
+                    }
+                    b = intsetAddMany(b, vals, n, &added);
+                    assert(added == expect && intsetEqual(a, b));
+                    assert(intrev32ifbe(a->encoding) == intrev32ifbe(b->encoding));
+                    checkConsistency(b);
+
+                    for (j = 0; j < n; j++) vals[j] = bases[rand() % 3] + rand() % 4000;
+
+                    int found;
+                    expect = 0;
+                    for (j = 0; j < n; j++) {
+                        a = intsetRemove(a, vals[j], &found);
+                        expect += found;
+                    }
+                    b = intsetRemoveMany(b, vals, n, &removed);
+                    assert(removed == expect && intsetEqual(a, b));
+                    assert(intsetBlobLen(b) == sizeof(intset) + intsetLen(b) * intrev32ifbe(b->encoding));
+                    checkConsistency(b);
+
+                    free(a);
+                    free(b);
+                }
+            }
+        }
+        ok();
+    }
+
+    printf("Batch add benchmark:\n");
+    {
+        int sizes[2] = {512, 100000}, s, j;
+        long long start, t1, t2;
+
+        for (s = 0; s < 2; s++) {
+            int64_t *vals = (int64_t *)malloc(sizeof(int64_t) * sizes[s]);
+            intset *a = intsetNew(), *b = intsetNew();
+
+            for (j = 0; j < sizes[s]; j++) vals[j] = ((int64_t)rand() * RAND_MAX + rand()) % 10000000;
+
+            start = usec();
+            for (j = 0; j < sizes[s]; j++) a = intsetAdd(a, vals[j], NULL);
+            t1 = usec() - start;
+
+            start = usec();
+            b = intsetAddMany(b, vals, sizes[s], NULL);
+            t2 = usec() - start;
+
+            assert(intsetEqual(a, b));
+            printf("  %d elements: intsetAdd %lld us, intsetAddMany %lld us\n", sizes[s], t1, t2);
+
+            free(vals);
+            free(a);
+            free(b);
+        }
+    }
+
+    printf("Packed intset matches intset: ");
+    {
+        int64_t bases[4] = {-2000, -200000, -20000000000LL, INT64_MIN};
+        int round, j;
+
+        for (round = 0; round < 40; round++) {
+            int64_t base = bases[round % 4];
+            int64_t range = (round & 4) ? 100000 : 5000;
+            intset *is = intsetNew();
+            pintset *pis = pintsetNew();
+            pintsetIter it;
+            uint8_t s1, s2;
+            int r1, r2;
+            int64_t v, v2;
+            uint32_t k;
+
+            for (j = 0; j < 2000; j++) {
+                v = base + ((int64_t)rand() * RAND_MAX + rand()) % range;
+                // 偶尔加入离群值
+                if (rand() % 500 == 0) v = INT64_MAX - rand();
+                is = intsetAdd(is, v, &s1);
+                pis = pintsetAdd(pis, v, &s2);
+                assert(s1 == s2);
+
+                v = base + ((int64_t)rand() * RAND_MAX + rand()) % range;
+                if (j & 1) {
+                    is = intsetRemove(is, v, &r1);
+                    pis = pintsetRemove(pis, v, &r2);
+                    assert(r1 == r2);
+                }
+                assert(intsetFind(is, v) == pintsetFind(pis, v));
+            }
+
+            assert(intsetLen(is) == pintsetLen(pis));
+            pintsetIterInit(pis, &it);
+            for (k = 0; k < intsetLen(is); k++) {
+                intsetGet(is, k, &v);
+                assert(pintsetNext(&it, &v2) && v == v2);
+                assert(pintsetGet(pis, k, &v2) && v == v2);
+            }
+            assert(!pintsetNext(&it, &v2));
+            assert(!pintsetGet(pis, k, &v2));
+
+            pintsetFree(pis);
+            pis = pintsetFromIntset(is);
+            pintsetIterInit(pis, &it);
+            for (k = 0; k < intsetLen(is); k++) {
+                intsetGet(is, k, &v);
+                assert(pintsetNext(&it, &v2) && v == v2);
+            }
+
+            pintsetFree(pis);
+            free(is);
+        }
+
+        // 每一种差值宽度：迭代器按块解码的结果与逐个读取的结果一致
+        for (round = 1; round <= 64; round++) {
+            uint64_t mask = round == 64 ? UINT64_MAX : (1ULL << round) - 1;
+            pintset *pis = pintsetNew();
+            pintsetIter it;
+            int64_t base = (round & 1) ? INT64_MIN : -1000;
+            int64_t v, v2;
+            uint32_t k = 0;
+
+            pis = pintsetAdd(pis, base, NULL);
+            pis = pintsetAdd(pis, (int64_t)((uint64_t)base + mask), NULL);
+            for (j = 0; j < 300; j++) {
+                v = (int64_t)((uint64_t)base + ((((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ (uint64_t)rand()) & mask));
+                pis = pintsetAdd(pis, v, NULL);
+            }
+            pintsetIterInit(pis, &it);
+            while (pintsetNext(&it, &v)) {
+                assert(pintsetGet(pis, k, &v2) && v == v2);
+                k++;
+            }
+            assert(k == pintsetLen(pis));
+            pintsetFree(pis);
+        }
+        ok();
+    }
+
+    printf("Packed intset benchmark:\n");
+    {
+        // 稠密的ID、稀疏的ID、带一个离群值的稠密ID
+        int64_t bases[3] = {1000000000000LL, 0, 0};
+        int64_t ranges[3] = {1000000, 1LL << 40, 1000000};
+        const char *names[3] = {"dense ids", "sparse ids", "dense + outlier"};
+        int size = 100000, lookups = 200000, c, j;
+        long long start, t1, t2, t3, t4;
+        int64_t v;
+        uint64_t sum1 = 0, sum2 = 0;
+
+        for (c = 0; c < 3; c++) {
+            int64_t *vals = (int64_t *)malloc(sizeof(int64_t) * size);
+            intset *is = intsetNew();
+            pintset *pis;
+            pintsetIter it;
+            uint32_t hits1 = 0, hits2 = 0, k;
+
+            for (j = 0; j < size; j++) vals[j] = bases[c] + ((int64_t)rand() * RAND_MAX + rand()) % ranges[c];
+            // 一个离群值让整个 intset 从 int32 升级为 int64
+            if (c == 2) vals[0] = 1000000000000000LL;
+            is = intsetAddMany(is, vals, size, NULL);
+            pis = pintsetFromIntset(is);
+
+            start = usec();
+            for (j = 0; j < lookups; j++) hits1 += intsetFind(is, vals[j % size] + (j & 1));
+            t1 = usec() - start;
+
+            start = usec();
+            for (j = 0; j < lookups; j++) hits2 += pintsetFind(pis, vals[j % size] + (j & 1));
+            t2 = usec() - start;
+            assert(hits1 == hits2);
+
+            start = usec();
+            for (k = 0; k < intsetLen(is); k++) {
+                intsetGet(is, k, &v);
+                sum1 += (uint64_t)v;
+            }
+            t3 = usec() - start;
+
+            start = usec();
+            pintsetIterInit(pis, &it);
+            while (pintsetNext(&it, &v)) sum2 += (uint64_t)v;
+            t4 = usec() - start;
+            assert(sum1 == sum2);
+
+            printf("  %s, %u elements: intset %zu bytes, pintset %zu bytes (%.1fx); find %.1f ns vs %.1f ns; iterate %lld us vs %lld us\n",
+                names[c], intsetLen(is), intsetBlobLen(is), pintsetBlobLen(pis),
+                (double)intsetBlobLen(is) / pintsetBlobLen(pis),
+                t1 * 1000.0 / lookups, t2 * 1000.0 / lookups, t3, t4);
+
+            free(vals);
+            free(is);
+            pintsetFree(pis);
+        }
+    }
+
+    printf("Downgrade after removals: ");
+    {
+        is = intsetNew();
+        is = intsetAdd(is, 32, NULL);
+        is = intsetAdd(is, -5, NULL);
+        is = intsetAdd(is, 4294967295, NULL);
+        is = intsetAdd(is, 65535, NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT64);
+
+        is = intsetRemove(is, 4294967295, NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT32);
+        assert(intsetBlobLen(is) == sizeof(intset) + 3 * sizeof(int32_t));
+        checkConsistency(is);
+
+        is = intsetRemove(is, 65535, NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);
+        assert(intsetFind(is, 32) && intsetFind(is, -5) && intsetLen(is) == 2);
+        checkConsistency(is);
+
+        is = intsetAdd(is, -4294967295, NULL);
+        is = intsetRemove(is, 32, NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT64);
+        is = intsetRemove(is, -4294967295, NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16 && intsetLen(is) == 1 && intsetFind(is, -5));
+        free(is);
+        ok();
+    }
+
+    printf("Downgrade churn: ");
+    {
+        // 10000 个 int16 元素，反复加入再删除一个 int64 离群值
+        int j;
+        size_t peak = 0;
+
+        is = intsetNew();
+        for (j = 0; j < 10000; j++) is = intsetAdd(is, j, NULL);
+        for (j = 0; j < 100; j++) {
+            is = intsetAdd(is, 10000000000LL + j, NULL);
+            if (intsetBlobLen(is) > peak) peak = intsetBlobLen(is);
+            is = intsetRemove(is, 10000000000LL + j, NULL);
+        }
+        printf("%zu bytes with outlier, %zu bytes after removing it (%zu reclaimed)\n",
+            peak, intsetBlobLen(is), peak - intsetBlobLen(is));
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);
+        free(is);
+    }
+
+    printf("Random sampling: ");
+    {
+        int64_t out[1000];
+        long counts[16];
+        double chi;
+        size_t n, j, m;
+        int round, modes[3] = {0, 1, 1}, ks[3] = {1000, 3, 12}, mode;
+
+        intsetRandomSeed(42);
+        is = createSequentialSet(100, 1, 16);
+
+        n = intsetRandomMany(is, 100, 1, out);
+        assert(n == 16);
+        for (j = 0; j < 16; j++) assert(out[j] == 100 + (int64_t)j);
+
+        // 三种抽样方式：有放回、Floyd、选择抽样，每个元素被选中的次数都应该服从均匀分布
+        for (mode = 0; mode < 3; mode++) {
+            memset(counts, 0, sizeof(counts));
+            for (round = 0; round < 20000; round++) {
+                n = intsetRandomMany(is, ks[mode], modes[mode], out);
+                assert(n == (size_t)ks[mode]);
+                for (j = 0; j < n; j++) {
+                    assert(out[j] >= 100 && out[j] < 116);
+                    counts[out[j] - 100]++;
+                    // 不放回抽样不能有重复元素
+                    for (m = 0; modes[mode] && m < j; m++) assert(out[m] != out[j]);
+                }
+            }
+
+            // 自由度15，显著性0.001的临界值约为37.7
+            double expect = 20000.0 * ks[mode] / 16;
+            for (chi = 0, j = 0; j < 16; j++) chi += (counts[j] - expect) * (counts[j] - expect) / expect;
+            assert(chi < 37.7);
+        }
+        free(is);
+
+        // 长度为3的集合，rand() % 3 在 RAND_MAX 较小时会有偏差，这里应当没有
+        is = createSequentialSet(0, 1, 3);
+        memset(counts, 0, sizeof(counts));
+        for (round = 0; round < 300000; round++) counts[intsetRandom(is)]++;
+        for (chi = 0, j = 0; j < 3; j++) chi += (counts[j] - 100000.0) * (counts[j] - 100000.0) / 100000.0;
+        assert(chi < 13.8);
+        free(is);
+        ok();
+    }
+
+    printf("Random sampling benchmark:\n");
+    {
+        int samples = 1000000, j;
+        int64_t *out = (int64_t *)malloc(sizeof(int64_t) * samples), sum = 0;
+        long long start, t1, t2, t3;
+
+        is = createSequentialSet(0, 1, 512);
+
+        start = usec();
+        for (j = 0; j < samples; j++) sum += _intsetGet(is, rand() % intsetLen(is));
+        t1 = usec() - start;
+
+        start = usec();
+        for (j = 0; j < samples; j++) sum += intsetRandom(is);
+        t2 = usec() - start;
+
+        start = usec();
+        intsetRandomMany(is, samples, 0, out);
+        t3 = usec() - start;
+
+        printf("  rand() %% len %.1f ns/sample, intsetRandom %.1f ns/sample, intsetRandomMany %.1f ns/sample\n",
+            t1 * 1000.0 / samples, t2 * 1000.0 / samples, t3 * 1000.0 / samples);
+
+        free(is);
+        is = createSequentialSet(0, 1, 100000);
+        start = usec();
+        for (j = 0; j < 1000; j++) intsetRandomMany(is, 100, 1, out);
+        t1 = usec() - start;
+
+        start = usec();
+        for (j = 0; j < 10; j++) intsetRandomMany(is, 50000, 1, out);
+        t2 = usec() - start;
+
+        printf("  unique 100 of 100000 (Floyd) %.1f ns/sample, unique 50000 of 100000 (selection) %.1f ns/sample\n",
+            t1 * 1000.0 / (1000 * 100), t2 * 1000.0 / (10 * 50000));
+
+        assert(sum != 0);
+        free(out);
+        free(is);
+    }
+
+    printf("Range count, iteration and rank: ");
+    {
+        int64_t bases[3] = {-1000, -100000, -5000000000LL};
+        int64_t ranges[3] = {2000, 200000, 10000000000LL};
+        int64_t out[64], value, lo, hi;
+        uint32_t j, k, expect, n, total;
+        int e, round;
+        intsetRangeIter it;
+
+        for (e = 0; e < 3; e++) {
+            is = createRandomSet(bases[e], ranges[e], 500);
+            for (round = 0; round < 2000; round++) {
+                lo = bases[e] - 10 + (int64_t)(((uint64_t)rand() * rand()) % (uint64_t)(ranges[e] + 20));
+                hi = lo + (int64_t)(((uint64_t)rand() * rand()) % (uint64_t)(ranges[e] / 4 + 1)) - ranges[e] / 100;
+                // 有一半的区间端点取自集合中的元素，检查包含两端的语义
+                if (round & 1) {
+                    intsetGet(is, rand() % intsetLen(is), &lo);
+                    intsetGet(is, rand() % intsetLen(is), &hi);
+                }
+
+                expect = 0;
+                for (j = 0; j < intsetLen(is); j++) {
+                    intsetGet(is, j, &value);
+                    if (value >= lo && value <= hi) expect++;
+                }
+                assert(intsetRangeCount(is, lo, hi) == expect);
+
+                // 逐个迭代与批量迭代都应当按升序返回区间内的全部元素
+                intsetRangeIterInit(is, lo, hi, &it);
+                for (k = 0; intsetRangeIterNext(&it, &value); k++) {
+                    assert(value >= lo && value <= hi);
+                    assert(intsetRank(is, value) == intsetRank(is, lo) + k);
+                }
+                assert(k == expect);
+
+                intsetRangeIterInit(is, lo, hi, &it);
+                total = 0;
+                while ((n = intsetRangeIterNextMany(&it, out, 7)) != 0) {
+                    for (j = 0; j < n; j++) {
+                        intsetGet(is, intsetRank(is, lo) + total + j, &value);
+                        assert(out[j] == value);
+                    }
+                    total += n;
+                }
+                assert(total == expect);
+            }
+            free(is);
+        }
+
+        // 边界值：空集合、min > max、区间端点为 int64 的极值
+        is = intsetNew();
+        assert(intsetRangeCount(is, INT64_MIN, INT64_MAX) == 0);
+        assert(intsetRank(is, 5) == 0);
+        is = intsetAdd(is, INT64_MIN, NULL);
+        is = intsetAdd(is, -1, NULL);
+        is = intsetAdd(is, 7, NULL);
+        is = intsetAdd(is, INT64_MAX, NULL);
+        assert(intsetRangeCount(is, INT64_MIN, INT64_MAX) == 4);
+        assert(intsetRangeCount(is, INT64_MAX, INT64_MAX) == 1);
+        assert(intsetRangeCount(is, INT64_MIN, INT64_MIN) == 1);
+        assert(intsetRangeCount(is, 7, -1) == 0);
+        assert(intsetRangeCount(is, 0, 6) == 0);
+        assert(intsetRank(is, INT64_MIN) == 0);
+        assert(intsetRank(is, 0) == 2);
+        assert(intsetRank(is, 7) == 2);
+        assert(intsetRank(is, INT64_MAX) == 3);
+        intsetRangeIterInit(is, -1, INT64_MAX, &it);
+        assert(intsetRangeIterNextMany(&it, out, 64) == 3);
+        assert(out[0] == -1 && out[1] == 7 && out[2] == INT64_MAX);
+        assert(intsetRangeIterNextMany(&it, out, 64) == 0);
+        free(is);
+        ok();
+    }
+
+    printf("Range count benchmark:\n");
+    {
+        int queries = 1000, q;
+        uint32_t j, count = 0, scanned = 0;
+        int64_t value, lo, *out = (int64_t *)malloc(sizeof(int64_t) * 1000);
+        long long start, t1, t2, t3;
+        intsetRangeIter it;
+
+        is = createSequentialSet(0, 3, 100000);
+
+        start = usec();
+        for (q = 0; q < queries; q++) {
+            lo = rand() % 300000;
+            for (j = 0; j < intsetLen(is); j++) {
+                intsetGet(is, j, &value);
+                if (value >= lo && value <= lo + 3000) scanned++;
+            }
+        }
+        t1 = usec() - start;
+
+        start = usec();
+        for (q = 0; q < queries; q++) {
+            lo = rand() % 300000;
+            count += intsetRangeCount(is, lo, lo + 3000);
+        }
+        t2 = usec() - start;
+
+        start = usec();
+        for (q = 0; q < queries; q++) {
+            lo = rand() % 300000;
+            intsetRangeIterInit(is, lo, lo + 3000, &it);
+            while (intsetRangeIterNextMany(&it, out, 1000) != 0) count++;
+        }
+        t3 = usec() - start;
+
+        printf("  100000 elements, [a, a + 3000]: full scan %.1f us/query, intsetRangeCount %.3f us/query, "
+            "intsetRangeIter %.3f us/query\n", (double)t1 / queries, (double)t2 / queries, (double)t3 / queries);
+
+        assert(scanned != 0 && count != 0);
+        free(out);
+        free(is);
     }
 
     printf("Stress add + delete: ");
@@ -236,6 +1025,7 @@ void test_case_intset() {
         }
 
         checkConsistency(is);
+        free(is);
         ok();
     }
 }
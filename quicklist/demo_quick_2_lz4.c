@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "demo_quick_2_lz4.h"
+
+#define LZ4_MINMATCH 4
+#define LZ4_HASH_LOG 12
+#define LZ4_LAST_LITERALS 5         // 最后5个字节总是字面量
+#define LZ4_MFLIMIT 12              // 距离末尾不足12个字节时不再开始新的匹配
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_ML_MASK 15
+#define LZ4_RUN_MASK 15
+
+static inline uint32_t lz4_read32(const unsigned char *p) {
+
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned int lz4_hash(uint32_t v) {
+
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+// 从 a 和 b 开始比较，返回相同的字节数，a 不超过 limit
+static inline unsigned int lz4_count(const unsigned char *a, const unsigned char *b, const unsigned char *limit) {
+
+    const unsigned char *start = a;
+
+    while (a + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y) return (a - start) + (__builtin_ctzll(x ^ y) >> 3);
+        a += 8;
+        b += 8;
+    }
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return a - start;
+}
+
+// 写入长度的扩展字节，返回写入之后的位置
+static inline unsigned char *lz4_write_length(unsigned char *op, unsigned int len) {
+
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/**
+ * 写入一个序列：anchor 到 ip 之间的字面量，以及 offset 和 matchlen 表示的匹配(matchlen 为0时只有字面量)
+ * 返回写入之后的位置，输出缓冲区不够时返回 NULL
+ */
+static unsigned char *lz4_write_sequence(unsigned char *op, unsigned char *oend, const unsigned char *anchor,
+                                         unsigned int litlen, unsigned int offset, unsigned int matchlen) {
+
+    unsigned char *token = op++;
+
+    // token + 字面量 + 扩展字节 + offset + 匹配长度的扩展字节
+    if ((size_t)(oend - op) < (size_t)litlen + litlen / 255 + 1 + 2 + matchlen / 255 + 1) return NULL;
+
+    if (litlen >= LZ4_RUN_MASK) {
+        *token = LZ4_RUN_MASK << 4;
+        op = lz4_write_length(op, litlen - LZ4_RUN_MASK);
+    } else {
+        *token = litlen << 4;
+    }
+    memcpy(op, anchor, litlen);
+    op += litlen;
+
+    if (matchlen == 0) return op;
+
+    op[0] = offset & 0xff;
+    op[1] = offset >> 8;
+    op += 2;
+
+    matchlen -= LZ4_MINMATCH;
+    if (matchlen >= LZ4_ML_MASK) {
+        *token |= LZ4_ML_MASK;
+        op = lz4_write_length(op, matchlen - LZ4_ML_MASK);
+    } else {
+        *token |= matchlen;
+    }
+    return op;
+}
+
+unsigned int lz4_compress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len, int level) {
+
+    const unsigned char *in = in_data;
+    const unsigned char *ip = in, *anchor = in;
+    const unsigned char *iend = in + in_len;
+    const unsigned char *mflimit = iend - LZ4_MFLIMIT;
+    const unsigned char *matchlimit = iend - LZ4_LAST_LITERALS;
+    unsigned char *op = out_data, *oend = op + out_len;
+    int32_t head[1 << LZ4_HASH_LOG];
+    uint16_t *chain = NULL;     // level > 0 时每个位置到前一个相同哈希位置的距离
+
+    memset(head, 0xff, sizeof(head));
+    if (level > 0) {
+        chain = malloc(sizeof(uint16_t) * (in_len ? in_len : 1));
+        if (chain == NULL) level = 0;
+    }
+
+    if (in_len >= LZ4_MFLIMIT + 1) {
+        while (ip < mflimit) {
+            unsigned int h = lz4_hash(lz4_read32(ip));
+            int32_t pos = ip - in, cand = head[h];
+            unsigned int best = 0, offset = 0;
+
+            if (level > 0) {
+                // 沿着哈希链查找最长的匹配
+                int probes = level;
+                chain[pos] = (cand >= 0 && pos - cand <= LZ4_MAX_DISTANCE) ? pos - cand : 0;
+                while (cand >= 0 && pos - cand <= LZ4_MAX_DISTANCE && probes--) {
+                    const unsigned char *m = in + cand;
+                    if (m[best] == ip[best] && lz4_read32(m) == lz4_read32(ip)) {
+                        unsigned int len = LZ4_MINMATCH + lz4_count(ip + LZ4_MINMATCH, m + LZ4_MINMATCH, matchlimit);
+                        if (len > best) {
+                            best = len;
+                            offset = pos - cand;
+                        }
+                    }
+                    if (chain[cand] == 0) break;
+                    cand -= chain[cand];
+                }
+            } else if (cand >= 0 && pos - cand <= LZ4_MAX_DISTANCE && lz4_read32(in + cand) == lz4_read32(ip)) {
+                best = LZ4_MINMATCH + lz4_count(ip + LZ4_MINMATCH, in + cand + LZ4_MINMATCH, matchlimit);
+                offset = pos - cand;
+            }
+            head[h] = pos;
+
+            if (best == 0) {
+                // 没有匹配时，level 为0的压缩随着连续的字面量变长而加大步长，跳过不可压缩的数据
+                ip += (level > 0) ? 1 : 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // 向前扩展匹配
+            while (ip > anchor && ip - offset > in && ip[-1] == ip[-1 - (int)offset]) {
+                ip--;
+                best++;
+            }
+
+            op = lz4_write_sequence(op, oend, anchor, ip - anchor, offset, best);
+            if (op == NULL) goto err;
+
+            // 把匹配覆盖的位置加入哈希表，之后的数据可以引用它们
+            const unsigned char *end = ip + best;
+            for (ip += (level > 0) ? 1 : best - 2; ip < end && ip < mflimit; ip++) {
+                h = lz4_hash(lz4_read32(ip));
+                pos = ip - in;
+                if (level > 0) chain[pos] = (head[h] >= 0 && pos - head[h] <= LZ4_MAX_DISTANCE) ? pos - head[h] : 0;
+                head[h] = pos;
+            }
+            ip = anchor = end;
+        }
+    }
+
+    // 最后的字面量
+    op = lz4_write_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    if (op == NULL) goto err;
+
+    free(chain);
+    return op - (unsigned char *)out_data;
+
+err:
+    free(chain);
+    return 0;
+}
+
+// 读取长度的扩展字节，数据不完整时返回0
+static inline int lz4_read_length(const unsigned char **ip, const unsigned char *iend, unsigned int *len) {
+
+    unsigned int b;
+
+    do {
+        if (*ip >= iend) return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+unsigned int lz4_decompress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len) {
+
+    const unsigned char *ip = in_data, *iend = ip + in_len;
+    unsigned char *out = out_data, *op = out, *oend = out + out_len;
+
+    while (ip < iend) {
+        unsigned int token = *ip++;
+        unsigned int litlen = token >> 4, matchlen = token & LZ4_ML_MASK, offset;
+        const unsigned char *match;
+
+        // 字面量，两边都有足够的空间时一次复制16个字节
+        if (litlen == LZ4_RUN_MASK && !lz4_read_length(&ip, iend, &litlen)) return 0;
+        if ((size_t)(iend - ip) < litlen || (size_t)(oend - op) < litlen) return 0;
+        if (litlen <= 16 && iend - ip >= 16 && oend - op >= 16) {
+            memcpy(op, ip, 16);
+        } else {
+            memcpy(op, ip, litlen);
+        }
+        ip += litlen;
+        op += litlen;
+
+        // 最后一个序列只有字面量
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return 0;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out)) return 0;
+
+        if (matchlen == LZ4_ML_MASK && !lz4_read_length(&ip, iend, &matchlen)) return 0;
+        matchlen += LZ4_MINMATCH;
+        if ((size_t)(oend - op) < matchlen) return 0;
+
+        // 匹配，offset >= 8 时每次复制的8个字节不会重叠
+        match = op - offset;
+        if (offset >= 8 && (size_t)(oend - op) >= matchlen + 8) {
+            unsigned char *end = op + matchlen;
+            do {
+                memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            } while (op < end);
+            op = end;
+        } else {
+            while (matchlen--) *op++ = *match++;
+        }
+    }
+    return op - out;
+}
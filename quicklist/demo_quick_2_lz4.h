@@ -0,0 +1,29 @@
+#ifndef LZ4_2_H
+#define LZ4_2_H
+
+/**
+ * LZ4 block 格式的压缩和解压，解压只需要按字节对齐地复制字面量和匹配，没有位操作，比 lzf 更快
+ *
+ * 每个序列的格式
+ *  <token><字面量长度的扩展字节><字面量><offset><匹配长度的扩展字节>
+ *  token 的高4位是字面量长度，低4位是匹配长度减去4，等于15时之后还有扩展字节，每个扩展字节加上0-255，等于255时继续
+ *  offset 是2个字节的小端整数，匹配的位置为当前位置减去 offset
+ *  最后一个序列只有字面量
+ */
+
+/**
+ * 压缩从 in_data 开始的 in_len 字节，结果写入 out_data，最多 out_len 字节
+ * level 为0时每个位置只查找一个候选匹配；大于0时沿着哈希链最多查找 level 个候选，压缩率更高，速度更慢
+ *
+ * 输出缓冲区不够大时返回0，否则返回已使用的字节数
+ */
+unsigned int lz4_compress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len, int level);
+
+/**
+ * 解压 lz4_compress 压缩的数据，结果写入 out_data，最多 out_len 字节
+ *
+ * 输出缓冲区不够大或者数据不合法时返回0，否则返回解压之后的字节数
+ */
+unsigned int lz4_decompress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len);
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "demo_quick_2_lz4.h"
+#include "demo_quick_2_lzh.h"
+
+#define LZH_SYMBOLS 256
+#define LZH_HEADER_SIZE (1 + 4 + LZH_SYMBOLS / 2)
+#define LZH_LEVEL 16                // LZ4 沿着哈希链查找的候选数量
+
+// 按频率排序时使用的节点
+typedef struct lzhNode {
+    uint32_t freq;
+    int16_t left, right;            // 叶子节点为 -1
+    int16_t symbol;
+} lzhNode;
+
+static int lzhCompareFreq(const void *a, const void *b) {
+
+    const lzhNode *x = a, *y = b;
+    if (x->freq != y->freq) return x->freq < y->freq ? -1 : 1;
+    return x->symbol - y->symbol;
+}
+
+// 递归计算叶子的深度，即码长
+static void lzhAssignDepth(const lzhNode *nodes, int i, int depth, unsigned char *lens) {
+
+    if (nodes[i].left < 0) {
+        lens[nodes[i].symbol] = depth ? depth : 1;
+        return;
+    }
+    lzhAssignDepth(nodes, nodes[i].left, depth + 1, lens);
+    lzhAssignDepth(nodes, nodes[i].right, depth + 1, lens);
+}
+
+/**
+ * 根据频率计算每个符号的码长，没有出现的符号码长为0
+ * 最长的码超过 LZH_MAX_CODE_LEN 时把频率减半后重新计算，低频符号的码因此变短
+ */
+static void lzhBuildLengths(const uint32_t *freq, unsigned char *lens) {
+
+    uint32_t f[LZH_SYMBOLS];
+    lzhNode nodes[LZH_SYMBOLS * 2];
+    int n, i, maxlen;
+
+    memcpy(f, freq, sizeof(f));
+    do {
+        // 两个队列合并：叶子按频率排序，合并出来的内部节点的频率单调不减
+        n = 0;
+        for (i = 0; i < LZH_SYMBOLS; i++) {
+            if (f[i] == 0) continue;
+            nodes[n].freq = f[i];
+            nodes[n].left = nodes[n].right = -1;
+            nodes[n].symbol = i;
+            n++;
+        }
+        memset(lens, 0, LZH_SYMBOLS);
+        if (n == 0) return;
+        qsort(nodes, n, sizeof(lzhNode), lzhCompareFreq);
+
+        int leaf = 0, inner = n, total = n;
+        while (total - inner + (n - leaf) > 1) {
+            int pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (leaf < n && (inner == total || nodes[leaf].freq <= nodes[inner].freq)) {
+                    pick[k] = leaf++;
+                } else {
+                    pick[k] = inner++;
+                }
+            }
+            nodes[total].freq = nodes[pick[0]].freq + nodes[pick[1]].freq;
+            nodes[total].left = pick[0];
+            nodes[total].right = pick[1];
+            nodes[total].symbol = -1;
+            total++;
+        }
+        lzhAssignDepth(nodes, total - 1, 0, lens);
+
+        maxlen = 0;
+        for (i = 0; i < LZH_SYMBOLS; i++) {
+            if (lens[i] > maxlen) maxlen = lens[i];
+            if (f[i]) f[i] = (f[i] + 1) / 2;
+        }
+    } while (maxlen > LZH_MAX_CODE_LEN);
+}
+
+/**
+ * 根据码长计算规范 Huffman 码，按(码长, 符号)的顺序依次分配
+ * 位流从最低位开始读取，所以保存按位反转之后的码
+ */
+static void lzhBuildCodes(const unsigned char *lens, uint16_t *codes) {
+
+    unsigned int count[LZH_MAX_CODE_LEN + 1] = {0}, next[LZH_MAX_CODE_LEN + 2];
+    unsigned int code = 0, i, len;
+
+    for (i = 0; i < LZH_SYMBOLS; i++) count[lens[i]]++;
+    count[0] = 0;
+    for (len = 1; len <= LZH_MAX_CODE_LEN; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (i = 0; i < LZH_SYMBOLS; i++) {
+        uint16_t c, r = 0;
+        if ((len = lens[i]) == 0) continue;
+        c = next[len]++;
+        for (unsigned int b = 0; b < len; b++) r |= ((c >> b) & 1) << (len - 1 - b);
+        codes[i] = r;
+    }
+}
+
+unsigned int lzh_compress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len) {
+
+    unsigned char *out = out_data, *op;
+    unsigned char *lz, lens[LZH_SYMBOLS];
+    unsigned int lzcap = in_len + in_len / 255 + 16, lzlen, i;
+    uint32_t freq[LZH_SYMBOLS] = {0};
+    uint16_t codes[LZH_SYMBOLS];
+    uint64_t bits = 0, acc = 0;
+    unsigned int nbits = 0;
+
+    if (out_len < 1) return 0;
+    lz = malloc(lzcap);
+    if (lz == NULL) return 0;
+    lzlen = lz4_compress(in_data, in_len, lz, lzcap, LZH_LEVEL);
+    if (lzlen == 0) goto err;
+
+    for (i = 0; i < lzlen; i++) freq[lz[i]]++;
+    lzhBuildLengths(freq, lens);
+    for (i = 0; i < LZH_SYMBOLS; i++) bits += (uint64_t)freq[i] * lens[i];
+
+    // Huffman 编码不能让数据变小时直接保存 LZ4 数据
+    if (LZH_HEADER_SIZE + (bits + 7) / 8 >= 1 + (uint64_t)lzlen) {
+        if (out_len < 1 + lzlen) goto err;
+        out[0] = 0;
+        memcpy(out + 1, lz, lzlen);
+        free(lz);
+        return 1 + lzlen;
+    }
+    if ((uint64_t)out_len < LZH_HEADER_SIZE + (bits + 7) / 8) goto err;
+
+    out[0] = 1;
+    out[1] = lzlen & 0xff;
+    out[2] = (lzlen >> 8) & 0xff;
+    out[3] = (lzlen >> 16) & 0xff;
+    out[4] = (lzlen >> 24) & 0xff;
+    for (i = 0; i < LZH_SYMBOLS; i += 2) out[5 + i / 2] = lens[i] | (lens[i + 1] << 4);
+    lzhBuildCodes(lens, codes);
+
+    op = out + LZH_HEADER_SIZE;
+    for (i = 0; i < lzlen; i++) {
+        acc |= (uint64_t)codes[lz[i]] << nbits;
+        nbits += lens[lz[i]];
+        while (nbits >= 8) {
+            *op++ = acc & 0xff;
+            acc >>= 8;
+            nbits -= 8;
+        }
+    }
+    if (nbits) *op++ = acc & 0xff;
+
+    free(lz);
+    return op - out;
+
+err:
+    free(lz);
+    return 0;
+}
+
+unsigned int lzh_decompress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len) {
+
+    const unsigned char *in = in_data, *ip, *iend = in + in_len;
+    unsigned char lens[LZH_SYMBOLS], *lz;
+    uint16_t codes[LZH_SYMBOLS], table[1 << LZH_MAX_CODE_LEN];
+    unsigned int lzlen, i, nbits = 0, ret;
+    uint64_t acc = 0;
+    uint64_t kraft = 0;
+
+    if (in_len < 1) return 0;
+    if (in[0] == 0) return lz4_decompress(in + 1, in_len - 1, out_data, out_len);
+    if (in[0] != 1 || in_len < LZH_HEADER_SIZE) return 0;
+
+    lzlen = in[1] | (in[2] << 8) | (in[3] << 16) | ((unsigned int)in[4] << 24);
+    // LZ4 数据最多比原始数据长 1/255 左右，更长说明数据不合法
+    if (lzlen == 0 || lzlen > out_len + out_len / 255 + 16) return 0;
+
+    for (i = 0; i < LZH_SYMBOLS; i += 2) {
+        lens[i] = in[5 + i / 2] & 0x0f;
+        lens[i + 1] = in[5 + i / 2] >> 4;
+    }
+    for (i = 0; i < LZH_SYMBOLS; i++) {
+        if (lens[i] > LZH_MAX_CODE_LEN) return 0;
+        if (lens[i]) kraft += 1ULL << (LZH_MAX_CODE_LEN - lens[i]);
+    }
+    // 码长必须构成前缀码，查找表才不会有重叠
+    if (kraft == 0 || kraft > (1ULL << LZH_MAX_CODE_LEN)) return 0;
+
+    // 查找表：以接下来的 LZH_MAX_CODE_LEN 位为下标，保存 符号 | 码长 << 8，码长为0表示不合法的码
+    lzhBuildCodes(lens, codes);
+    memset(table, 0, sizeof(table));
+    for (i = 0; i < LZH_SYMBOLS; i++) {
+        if (lens[i] == 0) continue;
+        for (unsigned int c = codes[i]; c < (1U << LZH_MAX_CODE_LEN); c += 1U << lens[i]) {
+            table[c] = i | (lens[i] << 8);
+        }
+    }
+
+    lz = malloc(lzlen);
+    if (lz == NULL) return 0;
+    ip = in + LZH_HEADER_SIZE;
+    for (i = 0; i < lzlen; i++) {
+        // 位流结束之后按0补齐，最后再检查实际使用的位没有超过位流
+        while (nbits <= 56) {
+            acc |= (uint64_t)(ip < iend ? *ip : 0) << nbits;
+            ip++;
+            nbits += 8;
+        }
+        uint16_t e = table[acc & ((1U << LZH_MAX_CODE_LEN) - 1)];
+        if ((e >> 8) == 0) goto err;
+        lz[i] = e & 0xff;
+        acc >>= e >> 8;
+        nbits -= e >> 8;
+    }
+    // ip 之前读入的位中还有 nbits 位没有使用
+    if ((size_t)(ip - (in + LZH_HEADER_SIZE)) * 8 - nbits > (size_t)(iend - (in + LZH_HEADER_SIZE)) * 8) goto err;
+
+    ret = lz4_decompress(lz, lzlen, out_data, out_len);
+    free(lz);
+    return ret;
+
+err:
+    free(lz);
+    return 0;
+}
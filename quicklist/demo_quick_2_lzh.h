@@ -0,0 +1,30 @@
+#ifndef LZH_2_H
+#define LZH_2_H
+
+/**
+ * LZ77 + Huffman：先用 lz4_compress(沿着哈希链查找更长的匹配)压缩，再用 Huffman 编码 LZ4 的输出
+ * 以更多的 CPU 换取比 lzf 和 lz4 更高的压缩率，适合很少访问的冷数据
+ *
+ * 格式
+ *  <mode>
+ *  mode 为0时之后是未经 Huffman 编码的 LZ4 数据(Huffman 编码不能让它变小)
+ *  mode 为1时之后是 <LZ4 数据的长度，4字节小端><256个符号的码长，每个4位，共128字节><Huffman 编码的位流>
+ *  位流从每个字节的最低位开始，码长不超过 LZH_MAX_CODE_LEN
+ */
+#define LZH_MAX_CODE_LEN 11
+
+/**
+ * 压缩从 in_data 开始的 in_len 字节，结果写入 out_data，最多 out_len 字节
+ *
+ * 输出缓冲区不够大时返回0，否则返回已使用的字节数
+ */
+unsigned int lzh_compress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len);
+
+/**
+ * 解压 lzh_compress 压缩的数据，结果写入 out_data，最多 out_len 字节
+ *
+ * 输出缓冲区不够大或者数据不合法时返回0，否则返回解压之后的字节数
+ */
+unsigned int lzh_decompress(const void *const in_data, unsigned int in_len, void *out_data, unsigned int out_len);
+
+#endif
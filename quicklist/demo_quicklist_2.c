@@ -1,11 +1,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "demo_quicklist_2_util.h"
 #include "demo_quick_2_lzf.h"
+#include "demo_quick_2_lz4.h"
+#include "demo_quick_2_lzh.h"
 #include "demo_quicklist_2_ziplist.h"
 #include "demo_quicklist_2.h"
 
+REDIS_STATIC void __quicklistCompressCancel(quicklistNode *node);
+REDIS_STATIC void __quicklistCacheRemove(const quicklist *quicklist, quicklistNode *node);
+
 // 创建新的 quicklist
 quicklist *quicklistCreate(void) {
 
@@ -17,9 +23,38 @@ quicklist *quicklistCreate(void) {
     quicklist->count = 0;
     quicklist->compress = 0;
     quicklist->fill = -2;
+    quicklist->codec = QUICKLIST_NODE_ENCODING_LZF;
+    quicklist->cache = NULL;
+    quicklist->cindex = NULL;
     return quicklist;
 }
 
+static unsigned int lz4FastCompress(const void *const in, unsigned int in_len, void *out, unsigned int out_len) {
+
+    return lz4_compress(in, in_len, out, out_len, 0);
+}
+
+// 以节点的 encoding 为下标
+static const quicklistCodec quicklistCodecs[QUICKLIST_NODE_ENCODING_MAX + 1] = {
+    [QUICKLIST_NODE_ENCODING_RAW] = {"none", NULL, NULL},
+    [QUICKLIST_NODE_ENCODING_LZF] = {"lzf", lzf_compress, lzf_decompress},
+    [QUICKLIST_NODE_ENCODING_LZ4] = {"lz4", lz4FastCompress, lz4_decompress},
+    [QUICKLIST_NODE_ENCODING_LZH] = {"lzh", lzh_compress, lzh_decompress},
+};
+
+const quicklistCodec *quicklistGetCodec(int encoding) {
+
+    if (encoding < QUICKLIST_NODE_ENCODING_RAW || encoding > QUICKLIST_NODE_ENCODING_MAX) return NULL;
+    return &quicklistCodecs[encoding];
+}
+
+int quicklistSetCodec(quicklist *quicklist, int encoding) {
+
+    if (quicklistGetCodec(encoding) == NULL) return 0;
+    quicklist->codec = encoding;
+    return 1;
+}
+
 void quicklistSetCompressDepth(quicklist *quicklist, int compress) {
 
     if (compress > COMPRESS_MAX) {
@@ -65,6 +100,10 @@ REDIS_STATIC quicklistNode *quicklistCreateNode() {
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
     node->container = QUICKLIST_NODE_CONTAINER_ZIPLIST;
     node->recompress = 0;
+    node->pending = 0;
+    node->version = 0;
+    node->cached = 0;
+    node->idxnode = NULL;
     return node;
 }
 
@@ -83,12 +122,15 @@ void quicklistRelease(quicklist *quicklist) {
     unsigned long len;
     quicklistNode *current, *next;
 
+    quicklistSetCountIndex(quicklist, 0);
+
     current = quicklist->head;
     len = quicklist->len;
     
     while (len--) {
         next = current->next;
 
+        if (current->pending) __quicklistCompressCancel(current);
         free(current->zl);
         quicklist->count -= current->count;
 
@@ -97,50 +139,191 @@ void quicklistRelease(quicklist *quicklist) {
         quicklist->len--;
         current = next;
     }
+    free(quicklist->cache);
     free(quicklist);
 }
 
 /**
  * 对quicklist node 进行压缩
  *  如果被压缩的node 的ziplist数据长度小于MIN_COMPRESS_BYTES(48), 不进行压缩
- *  通过 lzf_compress 对 node->zl压缩
- *  并把节点打上已压缩的标识(QUICKLIST_NODE_ENCODING_LZF)
+ *  通过 quicklist->codec 对应的压缩算法对 node->zl压缩
+ *  并把节点打上该算法的标识(QUICKLIST_NODE_ENCODING_*)
  * 
  * 返回值
  *   如果ziplist成功压缩，则返回1
  *  如果压缩失败或ziplist太小而无法压缩，则返回0
  */
-REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
+REDIS_STATIC quicklistLZF *__quicklistCompressZiplist(unsigned char *zl, unsigned int sz, unsigned int encoding) {
 
-#ifdef REDIS_TEST
-    node->attempted_compress = 1;
-#endif
+    const quicklistCodec *codec = &quicklistCodecs[encoding];
 
-    // 小于压缩最小值，不压缩
-    if (node->sz < MIN_COMPRESS_BYTES) return 0;
+    if (codec->compress == NULL) return NULL;
 
-    quicklistLZF *lzf = malloc(sizeof(*lzf) + node->sz);
+    quicklistLZF *lzf = malloc(sizeof(*lzf) + sz);
 
     // 如果压缩失败或压缩不够小，请取消
-    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed, node->sz)) == 0) || lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+    if (((lzf->sz = codec->compress(zl, sz, lzf->compressed, sz)) == 0) || lzf->sz + MIN_COMPRESS_IMPROVE >= sz) {
         /* 如果值不可压缩，lzf_compress中止/拒绝压缩. */
         free(lzf);
-        return 0;
+        return NULL;
     }
+    return realloc(lzf, sizeof(*lzf) + lzf->sz);
+}
+
+REDIS_STATIC int __quicklistCompressNode(const quicklist *quicklist, quicklistNode *node) {
+
+#ifdef REDIS_TEST
+    node->attempted_compress = 1;
+#endif
+
+    // 小于压缩最小值，不压缩
+    if (node->sz < MIN_COMPRESS_BYTES) return 0;
+
+    quicklistLZF *lzf = __quicklistCompressZiplist(node->zl, node->sz, quicklist->codec);
+    if (lzf == NULL) return 0;
 
-    lzf = realloc(lzf, sizeof(*lzf) + lzf->sz);
     free(node->zl);
     node->zl = (unsigned char *)lzf;
-    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    node->encoding = quicklist->codec;
     node->recompress = 0;
     return 1;
 }
 
-// 仅压缩未压缩的节点(QUICKLIST_NODE_ENCODING_RAW)
-#define quicklistCompressNode(_node)                                        \
+/**
+ * 后台压缩任务
+ * 主线程创建任务并持有它直到处理完结果，后台线程只读取 zl 和 sz，写入 lzf
+ */
+typedef struct quicklistCompressJob {
+    const quicklist *quicklist;         // 节点所属的 quicklist，任务取消之后为 NULL
+    quicklistNode *node;                // 要压缩的节点，任务取消之后为 NULL
+    unsigned char *zl;                  // 节点 ziplist 的副本
+    unsigned int sz;
+    unsigned int encoding;              // 使用的压缩算法，交出时 quicklist 的 codec
+    quicklistLZF *lzf;                  // 压缩的结果，不值得压缩时为 NULL
+    struct quicklistCompressJob *next;
+} quicklistCompressJob;
+
+/**
+ * 后台压缩线程
+ * todo 和 done 由 lock 保护，ndone 可以不加锁读取，主线程没有结果需要处理时不用加锁
+ * running、pending 和 npending 只由主线程访问
+ */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stop;
+    quicklistCompressJob *todo, *todo_tail;
+    quicklistCompressJob *done;
+    int ndone;
+    quicklistCompressJob *pending[QUICKLIST_COMPRESS_MAX_PENDING];
+    int npending;
+} compressWorker = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+REDIS_STATIC void *quicklistCompressWorkerMain(void *arg) {
+
+    quicklistCompressJob *job;
+
+    (void)arg;
+    pthread_mutex_lock(&compressWorker.lock);
+    while (1) {
+        while (compressWorker.todo == NULL && !compressWorker.stop) {
+            pthread_cond_wait(&compressWorker.cond, &compressWorker.lock);
+        }
+        // 停止之前先完成所有任务
+        if (compressWorker.todo == NULL) break;
+
+        job = compressWorker.todo;
+        compressWorker.todo = job->next;
+        if (compressWorker.todo == NULL) compressWorker.todo_tail = NULL;
+        pthread_mutex_unlock(&compressWorker.lock);
+
+        job->lzf = __quicklistCompressZiplist(job->zl, job->sz, job->encoding);
+        free(job->zl);
+        job->zl = NULL;
+
+        pthread_mutex_lock(&compressWorker.lock);
+        job->next = compressWorker.done;
+        compressWorker.done = job;
+        __atomic_store_n(&compressWorker.ndone, compressWorker.ndone + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&compressWorker.lock);
+    return NULL;
+}
+
+/**
+ * 把节点的 ziplist 复制一份交给后台线程压缩
+ * 调用线程只付出一次 memcpy，lzf_compress 在后台线程上运行
+ *
+ * 返回值
+ *  节点已经交给后台线程(包括之前已经交出)，返回1
+ *  节点太小或者任务已满，返回0，由调用者同步压缩
+ */
+REDIS_STATIC int __quicklistCompressNodeAsync(const quicklist *quicklist, quicklistNode *node) {
+
+    quicklistCompressJob *job;
+
+    if (node->pending) return 1;
+    // 编码没有压缩函数(RAW)时不创建任务，由同步压缩直接返回
+    if (quicklistCodecs[quicklist->codec].compress == NULL) return 0;
+    if (node->sz < MIN_COMPRESS_BYTES || compressWorker.npending == QUICKLIST_COMPRESS_MAX_PENDING) return 0;
+
+#ifdef REDIS_TEST
+    node->attempted_compress = 1;
+#endif
+
+    job = malloc(sizeof(*job));
+    job->quicklist = quicklist;
+    job->node = node;
+    job->sz = node->sz;
+    job->encoding = quicklist->codec;
+    job->zl = malloc(node->sz);
+    memcpy(job->zl, node->zl, node->sz);
+    job->lzf = NULL;
+    job->next = NULL;
+
+    node->pending = 1;
+    node->version = 0;
+    // 和同步压缩一样，交出之后节点不再是临时解压的状态，否则压缩的结果会被丢弃
+    node->recompress = 0;
+    compressWorker.pending[compressWorker.npending++] = job;
+
+    pthread_mutex_lock(&compressWorker.lock);
+    if (compressWorker.todo_tail) {
+        compressWorker.todo_tail->next = job;
+    } else {
+        compressWorker.todo = job;
+    }
+    compressWorker.todo_tail = job;
+    pthread_cond_signal(&compressWorker.cond);
+    pthread_mutex_unlock(&compressWorker.lock);
+    return 1;
+}
+
+// 节点即将被释放，取消它的后台压缩任务，任务的结果之后会被直接丢弃
+REDIS_STATIC void __quicklistCompressCancel(quicklistNode *node) {
+
+    for (int i = 0; i < compressWorker.npending; i++) {
+        if (compressWorker.pending[i]->node == node) {
+            compressWorker.pending[i]->node = NULL;
+            compressWorker.pending[i]->quicklist = NULL;
+            break;
+        }
+    }
+    node->pending = 0;
+}
+
+// 仅压缩未压缩的节点(QUICKLIST_NODE_ENCODING_RAW)，后台线程运行时优先交给后台线程
+#define quicklistCompressNode(_ql, _node)                                   \
     do {                                                                    \
         if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) {  \
-            __quicklistCompressNode((_node));                               \
+            if (!compressWorker.running ||                                  \
+                !__quicklistCompressNodeAsync((_ql), (_node)))              \
+                __quicklistCompressNode((_ql), (_node));                    \
         }                                                                   \
     } while (0)
 
@@ -156,7 +339,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 
     void *decompressed = malloc(node->sz);
     quicklistLZF *lzf = (quicklistLZF *)node->zl;
-    if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+    if (quicklistCodecs[node->encoding].decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
         free(decompressed);
         return 0;
     }
@@ -169,7 +352,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 // 仅解压压缩点
 #define quicklistDecompressNode(_node)                                      \
     do {                                                                    \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {  \
+        if ((_node) && quicklistNodeIsCompressed(_node)) {                  \
             __quicklistDecompressNode((_node));                             \
         }                                                                   \
     } while (0);                                                            \
@@ -177,7 +360,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 // 强制节点不能立即压缩
 #define quicklistDecompressNodeForUse(_node)                                \
     do {                                                                    \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {  \
+        if ((_node) && quicklistNodeIsCompressed(_node)) {                  \
             __quicklistDecompressNode((_node));                             \
             (_node)->recompress = 1;                                        \
         }                                                                   \
@@ -217,7 +400,7 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist, quicklistNode
         quicklistDecompressNode(h);
         quicklistDecompressNode(t);
         if (h != node && t != node)
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         return;
     } else if (quicklist->compress == 2) {
         quicklistNode *h = quicklist->head, *hn = h->next, *hnn = hn->next;
@@ -227,13 +410,13 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist, quicklistNode
         quicklistDecompressNode(t);
         quicklistDecompressNode(tp);
         if (h != node && hn != node && t != node && tp != node) {
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         }
         if (hnn != t) {
-            quicklistCompressNode(hnn);
+            quicklistCompressNode(quicklist, hnn);
         }
         if (tpp != h) {
-            quicklistCompressNode(tpp);
+            quicklistCompressNode(quicklist, tpp);
         }
         return;
     }
@@ -269,32 +452,473 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist, quicklistNode
 
     // 如果，前后节点都没有要压缩的，压缩当前节点
     if (!in_depth) {
-        quicklistCompressNode(node);
+        quicklistCompressNode(quicklist, node);
     }
         
     // 如果只有两个节点，那么压缩头尾节点
     if (depth > 2) {
         // 在这一点上，前进和后退是一个超出深度的节点
-        quicklistCompressNode(forward);
-        quicklistCompressNode(reverse);
+        quicklistCompressNode(quicklist, forward);
+        quicklistCompressNode(quicklist, reverse);
     }
 }
 
 #define quicklistCompress(_ql, _node)                                          \
     do {                                                                       \
         if ((_node)->recompress)                                               \
-            quicklistCompressNode((_node));                                    \
+            __quicklistRecompress((_ql), (_node));                             \
         else                                                                   \
             __quicklistCompress((_ql), (_node));                               \
     } while (0)
 
-// 如果我们以前使用了quicklistDecompressNodeForUse（），只需重新压缩
+// 如果我们以前使用了quicklistDecompressNodeForUse（），只需重新压缩(有解压缓存时放入缓存)
 #define quicklistRecompressOnly(_ql, _node)                                    \
     do {                                                                       \
         if ((_node)->recompress)                                               \
-            quicklistCompressNode((_node));                                    \
+            __quicklistRecompress((_ql), (_node));                             \
     } while (0)
 
+// 节点是否位于两端 compress 深度之内(或者 quicklist 太短不压缩任何节点)，与 __quicklistCompress 的规则一致
+REDIS_STATIC int _quicklistNodeInCompressDepth(const quicklist *quicklist, const quicklistNode *node) {
+
+    if (!quicklistAllowsCompression(quicklist) || quicklist->len < (unsigned int)(quicklist->compress * 2)) {
+        return 1;
+    }
+
+    const quicklistNode *forward = quicklist->head;
+    const quicklistNode *reverse = quicklist->tail;
+    for (int depth = 0; depth < quicklist->compress; depth++) {
+        if (forward == node || reverse == node) return 1;
+        forward = forward->next;
+        reverse = reverse->prev;
+    }
+    return 0;
+}
+
+/**
+ * 解压缓存
+ * 缓存临时解压(recompress 为1)的节点，按最近一次访问的时钟做 LRU 淘汰
+ * 节点数量不超过 QUICKLIST_CACHE_MAX_NODES，所以查找和淘汰都直接遍历数组
+ */
+struct quicklistCache {
+    size_t limit;                       // 缓存的 ziplist 总字节数上限
+    size_t bytes;                       // 缓存的 ziplist 总字节数，按节点最近一次访问时的 sz 计算
+    unsigned long long clock;
+    int count;
+    struct {
+        quicklistNode *node;
+        unsigned int sz;
+        unsigned long long used;        // 最近一次访问时的 clock
+    } entries[QUICKLIST_CACHE_MAX_NODES];
+};
+
+// 从缓存中移除第 i 个节点，不重新压缩
+REDIS_STATIC quicklistNode *_quicklistCacheTake(quicklistCache *cache, int i) {
+
+    quicklistNode *node = cache->entries[i].node;
+
+    cache->bytes -= cache->entries[i].sz;
+    cache->entries[i] = cache->entries[--cache->count];
+    node->cached = 0;
+    return node;
+}
+
+// 淘汰第 i 个节点：节点仍然是临时解压的并且在 compress 深度之外时重新压缩
+REDIS_STATIC void _quicklistCacheEvict(const quicklist *quicklist, int i) {
+
+    quicklistNode *node = _quicklistCacheTake(quicklist->cache, i);
+
+    if (!node->recompress) return;
+    if (_quicklistNodeInCompressDepth(quicklist, node)) {
+        node->recompress = 0;
+        return;
+    }
+    quicklistCompressNode(quicklist, node);
+}
+
+// 淘汰最久没有访问的节点
+REDIS_STATIC void _quicklistCacheEvictLRU(const quicklist *quicklist) {
+
+    quicklistCache *cache = quicklist->cache;
+    int lru = 0;
+
+    for (int i = 1; i < cache->count; i++) {
+        if (cache->entries[i].used < cache->entries[lru].used) lru = i;
+    }
+    _quicklistCacheEvict(quicklist, lru);
+}
+
+REDIS_STATIC void __quicklistCacheRemove(const quicklist *quicklist, quicklistNode *node) {
+
+    quicklistCache *cache = quicklist->cache;
+
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->entries[i].node == node) {
+            _quicklistCacheTake(cache, i);
+            return;
+        }
+    }
+}
+
+/**
+ * 把临时解压的节点放入缓存，已经在缓存中时更新访问时钟和大小
+ * 返回值
+ *  节点在缓存中，返回1
+ *  没有缓存或者节点比整个缓存还大，返回0
+ */
+REDIS_STATIC int _quicklistCacheTouch(const quicklist *quicklist, quicklistNode *node) {
+
+    quicklistCache *cache = quicklist->cache;
+    int i;
+
+    if (cache == NULL || node->sz > cache->limit) {
+        if (node->cached) __quicklistCacheRemove(quicklist, node);
+        return 0;
+    }
+
+    if (node->cached) {
+        for (i = 0; cache->entries[i].node != node; i++);
+        cache->bytes -= cache->entries[i].sz;
+        cache->entries[i] = cache->entries[--cache->count];
+    }
+
+    // 腾出空间，节点自己已经不在数组中，不会被淘汰
+    while (cache->count == QUICKLIST_CACHE_MAX_NODES || (cache->count && cache->bytes + node->sz > cache->limit)) {
+        _quicklistCacheEvictLRU(quicklist);
+    }
+
+    i = cache->count++;
+    cache->entries[i].node = node;
+    cache->entries[i].sz = node->sz;
+    cache->entries[i].used = ++cache->clock;
+    cache->bytes += node->sz;
+    node->cached = 1;
+    return 1;
+}
+
+// 临时解压的节点用完之后：有缓存时放入缓存，否则立即重新压缩
+REDIS_STATIC void __quicklistRecompress(const quicklist *quicklist, quicklistNode *node) {
+
+    if (_quicklistCacheTouch(quicklist, node)) return;
+
+    // 列表变短之后，临时解压的节点可能已经位于两端的 compress 深度之内，这时不能再压缩
+    if (_quicklistNodeInCompressDepth(quicklist, node)) {
+        node->recompress = 0;
+        return;
+    }
+    quicklistCompressNode(quicklist, node);
+}
+
+void quicklistSetCacheSize(quicklist *quicklist, size_t bytes) {
+
+    if (bytes == 0) {
+        if (quicklist->cache == NULL) return;
+        while (quicklist->cache->count) _quicklistCacheEvict(quicklist, quicklist->cache->count - 1);
+        free(quicklist->cache);
+        quicklist->cache = NULL;
+        return;
+    }
+
+    if (quicklist->cache == NULL) {
+        quicklist->cache = malloc(sizeof(quicklistCache));
+        quicklist->cache->bytes = 0;
+        quicklist->cache->clock = 0;
+        quicklist->cache->count = 0;
+    }
+    quicklist->cache->limit = bytes;
+    while (quicklist->cache->bytes > bytes) _quicklistCacheEvictLRU(quicklist);
+}
+
+/**
+ * 计数索引
+ * 和有序集合的跳表一样按随机的层数链接节点，但是 span 记录的是元素数量而不是节点数量：
+ *  level[i].span 为从本节点(含)到 level[i].forward(不含)之间所有 quicklist 节点的元素数量，forward 为 NULL 时到末尾为止
+ *  第0层链接所有节点，span 就是节点的元素数量
+ * 节点的元素数量改变时，只需要修改每一层上覆盖它的那个节点的 span，通过每一层的 backward 向前查找，期望 O(log 节点数)
+ */
+typedef struct quicklistIndexNode {
+    quicklistNode *node;                // header 为 NULL
+    unsigned int count;                 // 最近一次同步时 node->count，span 都按它计算
+    int height;
+    struct quicklistIndexLevel {
+        struct quicklistIndexNode *forward;
+        struct quicklistIndexNode *backward;    // 每一层的第一个节点指向 header
+        unsigned long span;
+    } level[];
+} quicklistIndexNode;
+
+struct quicklistCountIndex {
+    quicklistIndexNode *header;         // 哨兵，count 为0，高度为 QUICKLIST_INDEX_MAXLEVEL
+    int level;                          // 当前使用的层数，level 之上 header 的 span 没有维护
+    unsigned long count;                // 所有节点的元素数量
+    uint64_t seed;                      // 随机层数使用的 xorshift 状态
+};
+
+REDIS_STATIC quicklistIndexNode *_quicklistIndexCreateNode(int height, quicklistNode *node) {
+
+    quicklistIndexNode *x = malloc(sizeof(*x) + height * sizeof(struct quicklistIndexLevel));
+
+    x->node = node;
+    x->count = node ? node->count : 0;
+    x->height = height;
+    for (int i = 0; i < height; i++) {
+        x->level[i].forward = x->level[i].backward = NULL;
+        x->level[i].span = 0;
+    }
+    return x;
+}
+
+// 返回 1 到 QUICKLIST_INDEX_MAXLEVEL 之间的随机层数，层数越高概率越小(幂律分布)
+REDIS_STATIC int _quicklistIndexRandomLevel(quicklistCountIndex *index) {
+
+    int level = 1;
+
+    while (level < QUICKLIST_INDEX_MAXLEVEL) {
+        index->seed ^= index->seed << 13;
+        index->seed ^= index->seed >> 7;
+        index->seed ^= index->seed << 17;
+        if ((index->seed & 0xFFFF) >= QUICKLIST_INDEX_P * 0xFFFF) break;
+        level++;
+    }
+    return level;
+}
+
+/**
+ * 从 x 开始向前查找，update[i] 为第 i 层上位于 x 之前(含 x)的最后一个节点
+ * rank 不为 NULL 时，rank[i] 为 update[i](含)到 x(不含)之间的元素数量
+ */
+REDIS_STATIC void _quicklistIndexPrev(const quicklistCountIndex *index, quicklistIndexNode *x, quicklistIndexNode **update, unsigned long *rank) {
+
+    unsigned long dist = 0;
+
+    for (int i = 0; i < index->level; i++) {
+        while (x->height <= i) {
+            x = x->level[i - 1].backward;
+            dist += x->level[i - 1].span;
+        }
+        update[i] = x;
+        if (rank) rank[i] = dist;
+    }
+}
+
+// 把 node 加入索引，位于 prev 之后，prev 为 NULL 时为第一个节点
+REDIS_STATIC void __quicklistIndexInsert(quicklistCountIndex *index, quicklistNode *prev, quicklistNode *node) {
+
+    quicklistIndexNode *update[QUICKLIST_INDEX_MAXLEVEL], *p = prev ? prev->idxnode : index->header, *x;
+    unsigned long rank[QUICKLIST_INDEX_MAXLEVEL];
+    int height = _quicklistIndexRandomLevel(index);
+
+    // 新增的层上 header 覆盖所有元素
+    if (height > index->level) {
+        for (int i = index->level; i < height; i++) {
+            index->header->level[i].forward = NULL;
+            index->header->level[i].span = index->count;
+        }
+        index->level = height;
+    }
+
+    _quicklistIndexPrev(index, p, update, rank);
+    x = _quicklistIndexCreateNode(height, node);
+    for (int i = 0; i < index->level; i++) {
+        // update[i] 到新节点之前的元素数量
+        unsigned long before = rank[i] + p->count;
+        if (i < height) {
+            x->level[i].forward = update[i]->level[i].forward;
+            x->level[i].backward = update[i];
+            if (x->level[i].forward) x->level[i].forward->level[i].backward = x;
+            update[i]->level[i].forward = x;
+            x->level[i].span = update[i]->level[i].span - before + x->count;
+            update[i]->level[i].span = before;
+        } else {
+            update[i]->level[i].span += x->count;
+        }
+    }
+    index->count += x->count;
+    node->idxnode = x;
+}
+
+// 把 node 从索引中删除，按照索引中记录的 count 扣除元素数量
+REDIS_STATIC void __quicklistIndexDelete(quicklistCountIndex *index, quicklistNode *node) {
+
+    quicklistIndexNode *update[QUICKLIST_INDEX_MAXLEVEL], *x = node->idxnode;
+
+    _quicklistIndexPrev(index, x->level[0].backward, update, NULL);
+    for (int i = 0; i < index->level; i++) {
+        if (i < x->height) {
+            update[i]->level[i].span += x->level[i].span - x->count;
+            update[i]->level[i].forward = x->level[i].forward;
+            if (x->level[i].forward) x->level[i].forward->level[i].backward = update[i];
+        } else {
+            update[i]->level[i].span -= x->count;
+        }
+    }
+    while (index->level > 1 && index->header->level[index->level - 1].forward == NULL) index->level--;
+    index->count -= x->count;
+    free(x);
+    node->idxnode = NULL;
+}
+
+// 节点的元素数量已经改变，把差值加到每一层上覆盖它的节点
+REDIS_STATIC void __quicklistIndexUpdate(quicklistCountIndex *index, quicklistNode *node) {
+
+    quicklistIndexNode *update[QUICKLIST_INDEX_MAXLEVEL];
+    unsigned long delta = (unsigned long)node->count - node->idxnode->count;
+
+    _quicklistIndexPrev(index, node->idxnode, update, NULL);
+    for (int i = 0; i < index->level; i++) update[i]->level[i].span += delta;
+    index->count += delta;
+    node->idxnode->count = node->count;
+}
+
+// 节点的 count 改变之后同步计数索引，没有索引时只检查一个指针
+#define quicklistIndexSync(_ql, _node)                                         \
+    do {                                                                       \
+        if ((_node)->idxnode && (_node)->idxnode->count != (_node)->count)     \
+            __quicklistIndexUpdate((_ql)->cindex, (_node));                    \
+    } while (0)
+
+/**
+ * 查找第 idx 个元素(从0开始)所在的节点，*accum 为它之前所有节点的元素数量
+ * 调用者保证 idx 小于元素总数
+ */
+REDIS_STATIC quicklistNode *_quicklistIndexFind(const quicklistCountIndex *index, unsigned long long idx, unsigned long long *accum) {
+
+    quicklistIndexNode *x = index->header;
+    unsigned long long traversed = 0;
+
+    for (int i = index->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && traversed + x->level[i].span <= idx) {
+            traversed += x->level[i].span;
+            x = x->level[i].forward;
+        }
+    }
+    *accum = traversed;
+    return x->node;
+}
+
+void quicklistSetCountIndex(quicklist *quicklist, int on) {
+
+    if (!on) {
+        if (quicklist->cindex == NULL) return;
+        for (quicklistNode *node = quicklist->head; node; node = node->next) {
+            free(node->idxnode);
+            node->idxnode = NULL;
+        }
+        free(quicklist->cindex->header);
+        free(quicklist->cindex);
+        quicklist->cindex = NULL;
+        return;
+    }
+
+    if (quicklist->cindex) return;
+    quicklistCountIndex *index = malloc(sizeof(*index));
+    index->header = _quicklistIndexCreateNode(QUICKLIST_INDEX_MAXLEVEL, NULL);
+    index->level = 1;
+    index->count = 0;
+    index->seed = 0x9E3779B97F4A7C15ULL;
+    for (quicklistNode *node = quicklist->head; node; node = node->next) {
+        __quicklistIndexInsert(index, node->prev, node);
+    }
+    quicklist->cindex = index;
+}
+
+/**
+ * 处理一个完成的后台压缩任务
+ * 节点仍然在 compress 深度之外并且没有被修改过(version 为0)时，用压缩结果替换节点的 ziplist
+ * 节点被修改过但仍然需要压缩时，重新压缩当前的内容
+ */
+REDIS_STATIC void _quicklistCompressJobFinish(quicklistCompressJob *job) {
+
+    quicklistNode *node = job->node;
+
+    for (int i = 0; i < compressWorker.npending; i++) {
+        if (compressWorker.pending[i] == job) {
+            compressWorker.pending[i] = compressWorker.pending[--compressWorker.npending];
+            break;
+        }
+    }
+
+    if (node) {
+        node->pending = 0;
+        if (node->encoding == QUICKLIST_NODE_ENCODING_RAW && !node->recompress &&
+            !_quicklistNodeInCompressDepth(job->quicklist, node)) {
+            if (node->version != 0) {
+                quicklistCompressNode(job->quicklist, node);
+            } else if (job->lzf) {
+                free(node->zl);
+                node->zl = (unsigned char *)job->lzf;
+                node->encoding = job->encoding;
+                job->lzf = NULL;
+            }
+        }
+    }
+    free(job->lzf);
+    free(job);
+}
+
+/**
+ * 处理 quicklist 已经完成的后台压缩任务，quicklist 为 NULL 时处理所有的任务
+ * 已经取消的任务不属于任何 quicklist，总是直接释放
+ */
+REDIS_STATIC void _quicklistCompressWorkerDrain(const quicklist *quicklist) {
+
+    quicklistCompressJob *job, *next, *mine = NULL, *rest = NULL;
+    int nrest = 0;
+
+    if (__atomic_load_n(&compressWorker.ndone, __ATOMIC_ACQUIRE) == 0) return;
+
+    pthread_mutex_lock(&compressWorker.lock);
+    for (job = compressWorker.done; job; job = next) {
+        next = job->next;
+        if (quicklist == NULL || job->quicklist == quicklist || job->quicklist == NULL) {
+            job->next = mine;
+            mine = job;
+        } else {
+            job->next = rest;
+            rest = job;
+            nrest++;
+        }
+    }
+    compressWorker.done = rest;
+    __atomic_store_n(&compressWorker.ndone, nrest, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&compressWorker.lock);
+
+    for (job = mine; job; job = next) {
+        next = job->next;
+        _quicklistCompressJobFinish(job);
+    }
+}
+
+void quicklistCompressWorkerDrain(quicklist *quicklist) {
+
+    _quicklistCompressWorkerDrain(quicklist);
+}
+
+int quicklistCompressWorkerStart(void) {
+
+    if (compressWorker.running) return 0;
+
+    compressWorker.stop = 0;
+    if (pthread_create(&compressWorker.thread, NULL, quicklistCompressWorkerMain, NULL) != 0) return -1;
+    compressWorker.running = 1;
+    return 0;
+}
+
+void quicklistCompressWorkerStop(void) {
+
+    if (!compressWorker.running) return;
+
+    pthread_mutex_lock(&compressWorker.lock);
+    compressWorker.stop = 1;
+    pthread_cond_signal(&compressWorker.cond);
+    pthread_mutex_unlock(&compressWorker.lock);
+    pthread_join(compressWorker.thread, NULL);
+
+    // 线程已经停止，之后需要重新压缩的节点在当前线程上同步压缩
+    compressWorker.running = 0;
+    _quicklistCompressWorkerDrain(NULL);
+}
+
 
 /**
  * 
@@ -360,6 +984,10 @@ REDIS_STATIC void __quicklistInsertNode(quicklist *quicklist, quicklistNode *old
         quicklist->head = quicklist->tail = new_node;
     }
 
+    if (quicklist->cindex) {
+        __quicklistIndexInsert(quicklist->cindex, new_node->prev, new_node);
+    }
+
     if (old_node) {
         quicklistCompress(quicklist, old_node);
     }
@@ -480,9 +1108,11 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a, const quicklis
 }
 
 // 更新ziplist 的 数据长度
+// 同时增加节点的 version，交给后台压缩的副本因此失效
 #define quicklistNodeUpdateSz(node)                                            \
     do {                                                                       \
         (node)->sz = ziplistBlobLen((node)->zl);                               \
+        if ((node)->version < QUICKLIST_NODE_VERSION_MAX) (node)->version++;   \
     } while (0)
 
 
@@ -505,6 +1135,8 @@ int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
 
     quicklistNode *orig_head = quicklist->head;
 
+    _quicklistCompressWorkerDrain(quicklist);
+
     if (likely(_quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz))) {
         quicklist->head->zl = ziplistPush(quicklist->head->zl, value, sz, ZIPLIST_HEAD);
         quicklistNodeUpdateSz(quicklist->head);
@@ -518,6 +1150,7 @@ int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
 
     quicklist->count++;
     quicklist->head->count++;
+    quicklistIndexSync(quicklist, quicklist->head);
     return (orig_head != quicklist->head);
 }
 
@@ -540,6 +1173,8 @@ int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
 int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
 
     quicklistNode *orig_tail = quicklist->tail;
+
+    _quicklistCompressWorkerDrain(quicklist);
     if (likely(_quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz))) {
         quicklist->tail->zl = ziplistPush(quicklist->tail->zl, value, sz, ZIPLIST_TAIL);
         quicklistNodeUpdateSz(quicklist->tail);
@@ -554,6 +1189,7 @@ int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
 
     quicklist->count++;
     quicklist->tail->count++;
+    quicklistIndexSync(quicklist, quicklist->tail);
     return (orig_tail != quicklist->tail);
 }
 
@@ -645,6 +1281,9 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist, quicklistNode *node)
 
     quicklist->count -= node->count;
 
+    if (node->pending) __quicklistCompressCancel(node);
+    if (node->cached) __quicklistCacheRemove(quicklist, node);
+    if (node->idxnode) __quicklistIndexDelete(quicklist->cindex, node);
     free(node->zl);
     free(node);
     quicklist->len--;
@@ -671,6 +1310,7 @@ REDIS_STATIC int quicklistDelIndex(quicklist *quicklist, quicklistNode *node, un
         __quicklistDelNode(quicklist, node);
     } else {
         quicklistNodeUpdateSz(node);
+        quicklistIndexSync(quicklist, node);
     }
     quicklist->count--;
     /* If we deleted the node, the original node is no longer valid */
@@ -767,6 +1407,7 @@ REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist, quickli
         }
         keep->count = ziplistLen(keep->zl);
         quicklistNodeUpdateSz(keep);
+        quicklistIndexSync(quicklist, keep);
 
         nokeep->count = 0;
         __quicklistDelNode(quicklist, nokeep);
@@ -943,6 +1584,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
         __quicklistInsertNode(quicklist, NULL, new_node, after);
         new_node->count++;
+        quicklistIndexSync(quicklist, new_node);
         quicklist->count++;
         return;
     }
@@ -987,6 +1629,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         }
         node->count++;
         quicklistNodeUpdateSz(node);
+        quicklistIndexSync(quicklist, node);
         
         // 加密
         quicklistRecompressOnly(quicklist, node);
@@ -1000,6 +1643,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
 
         node->count++;
         quicklistNodeUpdateSz(node);
+        quicklistIndexSync(quicklist, node);
 
         // 加密
         quicklistRecompressOnly(quicklist, node);
@@ -1018,6 +1662,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         new_node->count++;
 
         quicklistNodeUpdateSz(new_node);
+        quicklistIndexSync(quicklist, new_node);
 
         // 加密
         quicklistRecompressOnly(quicklist, new_node);
@@ -1036,6 +1681,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_TAIL);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
+        quicklistIndexSync(quicklist, new_node);
 
         // 加密
         quicklistRecompressOnly(quicklist, new_node);
@@ -1067,8 +1713,9 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         new_node->count++;
 
         quicklistNodeUpdateSz(new_node);
-        // 把new_node 插入到 quicklist中去
+        // 把new_node 插入到 quicklist中去，node 被切分之后同步它的元素数量
         __quicklistInsertNode(quicklist, node, new_node, after);
+        quicklistIndexSync(quicklist, node);
 
         // 合并节点。四种方式合并
         _quicklistMergeNodes(quicklist, node);
@@ -1130,9 +1777,10 @@ int quicklistDelRange(quicklist *quicklist, const long start, const long count)
              */
             delete_entire_node = 1;
             del = node->count;
-        } else if (entry.offset >= 0 && extent >= node->count) {
+        } else if (entry.offset >= 0 && extent + entry.offset >= node->count) {
             /**
              * 删除 [entry.offset, node->count]的数据
+             * 范围超出节点末尾时只删除到末尾，剩下的在之后的节点中删除
              */
             del = node->count - entry.offset;
         } else if (entry.offset < 0) {
@@ -1170,6 +1818,7 @@ int quicklistDelRange(quicklist *quicklist, const long start, const long count)
 
             quicklistNodeUpdateSz(node);
             node->count -= del;
+            quicklistIndexSync(quicklist, node);
             quicklist->count -= del;
             
             // 如果节点元素数量为空，那么直接删除
@@ -1256,11 +1905,11 @@ void quicklistReleaseIterator(quicklistIter *iter) {
  * 获取迭代器中的下一个元素
  *  通过 quicklistIter 迭代器获取 quicklist和 quicklist node 等信息
  *  !iter->zi 为 true 的情况
- *      解压当前的node节点，通过node ziplist的 ziplistIndex或对应ziplist entry节点
+ *      解压当前的node节点，通过node ziplist的 ziplistIndex获取对应ziplist entry节点，并在这里初始化 iter->zit
  *  !iter->zi 为 false 的情况,已经获取了 ziplist entry
- *      所以通过 quicklistIter 的 direction 通过 ziplist ziplistPrev/ziplistNext 取上一个/下一个 ziplist entry
+ *      iter->zit 已经按照 direction 指向上一个/下一个 ziplist entry
  *   
- *  在iter->zi不为空的情况下，通过ziplistGet 获取 ziplist entry节点里的内容
+ *  通过 ziplistIterNext 获取 ziplist entry节点里的内容，每个节点的头部只解析一次
  *  在iter->zi为空，把quicklistIter 切换下一个为下一个quicklist node, 重新获取ziplist entry
  * 
  * 注意：遍历列表时，请勿插入列表
@@ -1299,36 +1948,30 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
         return 0;
     }
 
-    unsigned char *(*nextFn)(unsigned char *, unsigned char *) = NULL;
-    int offset_update = 0;
+    ziplistEntry ze;
 
     if (!iter->zi) {
-        // 如果 !zi, 则使用当前索引
+        // 如果 !zi, 则在当前索引处初始化 ziplist 迭代器
         quicklistDecompressNodeForUse(iter->current);
-        iter->zi = ziplistIndex(iter->current->zl, iter->offset);
+        ziplistIterInitAt(iter->current->zl, ziplistIndex(iter->current->zl, iter->offset), &iter->zit,
+            iter->direction == AL_START_HEAD ? ZIPLIST_HEAD : ZIPLIST_TAIL);
 
     } else {
-        // 否则，使用现有的迭代器偏移量并根据需要获取上一个/下一个
-        if (iter->direction == AL_START_HEAD) {
-            nextFn = ziplistNext;
-            offset_update = 1;
-
-        } else if (iter->direction == AL_START_TAIL) {
-            nextFn = ziplistPrev;
-            offset_update = -1;
+        // 否则，ziplist 迭代器已经指向上一个/下一个节点，只需要更新偏移量
+        iter->offset += (iter->direction == AL_START_HEAD) ? 1 : -1;
+    }
+
+    // ziplist 迭代器同时解码节点的头部和值，每个节点只解析一次
+    if (ziplistIterNext(&iter->zit, &ze)) {
+        iter->zi = iter->zit.e.p;
+        entry->zi = iter->zi;
+        entry->offset = iter->offset;
+        entry->value = ze.sval;
+        if (ze.sval) {
+            entry->sz = ze.slen;
+        } else {
+            entry->longval = ze.lval;
         }
-
-        iter->zi = nextFn(iter->current->zl, iter->zi);
-        iter->offset += offset_update;
-    }
-
-    entry->zi = iter->zi;
-    entry->offset = iter->offset;
-
-    // 如果迭代器的zi不为NULL，从ziplist中获取值
-    if (iter->zi) {
-        // 从现有的ziplist位置填充值
-        ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
         return 1;
     } else {
         /**
@@ -1364,12 +2007,15 @@ quicklist *quicklistDup(quicklist *orig) {
     quicklist *copy;
 
     copy = quicklistNew(orig->fill, orig->compress);
+    copy->codec = orig->codec;
+    if (orig->cache) quicklistSetCacheSize(copy, orig->cache->limit);
+    if (orig->cindex) quicklistSetCountIndex(copy, 1);
 
     for (quicklistNode *current = orig->head; current; current = current->next) {
         quicklistNode *node = quicklistCreateNode();
 
         // 复制ziplist
-        if (current->encoding == QUICKLIST_NODE_ENCODING_LZF) {
+        if (quicklistNodeIsCompressed(current)) {
             quicklistLZF *lzf = (quicklistLZF *)current->zl;
             size_t lzf_sz = sizeof(*lzf) + lzf->sz;
             node->zl = malloc(lzf_sz);
@@ -1424,6 +2070,12 @@ int quicklistIndex(const quicklist *quicklist, const long long idx, quicklistEnt
         return 0;
     }
 
+    if (quicklist->cindex) {
+        // 计数索引按从头开始的下标查找，accum 再换算成下面遍历时的含义(反向时为 n 之后的元素数量)
+        n = _quicklistIndexFind(quicklist->cindex, forward ? index : quicklist->count - 1 - index, &accum);
+        if (!forward) accum = quicklist->count - accum - n->count;
+    }
+
     while (likely(n)) {
         if ((accum + n->count) > index) {
             break;
@@ -1458,7 +2110,9 @@ int quicklistIndex(const quicklist *quicklist, const long long idx, quicklistEnt
     /**
      * 调用者将使用我们的结果，因此我们在这里不重新压缩
      * 调用方可以根据需要重新压缩或删除该节点。
+     * 有解压缓存时交给缓存管理，被淘汰之前节点保持解压，entry 仍然有效
      */
+    if (entry->node->recompress) _quicklistCacheTouch(quicklist, entry->node);
     return 1;
 }
 
@@ -1,10 +1,11 @@
 #ifndef __QUICKLIST_2_H__
 #define __QUICKLIST_2_H__
 #include <stdio.h>
+#include "demo_quicklist_2_ziplist.h"
 
 /**
- * quicklistNode是一个32字节的结构，用于描述快速列表的ziplist
- * 我们使用位字段将quicklistNode保持在32字节
+ * quicklistNode是一个40字节的结构(64位系统)，用于描述快速列表的ziplist
+ * 我们使用位字段把标志压缩到一个 int 中，没有计数索引时的32字节之外，只多了 idxnode 指针的8字节
  * prev: 指向链表前一个节点的指针
  * 
  * next: 指向链表后一个节点的指针
@@ -16,7 +17,7 @@
  * 
  * count: 表示ziplist里面包含的数据项个数。16位，最大65536（最大zl字节为65k，因此最大计数实际上 < 32k）
  * 
- * encoding: 表示ziplist是否压缩了（以及用了哪个压缩算法，2位，RAW = 1，没有压缩, LZF = 2，使用LZF算法压缩
+ * encoding: 表示ziplist是否压缩了（以及用了哪个压缩算法，3位，RAW = 1，没有压缩, LZF = 2，LZ4 = 3，LZH = 4，分别使用对应的算法压缩
  * 
  * container: 是一个预留字段，2位，NONE = 1, ZIPLIST = 2
  *  本来设计是用来表明一个quicklist节点下面是直接存数据，还是使用ziplist存数据，或者用其它的结构来存数据（用作一个数据容器，所以叫container）
@@ -29,8 +30,14 @@
  * attempted_compress：1位 ,bool值，用于测试期间的验证
  *  这个值只对Redis的自动化测试程序有用
  * 
- * extra：10位，免费供将来使用；将剩下的32位补出来
- *  其它扩展字段
+ * pending: 1位，bool值，节点已经交给后台压缩线程，压缩的结果还没有处理
+ *
+ * version: 7位，节点交给后台压缩线程之后 ziplist 被修改的次数，到最大值之后不再增加
+ *  后台线程压缩的是交出时的副本，只有 version 仍然为0时，压缩的结果才能替换节点的 ziplist
+ *
+ * cached: 1位，bool值，节点在 quicklist 的解压缓存中，重新压缩推迟到从缓存中淘汰时
+ *
+ * idxnode: 节点在计数索引中对应的跳表节点，quicklist 没有计数索引时为 NULL
  */
 typedef struct quicklistNode {
     struct quicklistNode *prev;
@@ -38,11 +45,14 @@ typedef struct quicklistNode {
     unsigned char *zl;
     unsigned int sz;
     unsigned int count: 16;
-    unsigned int encoding: 2;
+    unsigned int encoding: 3;
     unsigned int container: 2;
     unsigned int recompress: 1;
     unsigned int attempted_compress: 1;
-    unsigned int extra: 10;
+    unsigned int pending: 1;
+    unsigned int version: 7;
+    unsigned int cached: 1;
+    struct quicklistIndexNode *idxnode;
 } quicklistNode;
 
 /**
@@ -53,6 +63,7 @@ typedef struct quicklistNode {
  * 注意
  *  未压缩的长度存储在quicklistNode->sz中
  *  当quicklistNode->zl被压缩时，node->zl指向一个quicklistLZF
+ *  其他压缩算法同样使用这个结构，compressed 的格式由节点的 encoding 决定
  */
 typedef struct quicklistLZF {
     unsigned int sz;
@@ -88,8 +99,19 @@ typedef struct quicklistLZF {
  *          -3: 每个quicklist节点上的ziplist大小不能超过16 Kb
  *          -2: 每个quicklist节点上的ziplist大小不能超过8 Kb。（-2是Redis给出的默认值）
  *          -1: 每个quicklist节点上的ziplist大小不能超过4 Kb
- *      
+ *
+ * codec: 压缩节点时使用的算法(QUICKLIST_NODE_ENCODING_*)，默认为 LZF，由 quicklistSetCodec 设置
+ *  修改之后只影响之后压缩的节点，已经压缩的节点仍然按照各自的 encoding 解压
+ *
+ * cache: 最近访问过的压缩节点的解压缓存，默认为 NULL(不缓存)，由 quicklistSetCacheSize 设置
+ *  LINDEX、LRANGE 等临时解压的节点先放入缓存，按 LRU 淘汰时才重新压缩，反复访问同一段数据时不用每次都解压
+ *
+ * cindex: 按元素数量索引节点的跳表，默认为 NULL，由 quicklistSetCountIndex 打开
+ *  每一层的 span 是元素数量，quicklistIndex 等按下标查找节点时为 O(log 节点数)，不用从两端逐个遍历节点
  */
+typedef struct quicklistCache quicklistCache;
+typedef struct quicklistCountIndex quicklistCountIndex;
+
 
 typedef struct quicklist {
     quicklistNode *head;
@@ -98,6 +120,9 @@ typedef struct quicklist {
     unsigned long len;
     int fill: 16;
     unsigned int compress: 16; /* depth of end nodes not to compress;0=off */
+    unsigned int codec;
+    quicklistCache *cache;
+    quicklistCountIndex *cindex;
 } quicklist;
 
 // 优化级别
@@ -109,6 +134,7 @@ typedef struct quicklistIter {
     unsigned char *zi;  // 存储通过 ziplistIndex() 获取的ziplist的值
     long offset;
     int direction;
+    ziplistIter zit;    // current 的 ziplist 迭代器，zi 为 NULL 时在 offset 处重新初始化
 } quicklistIter;
 
 typedef struct quicklistEntry {
@@ -126,13 +152,28 @@ typedef struct quicklistEntry {
 
 #define QUICKLIST_NODE_ENCODING_RAW 1
 #define QUICKLIST_NODE_ENCODING_LZF 2
+#define QUICKLIST_NODE_ENCODING_LZ4 3   // 解压更快
+#define QUICKLIST_NODE_ENCODING_LZH 4   // LZ77 + Huffman，压缩率更高
+#define QUICKLIST_NODE_ENCODING_MAX QUICKLIST_NODE_ENCODING_LZH
+
+/**
+ * 节点的压缩算法
+ * compress 把 in 的 in_len 字节压缩到 out，最多 out_len 字节，放不下时返回0
+ * decompress 把 in 的 in_len 字节解压到 out，最多 out_len 字节，失败时返回0
+ * 两者都返回写入 out 的字节数，不压缩的算法(RAW)两者都为 NULL
+ */
+typedef struct quicklistCodec {
+    const char *name;
+    unsigned int (*compress)(const void *const in, unsigned int in_len, void *out, unsigned int out_len);
+    unsigned int (*decompress)(const void *const in, unsigned int in_len, void *out, unsigned int out_len);
+} quicklistCodec;
 
 #define QUICKLIST_NOCOMPRESS 0
 
 #define QUICKLIST_NODE_CONTAINER_NONE 1
 #define QUICKLIST_NODE_CONTAINER_ZIPLIST 2
 
-#define quicklistNodeIsCompressed(node) ((node)->encoding == QUICKLIST_NODE_ENCODING_LZF)
+#define quicklistNodeIsCompressed(node) ((node)->encoding != QUICKLIST_NODE_ENCODING_RAW)
 
 #ifndef REDIS_STATIC
 #define REDIS_STATIC static
@@ -153,6 +194,18 @@ typedef struct quicklistEntry {
  */
 #define MIN_COMPRESS_IMPROVE 8
 
+#define QUICKLIST_NODE_VERSION_MAX 127
+
+// 解压缓存最多缓存的节点数量
+#define QUICKLIST_CACHE_MAX_NODES 64
+
+// 计数索引的最大层数，以及节点出现在上一层的概率，与有序集合的跳表相同
+#define QUICKLIST_INDEX_MAXLEVEL 32
+#define QUICKLIST_INDEX_P 0.25
+
+// 后台压缩线程最多同时持有的任务数量，超过之后在调用线程上同步压缩
+#define QUICKLIST_COMPRESS_MAX_PENDING 64
+
 /* If not verbose testing, remove all debug printing. */
 #ifndef REDIS_TEST_VERBOSE
 #define D(...)
@@ -258,8 +311,35 @@ unsigned long quicklistCount(const quicklist *ql);
 
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len);
 
+// 只适用于 encoding 为 QUICKLIST_NODE_ENCODING_LZF 的节点
 size_t quicklistGetLzf(const quicklistNode *node, void **data);
 
+// 设置之后压缩节点时使用的算法，RAW 表示不再压缩新的节点，encoding 不合法时返回0
+int quicklistSetCodec(quicklist *quicklist, int encoding);
+
+// 返回 encoding 对应的压缩算法，encoding 不合法时返回 NULL
+const quicklistCodec *quicklistGetCodec(int encoding);
+
+// 设置解压缓存的大小(解压之后 ziplist 的总字节数)，0 表示关闭缓存并重新压缩缓存中的节点
+// 注意：放入缓存时可能淘汰并压缩其他节点，迭代期间不要用 quicklistIndex 访问同一个 quicklist
+void quicklistSetCacheSize(quicklist *quicklist, size_t bytes);
+
+// 打开(on 为1)或关闭计数索引，打开时根据现有的节点建立索引
+void quicklistSetCountIndex(quicklist *quicklist, int on);
+
+/**
+ * 启动后台压缩线程，之后离开 compress 深度的节点不在调用线程上压缩，而是复制一份交给后台线程，
+ * 压缩的结果在下一次 push 到同一个 quicklist 时替换节点的 ziplist，节点在此期间被修改过时丢弃
+ * 成功或者已经启动返回0，创建线程失败返回-1
+ */
+int quicklistCompressWorkerStart(void);
+
+// 等待后台线程完成所有任务后停止，并处理所有 quicklist 的压缩结果
+void quicklistCompressWorkerStop(void);
+
+// 处理 quicklist 已经完成的后台压缩结果，迭代这个 quicklist 的时候不能调用
+void quicklistCompressWorkerDrain(quicklist *quicklist);
+
 #define AL_START_HEAD 0
 #define AL_START_TAIL 1
 
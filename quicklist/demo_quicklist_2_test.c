@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include <assert.h>
 #include <string.h>
 #include "demo_quicklist_2_ziplist.h"
@@ -68,6 +69,20 @@ static long long ustime(void) {
     return ust;
 }
 
+static long long nstime(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static int cmplonglong(const void *a, const void *b) {
+
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
 static long long mstime() {
 
     return ustime() / 1000;
@@ -213,9 +228,8 @@ static char *genstr(char *prefix, int i) {
 
 void test_case_1(int argc, char *argv[]) {
 
-    UNUSED(argc);
-    UNUSED(argv);
-
+    // 只输出耗时的测试很慢(最大的 quicklist 有 1 亿个元素)，只有指定 --bench 时才运行
+    int bench = argc > 1 && strcmp(argv[1], "--bench") == 0;
     unsigned int err = 0;
     int optimize_start = -(int)(sizeof(optimization_level) / sizeof(*optimization_level));
 
@@ -1323,11 +1337,544 @@ void test_case_1(int argc, char *argv[]) {
 
     long long stop = mstime();
 
+    for (int depth = 1; depth <= 3; depth++) {
+        TEST_DESC("async compression matches sync compression at compress %d", depth); {
+            // 同样的操作序列分别在后台压缩和同步压缩下执行一次
+            quicklist *ql[2];
+            for (int async = 1; async >= 0; async--) {
+                if (async) quicklistCompressWorkerStart();
+                ql[async] = quicklistNew(-1, depth);
+                srand(47 + depth);
+                for (int op = 0; op < 20000; op++) {
+                    int r = rand() % 100;
+                    char *v = genstr("async compression value ", rand() % 1000);
+                    if (r < 40) {
+                        quicklistPushTail(ql[async], v, 32);
+                    } else if (r < 75) {
+                        quicklistPushHead(ql[async], v, 32);
+                    } else if (r < 85 && ql[async]->count) {
+                        quicklistReplaceAtIndex(ql[async], rand() % ql[async]->count, v, 32);
+                    } else if (r < 90 && ql[async]->count) {
+                        quicklistDelRange(ql[async], rand() % ql[async]->count, 1 + rand() % 50);
+                    } else if (r < 97) {
+                        quicklistPop(ql[async], rand() % 2 ? QUICKLIST_HEAD : QUICKLIST_TAIL, NULL, NULL, NULL);
+                    } else if (ql[async]->count) {
+                        quicklistEntry entry;
+                        quicklistIndex(ql[async], rand() % ql[async]->count, &entry);
+                    }
+                }
+                if (async) quicklistCompressWorkerStop();
+            }
+
+            quicklistIter *it[2] = {quicklistGetIterator(ql[0], AL_START_HEAD), quicklistGetIterator(ql[1], AL_START_HEAD)};
+            quicklistEntry e0, e1;
+            while (quicklistNext(it[0], &e0)) {
+                if (!quicklistNext(it[1], &e1) || e0.sz != e1.sz || memcmp(e0.value, e1.value, e0.sz) != 0) {
+                    ERR("async list differs at offset %d", e0.offset);
+                    err++;
+                    break;
+                }
+            }
+            quicklistReleaseIterator(it[0]);
+            quicklistReleaseIterator(it[1]);
+
+            // 节点结构相同，compress 深度之内没有压缩的节点，同步压缩的节点后台也完成了压缩
+            unsigned int at = 0, lzf[2] = {0, 0};
+            quicklistNode *n0 = ql[0]->head, *n1 = ql[1]->head;
+            for (; n0 && n1; n0 = n0->next, n1 = n1->next, at++) {
+                if (n0->count != n1->count || n1->pending) {
+                    ERR("node %u: count %u vs %u, pending %d", at, n0->count, n1->count, n1->pending);
+                    err++;
+                }
+                if ((at < ql[1]->compress || at >= ql[1]->len - ql[1]->compress) && quicklistNodeIsCompressed(n1)) {
+                    ERR("node %u compressed inside depth %d", at, depth);
+                    err++;
+                }
+                lzf[0] += quicklistNodeIsCompressed(n0);
+                lzf[1] += quicklistNodeIsCompressed(n1);
+            }
+            if (n0 || n1 || lzf[1] < lzf[0]) {
+                ERR("%u compressed nodes with worker, %u without", lzf[1], lzf[0]);
+                err++;
+            }
+            quicklistRelease(ql[0]);
+            quicklistRelease(ql[1]);
+        }
+    }
+
+    for (int enc = QUICKLIST_NODE_ENCODING_LZF; enc <= QUICKLIST_NODE_ENCODING_MAX; enc++) {
+        const quicklistCodec *codec = quicklistGetCodec(enc);
+        TEST_DESC("%s codec round trip", codec->name); {
+            // 随机字节、小字母表、长重复和随机长度的重复片段，覆盖字面量和匹配长度的扩展字节
+            // 不可压缩的数据会略微变长，输出缓冲区留出余量
+            unsigned char *in = malloc(70000), *out = malloc(80000), *back = malloc(70000);
+            srand(48 + enc);
+            for (int round = 0; round < 400; round++) {
+                unsigned int len = (round < 100) ? round : rand() % 70000, olen, blen;
+                int kind = round % 4;
+                for (unsigned int i = 0; i < len; i++) {
+                    if (kind == 0) {
+                        in[i] = rand();
+                    } else if (kind == 1) {
+                        in[i] = 'a' + rand() % 4;
+                    } else if (kind == 2) {
+                        in[i] = (i / 1000) & 0xff;
+                    } else {
+                        in[i] = (i > 64 && rand() % 50) ? in[i - 1 - rand() % 64] : rand();
+                    }
+                }
+                olen = codec->compress(in, len, out, 80000);
+                if (len && olen == 0) {
+                    ERR("%s: %u bytes of kind %d did not fit", codec->name, len, kind);
+                    err++;
+                    continue;
+                }
+                if (len == 0) continue;
+                blen = codec->decompress(out, olen, back, len);
+                if (blen != len || memcmp(in, back, len) != 0) {
+                    ERR("%s: round trip of %u bytes of kind %d returned %u bytes", codec->name, len, kind, blen);
+                    err++;
+                }
+                // 输出缓冲区太小，或者数据被截断时不能越界
+                if (len > 1 && codec->decompress(out, olen, back, len - 1) != 0) {
+                    ERR("%s: decompressed %u bytes into a short buffer", codec->name, len);
+                    err++;
+                }
+                codec->decompress(out, olen / 2, back, len);
+            }
+            free(in);
+            free(out);
+            free(back);
+        }
+    }
+
+    TEST("switch codec while the list grows"); {
+        // 每 2000 个元素换一次压缩算法，已经压缩的节点按照各自的算法解压
+        quicklist *ql = quicklistNew(-2, 1);
+        unsigned int seen[QUICKLIST_NODE_ENCODING_MAX + 1] = {0};
+        char buf[64];
+        int n = 12000;
+        for (int i = 0; i < n; i++) {
+            if (i % 2000 == 0) quicklistSetCodec(ql, QUICKLIST_NODE_ENCODING_LZF + (i / 2000) % 3);
+            int sz = sprintf(buf, "{\"id\":%d,\"codec\":%u}", i, ql->codec);
+            quicklistPushTail(ql, buf, sz);
+        }
+        if (quicklistSetCodec(ql, 0) || quicklistSetCodec(ql, QUICKLIST_NODE_ENCODING_MAX + 1)) {
+            ERR("%s", "invalid codec accepted");
+            err++;
+        }
+        for (quicklistNode *node = ql->head; node; node = node->next) seen[node->encoding]++;
+        for (int enc = QUICKLIST_NODE_ENCODING_LZF; enc <= QUICKLIST_NODE_ENCODING_MAX; enc++) {
+            if (seen[enc] == 0) {
+                ERR("no node compressed with %s", quicklistGetCodec(enc)->name);
+                err++;
+            }
+        }
+
+        quicklist *copy = quicklistDup(ql);
+        for (int round = 0; round < 2; round++) {
+            quicklist *cur = round ? copy : ql;
+            quicklistIter *iter = quicklistGetIterator(cur, AL_START_HEAD);
+            quicklistEntry entry;
+            int i = 0;
+            while (quicklistNext(iter, &entry)) {
+                int sz = sprintf(buf, "{\"id\":%d,\"codec\":", i);
+                if (entry.sz < (unsigned int)sz || memcmp(entry.value, buf, sz) != 0) {
+                    ERR("%s entry %d is %.*s", round ? "copy" : "list", i, (int)entry.sz, entry.value);
+                    err++;
+                    break;
+                }
+                i++;
+            }
+            quicklistReleaseIterator(iter);
+            if (i != n) {
+                ERR("%s has %d entries", round ? "copy" : "list", i);
+                err++;
+            }
+        }
+
+        // RAW 表示之后不再压缩
+        quicklistSetCodec(ql, QUICKLIST_NODE_ENCODING_RAW);
+        for (int i = 0; i < 2000; i++) quicklistPushTail(ql, buf, 20);
+        if (quicklistNodeIsCompressed(ql->tail->prev)) {
+            ERR("%s", "node compressed after codec set to RAW");
+            err++;
+        }
+        // 后台压缩线程运行时，RAW 也不会创建压缩任务
+        quicklistCompressWorkerStart();
+        for (int i = 0; i < 2000; i++) quicklistPushTail(ql, buf, 20);
+        for (quicklistNode *node = ql->head; node; node = node->next) {
+            if (node->pending) {
+                ERR("%s", "background job queued after codec set to RAW");
+                err++;
+                break;
+            }
+        }
+        quicklistCompressWorkerStop();
+        quicklistRelease(ql);
+        quicklistRelease(copy);
+    }
+
+    if (bench) {
+        TEST("codec benchmark: ratio, compress and decompress MB/s on ziplist nodes");
+        // 每种数据 fill -2(8KB)的 ziplist，和节点压缩时的输入相同
+        const char *kinds[] = {"numbers", "json", "words", "random"};
+        const char *words[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel"};
+        unsigned char *out = malloc(16384), *back = malloc(16384);
+        char buf[128];
+        for (int k = 0; k < 4; k++) {
+            quicklist *ql = quicklistNew(-2, 0);
+            srand(480 + k);
+            for (int i = 0; i < 20000; i++) {
+                int sz;
+                if (k == 0) {
+                    sz = sprintf(buf, "%d", 1000000 + rand() % 100000);
+                } else if (k == 1) {
+                    sz = sprintf(buf, "{\"id\":%d,\"user\":\"user:%d\",\"status\":\"%s\",\"score\":%d}",
+                                 i, rand() % 5000, rand() % 3 ? "active" : "idle", rand() % 1000);
+                } else if (k == 2) {
+                    sz = sprintf(buf, "%s %s %s", words[rand() % 8], words[rand() % 8], words[rand() % 8]);
+                } else {
+                    sz = 24;
+                    for (int j = 0; j < sz; j++) buf[j] = rand();
+                }
+                quicklistPushTail(ql, buf, sz);
+            }
+
+            for (int enc = QUICKLIST_NODE_ENCODING_LZF; enc <= QUICKLIST_NODE_ENCODING_MAX; enc++) {
+                const quicklistCodec *codec = quicklistGetCodec(enc);
+                unsigned long long raw = 0, packed = 0;
+                long long ctime = 0, dtime = 0, t;
+                // 取3次中最快的一次
+                for (int run = 0; run < 3; run++) {
+                    long long c = 0, d = 0;
+                    raw = packed = 0;
+                    for (quicklistNode *node = ql->head; node; node = node->next) {
+                        t = nstime();
+                        unsigned int olen = codec->compress(node->zl, node->sz, out, 16384);
+                        c += nstime() - t;
+                        t = nstime();
+                        unsigned int blen = codec->decompress(out, olen, back, node->sz);
+                        d += nstime() - t;
+                        if (blen != node->sz || memcmp(back, node->zl, blen) != 0) {
+                            ERR("%s failed on %s", codec->name, kinds[k]);
+                            err++;
+                        }
+                        raw += node->sz;
+                        packed += olen;
+                    }
+                    if (run == 0 || c < ctime) ctime = c;
+                    if (run == 0 || d < dtime) dtime = d;
+                }
+                printf("\t%-8s %-4s: ratio %5.2f, compress %7.1f MB/s, decompress %7.1f MB/s\n", kinds[k],
+                       codec->name, (double)raw / packed, raw * 1000.0 / ctime, raw * 1000.0 / dtime);
+            }
+            quicklistRelease(ql);
+        }
+        free(out);
+        free(back);
+    }
+
+    for (int depth = 1; depth <= 2; depth++) {
+        TEST_DESC("decompression cache matches uncached list at compress %d", depth); {
+            // 同样的操作序列分别在有缓存和没有缓存的 quicklist 上执行
+            size_t limit = 32 * 1024;
+            quicklist *ql[2] = {quicklistNew(-1, depth), quicklistNew(-1, depth)};
+            quicklistSetCacheSize(ql[1], limit);
+            for (int i = 0; i < 20000; i++) {
+                char *v = genstr("cached value ", i);
+                quicklistPushTail(ql[0], v, 32);
+                quicklistPushTail(ql[1], v, 32);
+            }
+            srand(49 + depth);
+            for (int op = 0; op < 20000; op++) {
+                // 删除比插入多，元素不够时补充
+                if (ql[0]->count < 10000) {
+                    for (int i = 0; i < 5000; i++) {
+                        char *v = genstr("cached refill ", i);
+                        quicklistPushTail(ql[0], v, 32);
+                        quicklistPushTail(ql[1], v, 32);
+                    }
+                }
+                int r = rand() % 100;
+                long idx = rand() % ql[0]->count;
+                int n = 1 + rand() % 200;
+                char *v = genstr("cached update ", op);
+                for (int c = 0; c < 2; c++) {
+                    quicklistEntry entry;
+                    if (r < 40) {
+                        quicklistIndex(ql[c], idx, &entry);
+                    } else if (r < 80) {
+                        quicklistIter *iter = quicklistGetIteratorAtIdx(ql[c], AL_START_HEAD, idx);
+                        while (n-- && quicklistNext(iter, &entry));
+                        quicklistReleaseIterator(iter);
+                        n = 1 + rand() % 200;
+                    } else if (r < 88) {
+                        quicklistReplaceAtIndex(ql[c], idx, v, 32);
+                    } else if (r < 94) {
+                        quicklistIndex(ql[c], idx, &entry);
+                        quicklistInsertAfter(ql[c], &entry, v, 32);
+                    } else {
+                        quicklistDelRange(ql[c], idx, 1 + idx % 300);
+                    }
+                }
+
+                // 缓存中的节点都是解压的，总大小不超过上限(节点在两次访问之间可能变大一些)
+                size_t bytes = 0;
+                for (quicklistNode *node = ql[1]->head; node; node = node->next) {
+                    if (node->cached && !quicklistNodeIsCompressed(node)) bytes += node->sz;
+                }
+                if (bytes > limit + 8192) {
+                    ERR("cache holds %zu bytes, limit %zu", bytes, limit);
+                    err++;
+                    break;
+                }
+            }
+
+            quicklistIter *it[2] = {quicklistGetIterator(ql[0], AL_START_HEAD), quicklistGetIterator(ql[1], AL_START_HEAD)};
+            quicklistEntry e0, e1;
+            while (quicklistNext(it[0], &e0)) {
+                if (!quicklistNext(it[1], &e1) || e0.sz != e1.sz || memcmp(e0.value, e1.value, e0.sz) != 0) {
+                    ERR("cached list differs at offset %d", e0.offset);
+                    err++;
+                    break;
+                }
+            }
+            quicklistReleaseIterator(it[0]);
+            quicklistReleaseIterator(it[1]);
+
+            // 关闭缓存之后，缓存中深度之外的节点都重新压缩了
+            quicklistNode *held[QUICKLIST_CACHE_MAX_NODES];
+            int nheld = 0;
+            for (quicklistNode *node = ql[1]->head; node; node = node->next) {
+                if (node->cached) held[nheld++] = node;
+            }
+            quicklistSetCacheSize(ql[1], 0);
+            if (nheld == 0) {
+                ERR("%s", "nothing was cached");
+                err++;
+            }
+            unsigned int at = 0;
+            for (quicklistNode *node = ql[1]->head; node; node = node->next, at++) {
+                int was_held = 0;
+                for (int i = 0; i < nheld; i++) was_held |= held[i] == node;
+                if (node->cached || (was_held && at >= ql[1]->compress && at < ql[1]->len - ql[1]->compress &&
+                                     !quicklistNodeIsCompressed(node))) {
+                    ERR("node %u left raw after the cache was disabled", at);
+                    err++;
+                    break;
+                }
+            }
+            quicklistRelease(ql[0]);
+            quicklistRelease(ql[1]);
+        }
+    }
+
+    if (bench) {
+        TEST("LRANGE 100 over the middle of a 10M element list, by cache size");
+        // fill -2，compress 1，只有两端的节点不压缩；在中间 10 万个元素的范围内随机 LRANGE
+        quicklist *ql = quicklistNew(-2, 1);
+        char buf[32];
+        long long n = 10000000, t;
+        size_t sizes[] = {0, 64 * 1024, 256 * 1024, 1024 * 1024};
+        for (long long i = 0; i < n; i++) {
+            int sz = ll2string(buf, sizeof(buf), i);
+            quicklistPushTail(ql, buf, sz);
+        }
+        printf("\t%lu nodes, %lu elements\n", ql->len, ql->count);
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+            long long sum = 0, best = 0;
+            quicklistSetCacheSize(ql, sizes[s]);
+            // 取3次中最快的一次
+            for (int run = 0; run < 3; run++) {
+                srand(4900);
+                t = ustime();
+                for (int q = 0; q < 5000; q++) {
+                    long long start = n / 2 - 50000 + rand() % 100000;
+                    quicklistIter *iter = quicklistGetIteratorAtIdx(ql, AL_START_HEAD, start);
+                    quicklistEntry entry;
+                    for (int k = 0; k < 100 && quicklistNext(iter, &entry); k++) sum += entry.longval;
+                    quicklistReleaseIterator(iter);
+                }
+                t = ustime() - t;
+                if (run == 0 || t < best) best = t;
+            }
+            assertx(sum != 0);
+            printf("\tcache %5zu KB: %6.2f us/LRANGE\n", sizes[s] / 1024, best / 5000.0);
+        }
+        quicklistRelease(ql);
+    }
+
+    for (int f = 4; f <= 64; f *= 4) {
+        TEST_DESC("count index matches linear lookup at fill %d", f); {
+            // 同样的操作序列分别在有索引和没有索引的 quicklist 上执行，fill 很小，经常切分和合并节点
+            quicklist *ql[2] = {quicklistNew(f, 1), quicklistNew(f, 1)};
+            quicklistSetCountIndex(ql[1], 1);
+            srand(50 + f);
+            for (int op = 0; op < 30000; op++) {
+                int r = rand() % 100;
+                long count = ql[0]->count;
+                long idx = count ? rand() % count : 0;
+                int n = 1 + rand() % (f * 3);
+                char *v = genstr("indexed ", op);
+                for (int c = 0; c < 2; c++) {
+                    quicklistEntry entry;
+                    if (r < 25) {
+                        quicklistPushTail(ql[c], v, 16);
+                    } else if (r < 40) {
+                        quicklistPushHead(ql[c], v, 16);
+                    } else if (r < 60 && count) {
+                        quicklistIndex(ql[c], idx, &entry);
+                        if (r % 2) {
+                            quicklistInsertAfter(ql[c], &entry, v, 16);
+                        } else {
+                            quicklistInsertBefore(ql[c], &entry, v, 16);
+                        }
+                    } else if (r < 70 && count) {
+                        quicklistReplaceAtIndex(ql[c], idx, v, 16);
+                    } else if (r < 80 && count) {
+                        quicklistDelRange(ql[c], idx, n);
+                    } else if (r < 90) {
+                        quicklistPop(ql[c], r % 2 ? QUICKLIST_HEAD : QUICKLIST_TAIL, NULL, NULL, NULL);
+                    } else if (r < 92 && count) {
+                        quicklistIter *iter = quicklistGetIteratorAtIdx(ql[c], AL_START_TAIL, idx);
+                        for (int k = 0; k < n && quicklistNext(iter, &entry); k++) quicklistDelEntry(iter, &entry);
+                        quicklistReleaseIterator(iter);
+                    } else if (r == 92 && c == 1) {
+                        // 关闭之后重新建立索引
+                        quicklistSetCountIndex(ql[1], 0);
+                        quicklistSetCountIndex(ql[1], 1);
+                    }
+                }
+
+                // 正向和反向的随机下标都找到同样的元素和偏移量
+                for (int k = 0; k < 4 && ql[0]->count; k++) {
+                    long long i = rand() % ql[0]->count;
+                    if (k % 2) i = -1 - i;
+                    quicklistEntry e0, e1;
+                    int f0 = quicklistIndex(ql[0], i, &e0), f1 = quicklistIndex(ql[1], i, &e1);
+                    if (f0 != f1 || e0.offset != e1.offset || e0.sz != e1.sz ||
+                        (e0.value && memcmp(e0.value, e1.value, e0.sz) != 0)) {
+                        ERR("index %lld after op %d: offset %d vs %d", i, op, e0.offset, e1.offset);
+                        err++;
+                        op = 30000;
+                        break;
+                    }
+                }
+            }
+
+            quicklist *copy = quicklistDup(ql[1]);
+            for (long long i = 0; i < (long long)ql[0]->count; i += 7) {
+                quicklistEntry e0, e1;
+                quicklistIndex(ql[0], i, &e0);
+                quicklistIndex(copy, i, &e1);
+                if (e0.sz != e1.sz || memcmp(e0.value, e1.value, e0.sz) != 0) {
+                    ERR("copy differs at index %lld", i);
+                    err++;
+                    break;
+                }
+            }
+            quicklistRelease(copy);
+            quicklistRelease(ql[0]);
+            quicklistRelease(ql[1]);
+        }
+    }
+
+    if (bench) {
+        TEST("random LINDEX from 1K to 100M elements, linear walk vs count index");
+        // 同一个 quicklist(fill -2，不压缩)逐渐增长，每个大小分别在关闭和打开索引时随机 LINDEX
+        quicklist *ql = quicklistNew(-2, 0);
+        char buf[32];
+        long long size = 0, sum = 0, t;
+        int lookups = 20000;
+        for (long long target = 1000; target <= 100000000; target *= 10) {
+            for (; size < target; size++) {
+                int sz = ll2string(buf, sizeof(buf), size);
+                quicklistPushTail(ql, buf, sz);
+            }
+            double ns[2];
+            for (int indexed = 0; indexed <= 1; indexed++) {
+                quicklistSetCountIndex(ql, indexed);
+                srand(5000);
+                t = nstime();
+                for (int q = 0; q < lookups; q++) {
+                    quicklistEntry entry;
+                    long long i = ((long long)rand() * RAND_MAX + rand()) % size;
+                    quicklistIndex(ql, i, &entry);
+                    sum += entry.longval;
+                }
+                ns[indexed] = (double)(nstime() - t) / lookups;
+            }
+            printf("\t%10lld elements, %6lu nodes: linear %9.1f ns, indexed %6.1f ns\n", size, ql->len, ns[0], ns[1]);
+        }
+        assertx(sum != 0);
+        quicklistRelease(ql);
+    }
+
+    if (bench) {
+        TEST("push latency with compress 1, sync vs async compression");
+        int n = 200000;
+        long long *lat = malloc(sizeof(long long) * n), t;
+        char buf[64];
+        for (int f = -1; f >= -2; f--) {
+            for (int async = 0; async <= 1; async++) {
+                if (async) quicklistCompressWorkerStart();
+                quicklist *ql = quicklistNew(f, 1);
+                long long total = nstime();
+                for (int i = 0; i < n; i++) {
+                    int sz = sprintf(buf, "{\"id\":%d,\"status\":\"active\",\"score\":%d}", i, i % 1000);
+                    t = nstime();
+                    quicklistPushTail(ql, buf, sz);
+                    lat[i] = nstime() - t;
+                }
+                total = nstime() - total;
+                if (async) quicklistCompressWorkerStop();
+
+                unsigned long compressed = 0;
+                for (quicklistNode *node = ql->head; node; node = node->next) compressed += quicklistNodeIsCompressed(node);
+                qsort(lat, n, sizeof(long long), cmplonglong);
+                printf("\tfill %d %-5s: p50 %5lld ns, p99 %6lld ns, p99.9 %6lld ns, max %7lld ns, total %4lld ms, %lu/%lu nodes compressed\n",
+                       f, async ? "async" : "sync", lat[n / 2], lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1],
+                       total / 1000000, compressed, ql->len);
+                quicklistRelease(ql);
+            }
+        }
+        free(lat);
+    }
+
+    if (bench) {
+        TEST("iteration benchmark");
+        // 100000 个字符串和整数混合的元素，fill -2(8KB 的 ziplist)，不压缩
+        quicklist *ql = quicklistNew(-2, 0);
+        char buf[32];
+        long long sum = 0, t;
+        int rounds = 20;
+        for (int i = 0; i < 100000; i++) {
+            int sz = (i % 3) ? sprintf(buf, "%d", i) : sprintf(buf, "value:%d", i);
+            quicklistPushTail(ql, buf, sz);
+        }
+
+        for (int forward = 1; forward >= 0; forward--) {
+            t = ustime();
+            for (int r = 0; r < rounds; r++) {
+                quicklistIter *iter = quicklistGetIterator(ql, forward ? AL_START_HEAD : AL_START_TAIL);
+                quicklistEntry entry;
+                while (quicklistNext(iter, &entry)) sum += entry.value ? entry.sz : entry.longval;
+                quicklistReleaseIterator(iter);
+            }
+            t = ustime() - t;
+            printf("\t%s: %.2f ns/entry\n", forward ? "forward" : "reverse", t * 1000.0 / (rounds * 100000.0));
+        }
+        assertx(sum != 0);
+        quicklistRelease(ql);
+    }
+
     printf("\n");
     for (size_t i = 0; i < option_count; i++) {
         printf("Test Loop %02d: %0.2f seconds.\n", options[i], (float)runtime[i] / 1000);
     }
     printf("Compressions: %0.2f seconds.\n", (float)(stop - start) / 1000);
+    if (!bench) printf("Benchmarks skipped, run with --bench to include them.\n");
     printf("\n");
 
     if (!err) {
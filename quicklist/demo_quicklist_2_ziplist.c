@@ -6,26 +6,6 @@
 #include "demo_quicklist_2_util.h"
 #include "demo_quicklist_2_ziplist.h"
 
-/**
- * 返回encoding 指定的整数编码方式所需的长度
- * 复杂度：O(1)
- */
-static unsigned int zipIntSize(unsigned char encoding) {
-
-    switch (encoding) {
-        case ZIP_INT_8B:    return 1;
-        case ZIP_INT_16B:   return 2;
-        case ZIP_INT_24B:   return 3;
-        case ZIP_INT_32B:   return 4;
-        case ZIP_INT_64B:   return 8;
-    }
-    if (encoding >= ZIP_INT_IMM_MIN && encoding <= ZIP_INT_IMM_MAX) {
-        return 0;
-    }
-    assert(NULL);
-    return 0;
-}
-
 unsigned int zipStoreEntryEncoding(unsigned char *p, unsigned char encoding, unsigned int rawlen) {
     unsigned char len = 1, buf[5];
 
@@ -744,6 +724,25 @@ unsigned char *ziplistIndex(unsigned char *zl, int index) {
     return (p[0] == ZIP_END || index > 0) ? NULL : p;
 }
 
+/*
+ * 初始化从节点 p 开始的迭代器，第一次调用 ziplistIterNext 返回的就是 p
+ *
+ * 与 ziplistPrev 一致，p 指向结束符时向前迭代从表尾开始
+ *
+ * 复杂度：O(1)
+ */
+void ziplistIterInitAt(unsigned char *zl, unsigned char *p, ziplistIter *iter, int direction) {
+
+    if (p != NULL && p[0] == ZIP_END) {
+        p = (direction == ZIPLIST_TAIL) ? ZIPLIST_ENTRY_TAIL(zl) : NULL;
+        if (p != NULL && p[0] == ZIP_END) p = NULL;
+    }
+    iter->zl = zl;
+    iter->next = p;
+    iter->direction = direction;
+    ZIPLIST_ENTRY_ZERO(&iter->e);
+}
+
 /*
  * 返回指向 p 的下一个节点的指针，
  * 如果 p 已经到达表尾，那么返回 NULL 。
@@ -3,6 +3,7 @@
 
 #include "demo_quicklist_2_endianconv.h"
 #include <assert.h>
+#include <string.h>
 
 
 #define ZIPLIST_HEAD 0
@@ -143,6 +144,28 @@ typedef struct zlentry {
     unsigned char *p;               // 内容
 } zlentry;
 
+/**
+ * ziplistIterNext 返回的值
+ * sval 不为 NULL 时是长度为 slen 的字符串，否则是整数 lval
+ */
+typedef struct ziplistEntry {
+    unsigned char *sval;
+    unsigned int slen;
+    long long lval;
+} ziplistEntry;
+
+/**
+ * ziplist 迭代器
+ * ziplistNext + ziplistGet 会把同一个节点的头部解析两次(zipRawEntryLength 和 zipEntry)，
+ * 迭代器每个节点只解析一次头部，结果保存在 e 中
+ */
+typedef struct ziplistIter {
+    unsigned char *zl;
+    unsigned char *next;    // 下一次要解码的节点，NULL 表示迭代结束
+    int direction;          // ZIPLIST_HEAD 从表头向表尾，ZIPLIST_TAIL 从表尾向表头
+    zlentry e;              // 最近一次返回的节点的头部，e.p 指向这个节点
+} ziplistIter;
+
 #define ZIPLIST_ENTRY_ZERO(zle) {                        \
     (zle)->prevrawlensize = (zle)->prevrawlen = 0;       \
     (zle)->lensize = (zle)->len = (zle)->headersize = 0; \
@@ -159,7 +182,25 @@ typedef struct zlentry {
     if ((encoding) < ZIP_STR_MASK) (encoding) &= ZIP_STR_MASK;  \
 } while(0)
 
-static unsigned int zipIntSize(unsigned char encoding);
+/**
+ * 返回encoding 指定的整数编码方式所需的长度
+ * 复杂度：O(1)
+ */
+static inline unsigned int zipIntSize(unsigned char encoding) {
+
+    switch (encoding) {
+        case ZIP_INT_8B:    return 1;
+        case ZIP_INT_16B:   return 2;
+        case ZIP_INT_24B:   return 3;
+        case ZIP_INT_32B:   return 4;
+        case ZIP_INT_64B:   return 8;
+    }
+    if (encoding >= ZIP_INT_IMM_MIN && encoding <= ZIP_INT_IMM_MAX) {
+        return 0;
+    }
+    assert(NULL);
+    return 0;
+}
 
 /**
  * 从 ptr 指针中取出节点的编码，保存节点长度所需的长度，以及节点长度
@@ -263,6 +304,68 @@ unsigned char *ziplistPush(unsigned char *zl, unsigned char *s, unsigned int sle
 
 unsigned char *ziplistIndex(unsigned char *zl, int index);
 
+// 初始化从节点 p 开始的迭代器，p 为 NULL 时迭代为空，p 指向结束符时向前迭代从表尾开始
+void ziplistIterInitAt(unsigned char *zl, unsigned char *p, ziplistIter *iter, int direction);
+
+/**
+ * 解码迭代器的下一个节点，头部保存到 iter->e，值保存到 entry
+ * 节点保存字符串时 entry->sval 和 entry->slen 指向字符串，lval 为0；否则 entry->sval 为 NULL，slen 为0，整数保存在 lval
+ *
+ * 每个节点的头部只解析一次，同时得到下一次迭代的位置：
+ * 向后迭代时是节点的末尾，向前迭代时根据 prevlen 后退
+ * 迭代的热点，定义为 static inline，迭代器的状态可以保存在寄存器中
+ *
+ * 复杂度：O(1)
+ *
+ * 返回值：迭代结束时返回0，否则返回1
+ */
+static inline __attribute__((always_inline)) int ziplistIterNext(ziplistIter *iter, ziplistEntry *entry) {
+
+    unsigned char *p = iter->next, *q;
+    zlentry *e = &iter->e;
+
+    if (p == NULL) return 0;
+
+    /**
+     * 结束符的检查合并在 prevlen 的判断中，这样编译器只能生成分支而不是条件传送：
+     * 绝大多数节点的 prevlen 只有1个字节，分支预测正确时，解码编码不需要等待 p[0] 的比较结果
+     */
+    if (p[0] < ZIP_BIG_PREVLEN) {
+        e->prevrawlensize = 1;
+        e->prevrawlen = p[0];
+    } else if (p[0] == ZIP_END) {
+        iter->next = NULL;
+        return 0;
+    } else {
+        e->prevrawlensize = 5;
+        memcpy(&e->prevrawlen, p + 1, 4);
+        memrev32ifbe(&e->prevrawlen);
+    }
+
+    ZIP_DECODE_LENGTH(p + e->prevrawlensize, e->encoding, e->lensize, e->len);
+    e->headersize = e->prevrawlensize + e->lensize;
+    e->p = p;
+
+    q = p + e->headersize;
+    if (ZIP_IS_STR(e->encoding)) {
+        entry->sval = q;
+        entry->slen = e->len;
+        entry->lval = 0;
+    } else {
+        entry->sval = NULL;
+        entry->slen = 0;
+        entry->lval = zipLoadInteger(q, e->encoding);
+    }
+
+    if (iter->direction == ZIPLIST_HEAD) {
+        iter->next = q + e->len;
+    } else {
+        // 第一个节点的 prevlen 为0
+        iter->next = e->prevrawlen ? p - e->prevrawlen : NULL;
+    }
+    return 1;
+}
+
 unsigned char *ziplistNext(unsigned char *zl, unsigned char *p);
 
 unsigned char *ziplistPrev(unsigned char *zl, unsigned char *p);
@@ -3,6 +3,16 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "demo_sds_2.h"
 
 const char *SDS_NOINIT = "SDS_NOINIT";
@@ -129,6 +139,7 @@ sds sdsnewlen(const void *init, size_t initlen) {
             sh->len = initlen;
             sh->alloc = initlen;
             *fp = type;
+            break;
         }
 
         case SDS_TYPE_32: {
@@ -163,6 +174,12 @@ sds sdsnewlen(const void *init, size_t initlen) {
 void sdsfree(sds s) {
 
     if (s == NULL) return;
+    if (sdsisshared(s)) {
+        struct sdsrefcount *rc = sdsAllocPtr(s);
+        if (--rc->refcount > 0) return;
+        free(rc);
+        return;
+    }
     free((char *)s - sdsHdrSize(s[-1]));
 }
 
@@ -173,6 +190,9 @@ void sdsfree(sds s) {
  */
 sds sdscpylen(sds s, const char *t, size_t len) {
 
+    s = sdsunshare(s);
+    if (s == NULL) return NULL;
+
     if (sdsalloc(s) < len) {
         s = sdsMakeRoomFor(s, len);
         if (s == NULL) return NULL;
@@ -199,6 +219,14 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {
     size_t len, newlen;
     int hdrlen;
 
+    // 共享字符串是只读的，先复制出私有副本
+    if (sdsisshared(s)) {
+        s = sdsunshare(s);
+        if (s == NULL) return NULL;
+        avail = sdsavail(s);
+        oldtype = s[-1] & SDS_TYPE_MASK;
+    }
+
     // 剩余空间可以满足需求，无须扩展
     if (avail >= addlen) return s;
 
@@ -464,6 +492,9 @@ sds sdstrim(sds s, const char *cset) {
     char *start, *end, *sp, *ep;
     size_t len;
 
+    s = sdsunshare(s);
+    if (s == NULL) return NULL;
+
     sp = start = s;
     ep = end = s + sdslen(s) - 1;
 
@@ -485,10 +516,18 @@ sds sdstrim(sds s, const char *cset) {
     return s;
 }
 
-// 创建一个给定SDS的副本(copy)
+// 创建一个给定SDS的副本(copy)，共享字符串只增加引用计数
 sds sdsdup(const sds s) {
 
-    return sdsnewlen(s, strlen(s));
+    if (sdsisshared(s)) {
+        struct sdsrefcount *rc = sdsAllocPtr(s);
+        // 引用计数即将溢出时退化为复制
+        if (rc->refcount < UINT32_MAX) {
+            rc->refcount++;
+            return s;
+        }
+    }
+    return sdsnewlen(s, sdslen(s));
 }
 
 // 保留SDS给定区间内的数据，不在区间内的数据会被覆盖或清除
@@ -496,6 +535,7 @@ void sdsrange(sds s, ssize_t start, ssize_t end) {
 
     size_t newlen, len = sdslen(s);
 
+    assert(!sdsisshared(s));
     if (len == 0) return;
 
     if (start < 0) {
@@ -532,6 +572,62 @@ void sdsrange(sds s, ssize_t start, ssize_t end) {
     sdssetlen(s, newlen);
 }
 
+// 按照 strlen 的结果更新 sds 的长度，用于手动修改了 buf 之后
+void sdsupdatelen(sds s) {
+
+    assert(!sdsisshared(s));
+    sdssetlen(s, strlen(s));
+}
+
+// 清除SDS保存的字符串内容，保留已分配的空间
+void sdsclear(sds s) {
+
+    assert(!sdsisshared(s));
+    sdssetlen(s, 0);
+    s[0] = '\0';
+}
+
+// 将给定 sds 中的字符全部转为小写
+void sdstolower(sds s) {
+
+    size_t len = sdslen(s), j;
+
+    assert(!sdsisshared(s));
+    for (j = 0; j < len; j++) s[j] = tolower((unsigned char)s[j]);
+}
+
+// 将给定 sds 中的字符全部转为大写
+void sdstoupper(sds s) {
+
+    size_t len = sdslen(s), j;
+
+    assert(!sdsisshared(s));
+    for (j = 0; j < len; j++) s[j] = toupper((unsigned char)s[j]);
+}
+
+/**
+ * 把 s 中出现在 from 里的字符替换为 to 中相同位置的字符，from 和 to 的长度都是 setlen
+ * 共享字符串会先复制出一个私有副本
+ */
+sds sdsmapchars(sds s, const char *from, const char *to, size_t setlen) {
+
+    size_t j, i, l;
+
+    s = sdsunshare(s);
+    if (s == NULL) return NULL;
+
+    l = sdslen(s);
+    for (j = 0; j < l; j++) {
+        for (i = 0; i < setlen; i++) {
+            if (s[j] == from[i]) {
+                s[j] = to[i];
+                break;
+            }
+        }
+    }
+    return s;
+}
+
 // 对比两个SDS字符串是否相同
 int sdscmp(const sds s1, const sds s2) {
 
@@ -549,44 +645,247 @@ int sdscmp(const sds s1, const sds s2) {
     return cmp;
 }
 
+/**
+ * sdscatrepr 使用的转义表
+ * 0 表示可以原样输出的字节，其他值是反斜杠后面的转义字符，'x' 表示输出为 \xHH
+ */
+static const char sdsReprTable[256] = {
+    // 0x00 - 0x1f，\a \b \t \n \r 使用对应的转义字符
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'a', 'b', 't', 'n', 'x', 'x', 'r', 'x', 'x',
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x',
+    ['"'] = '"', ['\\'] = '\\',
+    [127 ... 255] = 'x',
+};
+
+// 返回 p 开头连续的、可以原样输出的字节数
+static size_t sdsReprSafeRun(const unsigned char *p, size_t len) {
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // 每次检查16个字节：小于0x20(有符号比较时也包括大于等于0x80的字节)、0x7f、" 和 \ 需要转义
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+        bad = _mm_or_si128(bad, _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        int mask = _mm_movemask_epi8(bad);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+
+    while (i < len && sdsReprTable[p[i]] == 0) i++;
+    return i;
+}
+
+/**
+ * 把 p 的前 len 个字节转义成带双引号的可打印字符串，追加到 s 的末尾
+ * 连续的可打印字节整段复制，只有需要转义的字节才逐个处理
+ */
 sds sdscatrepr(sds s, const char *p, size_t len) {
 
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *u = (const unsigned char *)p;
+    char esc[4];
+    size_t run;
+
+    s = sdsMakeRoomFor(s, len + 2);
+    if (s == NULL) return NULL;
+
     s = sdscatlen(s, "\"", 1);
-    while (len--) {
-        switch (*p) {
-            case '\\':
-            case '"':
-                s = sdscatprintf(s, "\\%c", *p);
-                break;
-            case '\n':
-                s = sdscatlen(s, "\\n", 2);
-                break;
-            case '\r':
-                s = sdscatlen(s, "\\r", 2);
-                break;
-            case '\t':
-                s = sdscatlen(s, "\\t", 2);
-                break;
-            case '\a':
-                s = sdscatlen(s, "\\a", 2);
-                break;
-            case '\b':
-                s = sdscatlen(s, "\\b", 2);
-                break;
-            default:
-                if (isprint(*p)) {
-                    s = sdscatprintf(s, "%c", *p);
-                } else {
-                    s = sdscatprintf(s, "\\x%02x", (unsigned char)*p);
-                }
-                break;
+    while (len) {
+        run = sdsReprSafeRun(u, len);
+        if (run) {
+            s = sdscatlen(s, u, run);
+            u += run;
+            len -= run;
+            if (len == 0) break;
+        }
+
+        esc[0] = '\\';
+        esc[1] = sdsReprTable[*u];
+        if (esc[1] == 'x') {
+            esc[2] = hex[*u >> 4];
+            esc[3] = hex[*u & 0xf];
+            s = sdscatlen(s, esc, 4);
+        } else {
+            s = sdscatlen(s, esc, 2);
+        }
+        u++;
+        len--;
+    }
+    s = sdscatlen(s, "\"", 1);
+    return s;
+}
+
+// 返回 p 开头连续的、不是 c1 也不是 c2 的字节数
+static size_t sdsScanUntil2(const char *p, size_t len, char c1, char c2) {
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+
+    while (i < len && p[i] != c1 && p[i] != c2) i++;
+    return i;
+}
+
+// 判断是否是16进制字符
+static int sdsIsHexDigit(char c) {
+
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// 把16进制字符转换为数值
+static int sdsHexDigitToInt(char c) {
+
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return c - 'A' + 10;
+}
+
+/**
+ * sdscatrepr 的逆操作，p[0] 必须是 " 或 '
+ * 两个转义符之间的普通字节整段复制
+ */
+sds sdscatunrepr(sds s, const char *p, size_t len, size_t *consumed) {
+
+    size_t origlen = sdslen(s), i = 1, run;
+    char quote, c;
+
+    *consumed = 0;
+    if (len == 0 || (p[0] != '"' && p[0] != '\'')) return s;
+    quote = p[0];
+
+    s = sdsMakeRoomFor(s, len);
+    if (s == NULL) return NULL;
+
+    while (1) {
+        run = sdsScanUntil2(p + i, len - i, quote, '\\');
+        if (run) {
+            s = sdscatlen(s, p + i, run);
+            i += run;
+        }
+
+        // 没有找到结束的引号
+        if (i >= len) break;
+
+        if (p[i] == quote) {
+            *consumed = i + 1;
+            return s;
+        }
+
+        // 反斜杠在末尾，引号不匹配
+        if (i + 1 >= len) break;
+
+        if (quote == '\'') {
+            // 单引号字符串只转义 \'
+            if (p[i + 1] == '\'') {
+                s = sdscatlen(s, "'", 1);
+                i += 2;
+            } else {
+                s = sdscatlen(s, "\\", 1);
+                i++;
+            }
+            continue;
+        }
+
+        c = p[i + 1];
+        if (c == 'x' && i + 3 < len && sdsIsHexDigit(p[i + 2]) && sdsIsHexDigit(p[i + 3])) {
+            c = (sdsHexDigitToInt(p[i + 2]) << 4) | sdsHexDigitToInt(p[i + 3]);
+            i += 4;
+        } else {
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'b': c = '\b'; break;
+                case 'a': c = '\a'; break;
+            }
+            i += 2;
         }
-        p++;
+        s = sdscatlen(s, &c, 1);
     }
-    s =  sdscatlen(s, "\"", 1);
+
+    sdssetlen(s, origlen);
+    s[origlen] = '\0';
     return s;
 }
 
+// 释放 sdssplitlen 和 sdssplitargs 返回的数组
+void sdsfreesplitres(sds *tokens, int count) {
+
+    if (!tokens) return;
+    while (count--) {
+        sdsfree(tokens[count]);
+    }
+    free(tokens);
+}
+
+/**
+ * 按照空白字符把一行命令切分成参数
+ * 带引号的部分交给 sdscatunrepr 解码，结束的引号后面必须是空白字符或者字符串末尾
+ */
+sds *sdssplitargs(const char *line, int *argc) {
+
+    const char *p = line, *end = line + strlen(line);
+    sds current = NULL;
+    sds *vector = NULL, *newvector;
+    size_t consumed;
+
+    *argc = 0;
+    while (1) {
+        while (*p && isspace((unsigned char)*p)) p++;
+
+        if (*p == '\0') {
+            if (vector == NULL) vector = malloc(sizeof(sds));
+            return vector;
+        }
+
+        current = sdsempty();
+        while (*p && !isspace((unsigned char)*p)) {
+            if (*p == '"' || *p == '\'') {
+                current = sdscatunrepr(current, p, end - p, &consumed);
+                if (consumed == 0) goto err;
+                p += consumed;
+                // 结束的引号后面必须是空白字符
+                if (*p && !isspace((unsigned char)*p)) goto err;
+                break;
+            }
+            current = sdscatlen(current, p, 1);
+            p++;
+        }
+
+        newvector = realloc(vector, ((*argc) + 1) * sizeof(sds));
+        if (newvector == NULL) goto err;
+        vector = newvector;
+        vector[*argc] = current;
+        (*argc)++;
+        current = NULL;
+    }
+
+err:
+    while ((*argc)--) {
+        sdsfree(vector[*argc]);
+    }
+    free(vector);
+    if (current) sdsfree(current);
+    *argc = 0;
+    return NULL;
+}
+
 sds sdsfromlonglong(long long value) {
     char buf[SDS_LLSTR_SIZE];
     int len = sdsll2str(buf,value);
@@ -600,6 +899,7 @@ void sdsIncrLen(sds s, ssize_t incr) {
     unsigned char flags = s[-1];
     size_t len;
 
+    assert(!sdsisshared(s));
     switch (flags & SDS_TYPE_MASK) {
         case SDS_TYPE_5: {
             unsigned char *fp = ((unsigned char *) s) - 1;
@@ -674,4 +974,375 @@ sds sdsRemoveFreeSpace(sds s) {
 
     sdssetalloc(s, len);
     return s;
-}
\ No newline at end of file
+}
+
+// 计算给定 sds buf 的内存长度（包括header、已使用和未使用的空间）
+size_t sdsAllocSize(sds s) {
+
+    size_t size = sdsHdrSize(s[-1]) + sdsalloc(s) + 1;
+    if (sdsisshared(s)) size += sizeof(struct sdsrefcount);
+    return size;
+}
+
+// 返回 sds 实际分配的内存的起始地址，共享字符串的起始地址是引用计数
+void *sdsAllocPtr(sds s) {
+
+    char *p = s - sdsHdrSize(s[-1]);
+    if (sdsisshared(s)) p -= sizeof(struct sdsrefcount);
+    return p;
+}
+
+/**
+ * 按照 policy 压缩 s 占用的内存
+ * header类型不变时直接 realloc，否则分配新的内存并把数据复制过去
+ */
+sds sdsCompact(sds s, int policy, size_t *reclaimed) {
+
+    void *sh, *newsh;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen, oldhdrlen = sdsHdrSize(oldtype);
+    size_t len = sdslen(s), oldalloc = sdsalloc(s), newalloc = oldalloc;
+    size_t oldsize;
+
+    if (reclaimed) *reclaimed = 0;
+    if (sdsisshared(s)) return s;
+
+    if (policy & SDS_COMPACT_SLACK) newalloc = len;
+
+    type = oldtype;
+    if (policy & SDS_COMPACT_HEADER) {
+        type = sdsReqType(newalloc);
+        // SDS_TYPE_5 没有 alloc 字段，只能在没有未使用空间时使用
+        if (type == SDS_TYPE_5 && (!(policy & SDS_COMPACT_TYPE5) || newalloc != len)) {
+            type = SDS_TYPE_8;
+        }
+        if (type > oldtype) type = oldtype;
+    }
+
+    if (type == oldtype && newalloc == oldalloc) return s;
+
+    oldsize = sdsAllocSize(s);
+    sh = (char *)s - oldhdrlen;
+    hdrlen = sdsHdrSize(type);
+
+    if (type == oldtype) {
+        newsh = realloc(sh, hdrlen + newalloc + 1);
+        if (newsh == NULL) return s;
+        s = (char *)newsh + hdrlen;
+    } else {
+        newsh = malloc(hdrlen + newalloc + 1);
+        if (newsh == NULL) return s;
+
+        memcpy((char *)newsh + hdrlen, s, len + 1);
+        free(sh);
+
+        s = (char *)newsh + hdrlen;
+        s[-1] = type;
+        sdssetlen(s, len);
+    }
+
+    sdssetalloc(s, newalloc);
+    if (reclaimed) *reclaimed = oldsize - sdsAllocSize(s);
+    return s;
+}
+
+// 依次压缩数组中的 n 个 sds，返回回收的总字节数
+size_t sdsCompactMany(sds *array, size_t n, int policy) {
+
+    size_t j, reclaimed, total = 0;
+
+    for (j = 0; j < n; j++) {
+        if (array[j] == NULL) continue;
+        array[j] = sdsCompact(array[j], policy, &reclaimed);
+        total += reclaimed;
+    }
+    return total;
+}
+
+/**
+ * 创建一个引用计数为1的共享字符串
+ * 内存布局为: refcount | header | buf | '\0'
+ * 共享字符串不会再扩展，所以 alloc 和 len 相等
+ */
+sds sdsnewshared(const void *init, size_t initlen) {
+
+    char type = sdsReqType(initlen);
+    int hdrlen;
+    struct sdsrefcount *rc;
+    sds s;
+
+    if (type == SDS_TYPE_5) type = SDS_TYPE_8;
+    hdrlen = sdsHdrSize(type);
+
+    rc = malloc(sizeof(*rc) + hdrlen + initlen + 1);
+    if (rc == NULL) return NULL;
+
+    rc->refcount = 1;
+    s = (char *)rc + sizeof(*rc) + hdrlen;
+    s[-1] = type;
+    sdssetlen(s, initlen);
+    sdssetalloc(s, initlen);
+    s[-1] = type | SDS_SHARED;
+
+    if (initlen && init) memcpy(s, init, initlen);
+    s[initlen] = '\0';
+    return s;
+}
+
+// 返回共享字符串的引用计数，普通字符串返回1
+uint32_t sdsrefcount(const sds s) {
+
+    if (!sdsisshared(s)) return 1;
+    return ((struct sdsrefcount *)sdsAllocPtr(s))->refcount;
+}
+
+// 如果 s 是共享字符串，返回一个内容相同的私有副本，并释放对 s 的引用
+sds sdsunshare(sds s) {
+
+    sds copy;
+
+    if (!sdsisshared(s)) return s;
+
+    copy = sdsnewlen(s, sdslen(s));
+    if (copy == NULL) return NULL;
+    sdsfree(s);
+    return copy;
+}
+
+/**
+ * intern 表：开放寻址(线性探测)的哈希表，槽位为 NULL 表示空
+ * 表中的字符串只会在 sdsinternClear 时被释放，适合数量有限的热点小字符串
+ */
+static sds *sdsInternTable = NULL;
+static size_t sdsInternCap = 0;
+static size_t sdsInternUsed = 0;
+
+// FNV-1a 哈希
+static uint64_t sdsInternHash(const void *p, size_t len) {
+
+    const unsigned char *c = p;
+    uint64_t h = 14695981039346656037ULL;
+
+    while (len--) {
+        h ^= *c++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// 把 intern 表的容量扩展为 cap，cap 必须是2的幂
+static int sdsInternResize(size_t cap) {
+
+    sds *table = calloc(cap, sizeof(sds));
+    size_t j, idx;
+
+    if (table == NULL) return -1;
+
+    for (j = 0; j < sdsInternCap; j++) {
+        sds s = sdsInternTable[j];
+        if (s == NULL) continue;
+
+        idx = sdsInternHash(s, sdslen(s)) & (cap - 1);
+        while (table[idx]) idx = (idx + 1) & (cap - 1);
+        table[idx] = s;
+    }
+
+    free(sdsInternTable);
+    sdsInternTable = table;
+    sdsInternCap = cap;
+    return 0;
+}
+
+/**
+ * 从 intern 表中取出内容为 init 的共享字符串，并增加引用计数
+ * 表中不存在时创建一个新的共享字符串并放入表中，表自身持有一个引用
+ */
+sds sdsintern(const void *init, size_t initlen) {
+
+    size_t idx;
+    sds s;
+
+    if (initlen > SDS_INTERN_MAX_LEN) return sdsnewlen(init, initlen);
+
+    // 负载因子保持在 1/2 以下
+    if ((sdsInternUsed + 1) * 2 > sdsInternCap) {
+        if (sdsInternResize(sdsInternCap ? sdsInternCap * 2 : 64) == -1) return NULL;
+    }
+
+    idx = sdsInternHash(init, initlen) & (sdsInternCap - 1);
+    while ((s = sdsInternTable[idx]) != NULL) {
+        if (sdslen(s) == initlen && memcmp(s, init, initlen) == 0) return sdsdup(s);
+        idx = (idx + 1) & (sdsInternCap - 1);
+    }
+
+    s = sdsnewshared(init, initlen);
+    if (s == NULL) return NULL;
+
+    sdsInternTable[idx] = s;
+    sdsInternUsed++;
+    return sdsdup(s);
+}
+
+// 返回 intern 表中字符串的数量
+size_t sdsinternSize(void) {
+
+    return sdsInternUsed;
+}
+
+// 释放 intern 表持有的所有引用，仍被其他地方引用的字符串不受影响
+void sdsinternClear(void) {
+
+    size_t j;
+
+    for (j = 0; j < sdsInternCap; j++) sdsfree(sdsInternTable[j]);
+
+    free(sdsInternTable);
+    sdsInternTable = NULL;
+    sdsInternCap = 0;
+    sdsInternUsed = 0;
+}
+
+// sdsReadFd 每次至少预留的空间
+#define SDS_READ_CHUNK (16 * 1024)
+
+/**
+ * 从 fd 读取数据追加到 s 的末尾
+ * 每次调用 read 都直接使用 s 的未使用空间，sdsMakeRoomFor 的预分配策略保证扩容次数是对数级的
+ */
+sds sdsReadFd(sds s, int fd, size_t max, ssize_t *nread) {
+
+    size_t total = 0, want;
+    ssize_t n;
+
+    *nread = 0;
+    while (max == 0 || total < max) {
+        want = SDS_READ_CHUNK;
+        if (max && max - total < want) want = max - total;
+
+        s = sdsMakeRoomFor(s, want);
+        if (s == NULL) return NULL;
+
+        // 已经有更多空间时，一次把它读满
+        want = sdsavail(s);
+        if (max && max - total < want) want = max - total;
+
+        n = read(fd, s + sdslen(s), want);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (total == 0) *nread = -1;
+            break;
+        }
+        if (n == 0) break;
+
+        sdsIncrLen(s, n);
+        total += n;
+        *nread = total;
+    }
+    return s;
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/**
+ * 使用 writev 把 count 个 sds 依次写入 fd
+ * 每次最多提交 IOV_MAX 个 iovec，部分写入时跳过已经写完的部分继续写
+ */
+ssize_t sdsWritevFd(int fd, sds *array, int count) {
+
+    struct iovec iov[IOV_MAX < 64 ? IOV_MAX : 64];
+    int maxiov = sizeof(iov) / sizeof(iov[0]);
+    int idx = 0, iovcnt, j;
+    size_t offset = 0, total = 0;
+    ssize_t n;
+
+    while (idx < count) {
+        // 从 array[idx] 的 offset 处开始填充 iovec
+        iovcnt = 0;
+        for (j = idx; j < count && iovcnt < maxiov; j++) {
+            size_t skip = (j == idx) ? offset : 0;
+            if (sdslen(array[j]) == skip) continue;
+
+            iov[iovcnt].iov_base = array[j] + skip;
+            iov[iovcnt].iov_len = sdslen(array[j]) - skip;
+            iovcnt++;
+        }
+
+        if (iovcnt == 0) break;
+
+        n = writev(fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return total ? (ssize_t)total : -1;
+        }
+        total += n;
+
+        // 跳过已经写完的 sds
+        while (idx < count && n > 0) {
+            size_t left = sdslen(array[idx]) - offset;
+            if ((size_t)n < left) {
+                offset += n;
+                n = 0;
+            } else {
+                n -= left;
+                offset = 0;
+                idx++;
+            }
+        }
+        while (idx < count && sdslen(array[idx]) == offset) {
+            offset = 0;
+            idx++;
+        }
+    }
+    return total;
+}
+
+/**
+ * 把 infd 的 count 个字节写入 outfd
+ * sendfile 每次可能只复制一部分，所以循环直到复制完成或者 infd 结束
+ */
+ssize_t sdsSendFile(int outfd, int infd, off_t *offset, size_t count) {
+
+    size_t total = 0;
+    ssize_t n;
+
+#if defined(__linux__)
+    while (total < count) {
+        n = sendfile(outfd, infd, offset, count - total);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return total ? (ssize_t)total : -1;
+        }
+        if (n == 0) break;
+        total += n;
+    }
+#else
+    char buf[SDS_READ_CHUNK];
+    ssize_t w, written;
+
+    while (total < count) {
+        size_t want = count - total < sizeof(buf) ? count - total : sizeof(buf);
+        n = offset ? pread(infd, buf, want, *offset) : read(infd, buf, want);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return total ? (ssize_t)total : -1;
+        }
+        if (n == 0) break;
+
+        for (written = 0; written < n; written += w) {
+            w = write(outfd, buf + written, n - written);
+            if (w == -1) {
+                if (errno == EINTR) {
+                    w = 0;
+                    continue;
+                }
+                return total ? (ssize_t)total : -1;
+            }
+        }
+        if (offset) *offset += n;
+        total += n;
+    }
+#endif
+    return total;
+}
@@ -2,7 +2,7 @@
 #define __SDS_2_H
 
 #define SDS_MAX_PREALLOC (1024 * 1024)
-const char *SDS_NOINIT;
+extern const char *SDS_NOINIT;
 
 #include <sys/types.h>
 #include <stdarg.h>
@@ -74,6 +74,20 @@ struct __attribute__((__packed__)) sdshdr64 {
 #define SDS_TYPE_MASK 7
 #define SDS_TYPE_BITS 3
 
+/**
+ * 共享字符串标记，占用 flags 中 SDS_TYPE_BITS 之上的第一个bit
+ * SDS_TYPE_5 的高5位用来保存长度，所以共享字符串至少使用 SDS_TYPE_8 类型的header
+ * 共享字符串在header之前额外保存一个引用计数(struct sdsrefcount)
+ */
+#define SDS_SHARED (1 << SDS_TYPE_BITS)
+
+// 小于等于这个长度的字符串才会进入 intern 表
+#define SDS_INTERN_MAX_LEN 64
+
+struct __attribute__((__packed__)) sdsrefcount {
+    uint32_t refcount;
+};
+
 #define SDS_HDR_VAR(T, s) struct sdshdr##T *sh = (void*)(s - (sizeof(struct sdshdr##T)));
 
 // SDS_HDR用来从sds字符串获取header起始位置指针，例如 SDS_HDR(8, s1)， SDS_HDR(16, 32)
@@ -81,6 +95,13 @@ struct __attribute__((__packed__)) sdshdr64 {
 
 #define SDS_TYPE_5_LEN(f) ((f) >> SDS_TYPE_BITS)
 
+// 判断是否是共享字符串
+static inline int sdsisshared(const sds s) {
+
+    unsigned char flags = s[-1];
+    return (flags & SDS_TYPE_MASK) != SDS_TYPE_5 && (flags & SDS_SHARED);
+}
+
 // 返回SDS的已使用空间字节数
 static inline size_t sdslen(const sds s) {
 
@@ -240,9 +261,37 @@ sds sdsnew(const char *init);
 // 创建一个不包含任何内容的的空SDS
 sds sdsempty(void);
 
-// 创建一个给定SDS的副本(copy)
+// 创建一个给定SDS的副本(copy)，共享字符串只增加引用计数
 sds sdsdup(const sds s);
 
+/**
+ * 创建一个引用计数为1的共享字符串
+ * 共享字符串是只读的：sdsdup 只增加引用计数，sdsfree 只减少引用计数
+ * sdscatlen、sdscpylen、sdstrim、sdsmapchars 等返回新 sds 的修改函数会先复制出一个私有副本(copy-on-write)
+ * sdsrange、sdsclear、sdsupdatelen、sdstolower、sdstoupper、sdsIncrLen 这些原地修改的函数遇到共享字符串时断言失败，需要先调用 sdsunshare
+ * sdssetlen 等底层函数不做检查
+ */
+sds sdsnewshared(const void *init, size_t initlen);
+
+// 返回共享字符串的引用计数，普通字符串返回1
+uint32_t sdsrefcount(const sds s);
+
+// 如果 s 是共享字符串，返回一个内容相同的私有副本，并释放对 s 的引用
+sds sdsunshare(sds s);
+
+/**
+ * 从 intern 表中取出内容为 init 的共享字符串，并增加引用计数
+ * 表中不存在时创建一个新的共享字符串并放入表中，表自身持有一个引用
+ * 长度超过 SDS_INTERN_MAX_LEN 时不进入 intern 表，直接返回普通字符串
+ */
+sds sdsintern(const void *init, size_t initlen);
+
+// 返回 intern 表中字符串的数量
+size_t sdsinternSize(void);
+
+// 释放 intern 表持有的所有引用
+void sdsinternClear(void);
+
 // 释放指定的SDS
 void sdsfree(sds s);
 
@@ -304,12 +353,35 @@ void sdstolower(sds s);
 // 将给定 sds 中的字符全部转为大写
 void sdstoupper(sds s);
 
+// 将 long long 转换成字符串，返回字符串长度
+int sdsll2str(char *s, long long value);
+
+// 将 unsigned long long 转换成字符串，返回字符串长度
+int sdsull2str(char *s, unsigned long long value);
+
 sds sdsfromlonglong(long long value);
 
+/**
+ * 把 p 的前 len 个字节转义成带双引号的可打印字符串，追加到 s 的末尾
+ * 可打印字符原样输出，\\ 和 " 前加反斜杠，\n \r \t \a \b 输出对应的转义，其他字节输出为 \xHH
+ */
 sds sdscatrepr(sds s, const char *p, size_t len);
 
+/**
+ * sdscatrepr 的逆操作：p 指向一个以 " 或 ' 开头的带引号字符串，解码后追加到 s 的末尾
+ *  1. 双引号字符串支持 \xHH、\n、\r、\t、\a、\b，其他 \c 解码为 c
+ *  2. 单引号字符串只支持 \'
+ * consumed 返回消耗的字节数(包括两个引号)。引号不匹配时 consumed 为0，s 的内容保持不变
+ */
+sds sdscatunrepr(sds s, const char *p, size_t len, size_t *consumed);
+
+/**
+ * 按照空白字符把一行命令切分成参数，参数可以使用 sdscatunrepr 支持的引号格式
+ * 返回参数数组，argc 为参数个数，引号不匹配时返回 NULL
+ */
 sds *sdssplitargs(const char *line, int *argc);
 
+// 把 s 中出现在 from 里的字符替换为 to 中相同位置的字符，返回修改后的 sds
 sds sdsmapchars(sds s, const char *from, const char *to, size_t setlen);
 
 sds sdsjoin(char **argv, int argc, char *sep);
@@ -332,8 +404,53 @@ sds sdsRemoveFreeSpace(sds s);
 // 计算给定 sds buf 的内存长度（包括已使用和未使用的）
 size_t sdsAllocSize(sds s);
 
+/**
+ * sdsCompact 的策略，可以组合使用
+ *  SDS_COMPACT_SLACK：释放未使用的空间，让 alloc 等于 len
+ *  SDS_COMPACT_HEADER：把header换成能容纳 alloc 的最小类型
+ *  SDS_COMPACT_TYPE5：没有未使用空间且长度小于32时，允许降级为 SDS_TYPE_5
+ *      SDS_TYPE_5 没有 alloc 字段，之后任何追加都会重新分配并升级为 SDS_TYPE_8，适合不再修改的字符串
+ */
+#define SDS_COMPACT_SLACK 1
+#define SDS_COMPACT_HEADER 2
+#define SDS_COMPACT_TYPE5 4
+#define SDS_COMPACT_ALL (SDS_COMPACT_SLACK | SDS_COMPACT_HEADER | SDS_COMPACT_TYPE5)
+
+/**
+ * 按照 policy 压缩 s 占用的内存，返回压缩后的 sds
+ * 如果 reclaimed 不为 NULL，把回收的字节数写入 reclaimed
+ * 共享字符串不会被压缩
+ */
+sds sdsCompact(sds s, int policy, size_t *reclaimed);
+
+/**
+ * 依次压缩数组中的 n 个 sds，数组中的指针会被替换为压缩后的 sds，返回回收的总字节数
+ * 每次只处理数组的一段，就可以把压缩工作分摊到多次调用中(比如在定时任务中)
+ */
+size_t sdsCompactMany(sds *array, size_t n, int policy);
+
 void *sdsAllocPtr(sds s);
 
+/**
+ * 从 fd 读取最多 max 个字节追加到 s 的末尾，max 为0时一直读到 EOF
+ * 数据直接读进 sdsMakeRoomFor 预留的空间，不经过中间缓冲区
+ * 遇到 EOF、EAGAIN 或者读够 max 字节时返回。nread 返回读到的字节数，出错且没有读到数据时为 -1(errno 保存错误)
+ */
+sds sdsReadFd(sds s, int fd, size_t max, ssize_t *nread);
+
+/**
+ * 使用 writev 把 count 个 sds 依次写入 fd，不经过中间缓冲区
+ * 返回写入的总字节数，非阻塞 fd 遇到 EAGAIN 时可能少于总长度，出错且没有写入数据时返回 -1
+ */
+ssize_t sdsWritevFd(int fd, sds *array, int count);
+
+/**
+ * 把 infd 从 offset 开始的 count 个字节写入 outfd，offset 为 NULL 时从 infd 的当前位置读取
+ * Linux 上使用 sendfile 在内核中完成复制，其他平台退化为 read/write
+ * 返回写入的字节数，出错时返回 -1
+ */
+ssize_t sdsSendFile(int outfd, int infd, off_t *offset, size_t count);
+
 /* Export the allocator used by SDS to the program using SDS.
  * Sometimes the program SDS is linked to, may use a different set of
  * allocators, but may want to allocate or free things that SDS will
@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <ctype.h>
+#include <sys/time.h>
+#include <unistd.h>
 #include "demo_sds_2.h"
 
 int __failed_tests = 0;
@@ -20,6 +23,39 @@ int __test_num = 0;
     } \
 } while(0);
 
+// 逐字节转义的 sdscatrepr，用来对比结果和速度
+static sds sdscatreprBytewise(sds s, const char *p, size_t len) {
+
+    s = sdscatlen(s, "\"", 1);
+    while (len--) {
+        switch (*p) {
+            case '\\':
+            case '"':
+                s = sdscatprintf(s, "\\%c", *p);
+                break;
+            case '\n': s = sdscatlen(s, "\\n", 2); break;
+            case '\r': s = sdscatlen(s, "\\r", 2); break;
+            case '\t': s = sdscatlen(s, "\\t", 2); break;
+            case '\a': s = sdscatlen(s, "\\a", 2); break;
+            case '\b': s = sdscatlen(s, "\\b", 2); break;
+            default:
+                if (isprint(*p)) {
+                    s = sdscatprintf(s, "%c", *p);
+                } else {
+                    s = sdscatprintf(s, "\\x%02x", (unsigned char)*p);
+                }
+                break;
+        }
+        p++;
+    }
+    return sdscatlen(s, "\"", 1);
+}
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((long long)tv.tv_sec) * 1000000) + tv.tv_usec;
+}
 
 int main () {
 
@@ -74,7 +110,7 @@ int main () {
         sdsfree(y);
         sdsfree(x);
 
-        x = sdsnew("foa");
+        x = sdsnew("foo");
         y = sdsnew("foa");
         test_cond("sdscmp(foo, foa)", sdscmp(x, y) > 0);
         sdsfree(y);
@@ -92,7 +128,7 @@ int main () {
 
         x = sdsnewlen("\a\n\0foo\r", 7);
         x = sdscatrepr(sdsempty(), x, sdslen(x));
-        test_cond("sdscatrepr(...data...)", memcmp(y, "\"\\a\\n\\x00foo\\r\"", 15) == 0);
+        test_cond("sdscatrepr(...data...)", memcmp(x, "\"\\a\\n\\x00foo\\r\"", 15) == 0);
 
         {
             unsigned int oldfree;
@@ -126,6 +162,283 @@ int main () {
 
             sdsfree(x);
         }
+
+    }
+
+    {
+        sds a, b, c;
+
+        a = sdsnewshared("shared value", 12);
+        test_cond("sdsnewshared() 创建共享字符串", sdsisshared(a) && sdslen(a) == 12 && sdsrefcount(a) == 1 && memcmp(a, "shared value\0", 13) == 0);
+
+        b = sdsdup(a);
+        test_cond("sdsdup() 共享字符串只增加引用计数", b == a && sdsrefcount(a) == 2);
+
+        b = sdscatlen(b, "!", 1);
+        test_cond("sdscatlen() 写时复制", b != a && !sdsisshared(b) && sdsrefcount(a) == 1 && memcmp(b, "shared value!\0", 14) == 0 && memcmp(a, "shared value\0", 13) == 0);
+        sdsfree(b);
+
+        b = sdsdup(a);
+        b = sdscpy(b, "other");
+        test_cond("sdscpy() 写时复制", !sdsisshared(b) && sdsrefcount(a) == 1 && memcmp(b, "other\0", 6) == 0);
+        sdsfree(b);
+
+        b = sdsdup(a);
+        b = sdstrim(b, "se");
+        test_cond("sdstrim() 写时复制", sdslen(b) == 10 && memcmp(b, "hared valu\0", 11) == 0 && sdslen(a) == 12);
+        sdsfree(b);
+
+        b = sdsdup(a);
+        b = sdsmapchars(b, "ae", "AE", 2);
+        test_cond("sdsmapchars() 写时复制", !sdsisshared(b) && memcmp(b, "shArEd vAluE\0", 13) == 0 && memcmp(a, "shared value\0", 13) == 0);
+        sdstolower(b);
+        test_cond("sdstolower()", memcmp(b, "shared value\0", 13) == 0);
+        sdstoupper(b);
+        test_cond("sdstoupper()", memcmp(b, "SHARED VALUE\0", 13) == 0);
+        b[6] = '\0';
+        sdsupdatelen(b);
+        test_cond("sdsupdatelen()", sdslen(b) == 6);
+        sdsclear(b);
+        test_cond("sdsclear()", sdslen(b) == 0 && b[0] == '\0');
+        sdsfree(b);
+        sdsfree(a);
+
+        a = sdsintern("hot", 3);
+        b = sdsintern("hot", 3);
+        c = sdsintern("cold", 4);
+        test_cond("sdsintern() 相同内容返回同一个字符串", a == b && a != c && sdsrefcount(a) == 3 && sdsinternSize() == 2);
+
+        sdsinternClear();
+        test_cond("sdsinternClear() 不影响仍被引用的字符串", sdsrefcount(a) == 2 && memcmp(a, "hot\0", 4) == 0 && sdsinternSize() == 0);
+        sdsfree(a);
+        sdsfree(b);
+        sdsfree(c);
+    }
+
+    {
+        // 100000 个值，只有 100 种不同的取值
+        int count = 100000, distinct = 100, j;
+        sds *priv = malloc(sizeof(sds) * count), *shared = malloc(sizeof(sds) * count);
+        size_t privbytes = 0, sharedbytes = 0;
+        char buf[64];
+
+        for (j = 0; j < count; j++) {
+            int l = snprintf(buf, sizeof(buf), "status:value-%03d", j % distinct);
+            priv[j] = sdsnewlen(buf, l);
+            shared[j] = sdsintern(buf, l);
+            privbytes += sdsAllocSize(priv[j]);
+        }
+        for (j = 0; j < distinct; j++) sharedbytes += sdsAllocSize(shared[j]);
+        printf("%d values, %d distinct: sdsdup %zu bytes, sdsintern %zu bytes\n", count, distinct, privbytes, sharedbytes);
+        test_cond("sdsintern() 节省内存", sharedbytes * 100 < privbytes && sdsinternSize() == (size_t)distinct);
+
+        for (j = 0; j < count; j++) {
+            sdsfree(priv[j]);
+            sdsfree(shared[j]);
+        }
+        sdsinternClear();
+        free(priv);
+        free(shared);
+    }
+
+    {
+        sds x;
+        size_t reclaimed;
+
+        x = sdscatlen(sdsempty(), "0123456789012345678901234567890123456789", 40);
+        sdsrange(x, 0, 9);
+        x = sdsCompact(x, SDS_COMPACT_SLACK, &reclaimed);
+        test_cond("sdsCompact() 释放未使用空间", sdsavail(x) == 0 && (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_8 && reclaimed == 70);
+
+        x = sdsCompact(x, SDS_COMPACT_ALL, &reclaimed);
+        test_cond("sdsCompact() 降级为 SDS_TYPE_5", (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_5 && sdslen(x) == 10 && reclaimed == 2 && memcmp(x, "0123456789\0", 11) == 0);
+
+        x = sdscat(x, "abc");
+        test_cond("SDS_TYPE_5 追加后升级", (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_8 && sdslen(x) == 13 && memcmp(x, "0123456789abc\0", 14) == 0);
+        sdsfree(x);
+
+        x = sdsnewlen(NULL, 300);
+        sdsrange(x, 0, 99);
+        x = sdsCompact(x, SDS_COMPACT_HEADER | SDS_COMPACT_SLACK, &reclaimed);
+        test_cond("sdsCompact() 缩小header", (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_8 && sdsalloc(x) == 100 && reclaimed == 202);
+        sdsfree(x);
+    }
+
+    {
+        // 1000000 个先构造为 200 字节、再截断为 10 字节的字符串
+        size_t count = 1000000, j, before = 0, reclaimed;
+        sds *array = malloc(sizeof(sds) * count);
+        char buf[200];
+        long long start;
+
+        memset(buf, 'a', sizeof(buf));
+        for (j = 0; j < count; j++) {
+            array[j] = sdscatlen(sdsempty(), buf, sizeof(buf));
+            sdsrange(array[j], 0, 9);
+            before += sdsAllocSize(array[j]);
+        }
+
+        start = usec();
+        reclaimed = sdsCompactMany(array, count, SDS_COMPACT_ALL);
+        printf("sdsCompactMany: %zu strings, %zu of %zu bytes reclaimed in %lld usec\n", count, reclaimed, before, usec() - start);
+        test_cond("sdsCompactMany() 回收内存", reclaimed == before - count * sdsAllocSize(array[0]));
+
+        for (j = 0; j < count; j++) sdsfree(array[j]);
+        free(array);
+    }
+
+    {
+        sds x, y, *argv;
+        size_t consumed;
+        int argc, j, k, ok;
+        char buf[256];
+
+        x = sdscatunrepr(sdsnew(">"), "\"a\\x41\\n\\\"b\" tail", 16, &consumed);
+        test_cond("sdscatunrepr() 双引号字符串", consumed == 12 && sdslen(x) == 6 && memcmp(x, ">aA\n\"b\0", 7) == 0);
+        sdsfree(x);
+
+        x = sdscatunrepr(sdsempty(), "'it\\'s\\n'", 9, &consumed);
+        test_cond("sdscatunrepr() 单引号字符串", consumed == 9 && sdslen(x) == 6 && memcmp(x, "it's\\n", 6) == 0);
+        sdsfree(x);
+
+        x = sdscatunrepr(sdsnew("keep"), "\"unterminated\\\"", 15, &consumed);
+        test_cond("sdscatunrepr() 引号不匹配", consumed == 0 && sdslen(x) == 4 && memcmp(x, "keep\0", 5) == 0);
+        sdsfree(x);
+
+        argv = sdssplitargs("set \"key \\x00\" 'va lue'  plain ", &argc);
+        test_cond("sdssplitargs() 切分参数", argv && argc == 4 && sdslen(argv[1]) == 5 && memcmp(argv[1], "key \0", 5) == 0 && strcmp(argv[2], "va lue") == 0 && strcmp(argv[3], "plain") == 0);
+        sdsfreesplitres(argv, argc);
+
+        argv = sdssplitargs("set \"key\"x", &argc);
+        test_cond("sdssplitargs() 引号后必须是空白字符", argv == NULL && argc == 0);
+
+        // 随机二进制数据经过转义和解码后保持不变，转义结果与逐字节实现一致
+        srand(1234);
+        ok = 1;
+        for (j = 0; j < 2000 && ok; j++) {
+            int len = rand() % sizeof(buf);
+            for (k = 0; k < len; k++) buf[k] = (j & 1) ? rand() : (' ' + rand() % 96);
+
+            x = sdscatrepr(sdsempty(), buf, len);
+            y = sdscatreprBytewise(sdsempty(), buf, len);
+            if (sdscmp(x, y) != 0) ok = 0;
+            sdsfree(y);
+
+            y = sdscatunrepr(sdsempty(), x, sdslen(x), &consumed);
+            if (consumed != sdslen(x) || sdslen(y) != (size_t)len || memcmp(y, buf, len) != 0) ok = 0;
+            sdsfree(y);
+
+            x = sdscat(x, " next");
+            argv = sdssplitargs(x, &argc);
+            if (argv == NULL || argc != 2 || sdslen(argv[0]) != (size_t)len || memcmp(argv[0], buf, len) != 0) ok = 0;
+            sdsfreesplitres(argv, argc);
+            sdsfree(x);
+        }
+        test_cond("sdscatrepr()/sdscatunrepr() 随机数据往返", ok);
+    }
+
+    {
+        size_t len = 16 * 1024 * 1024, j;
+        char *data = malloc(len);
+        long long start, t;
+        size_t consumed;
+        sds x, y;
+
+        // 大部分是可打印字符，夹杂少量二进制字节
+        for (j = 0; j < len; j++) data[j] = (j % 61 == 0) ? (char)(j & 0xff) : (char)('a' + j % 26);
+
+        start = usec();
+        x = sdscatreprBytewise(sdsempty(), data, len);
+        t = usec() - start;
+        printf("sdscatrepr bytewise: %.1f MB/s\n", (double)len / t);
+        sdsfree(x);
+
+        start = usec();
+        x = sdscatrepr(sdsempty(), data, len);
+        t = usec() - start;
+        printf("sdscatrepr: %.1f MB/s\n", (double)len / t);
+
+        start = usec();
+        y = sdscatunrepr(sdsempty(), x, sdslen(x), &consumed);
+        t = usec() - start;
+        printf("sdscatunrepr: %.1f MB/s\n", (double)len / t);
+        test_cond("sdscatunrepr() 解码大字符串", sdslen(y) == len && memcmp(y, data, len) == 0);
+
+        sdsfree(x);
+        sdsfree(y);
+        free(data);
+    }
+
+    {
+        char path1[] = "/tmp/redis5-sds-XXXXXX", path2[] = "/tmp/redis5-sds-XXXXXX";
+        int fd1 = mkstemp(path1), fd2 = mkstemp(path2);
+        sds parts[4], x;
+        ssize_t n;
+        off_t offset = 0;
+
+        parts[0] = sdsnew("hello ");
+        parts[1] = sdsempty();
+        parts[2] = sdsnew("world");
+        parts[3] = sdsnew("!");
+        n = sdsWritevFd(fd1, parts, 4);
+        test_cond("sdsWritevFd() 写入多个 sds", n == 12);
+
+        lseek(fd1, 0, SEEK_SET);
+        x = sdsReadFd(sdsnew(">"), fd1, 5, &n);
+        test_cond("sdsReadFd() 读取最多 max 个字节", n == 5 && sdslen(x) == 6 && memcmp(x, ">hello\0", 7) == 0);
+        x = sdsReadFd(x, fd1, 0, &n);
+        test_cond("sdsReadFd() 读取到 EOF", n == 7 && sdslen(x) == 13 && memcmp(x, ">hello world!\0", 14) == 0);
+        sdsfree(x);
+
+        n = sdsSendFile(fd2, fd1, &offset, 100);
+        lseek(fd2, 0, SEEK_SET);
+        x = sdsReadFd(sdsempty(), fd2, 0, &n);
+        test_cond("sdsSendFile() 复制文件", offset == 12 && sdslen(x) == 12 && memcmp(x, "hello world!", 12) == 0);
+        sdsfree(x);
+
+        x = sdsReadFd(sdsempty(), -1, 0, &n);
+        test_cond("sdsReadFd() 读取出错", n == -1 && sdslen(x) == 0);
+        sdsfree(x);
+
+        sdsfree(parts[0]);
+        sdsfree(parts[1]);
+        sdsfree(parts[2]);
+        sdsfree(parts[3]);
+        close(fd1);
+        close(fd2);
+        unlink(path1);
+        unlink(path2);
+    }
+
+    {
+        char path[] = "/tmp/redis5-sds-XXXXXX";
+        int fd = mkstemp(path);
+        size_t len = 64 * 1024 * 1024, j;
+        char *data = malloc(len), buf[4096];
+        long long start;
+        ssize_t n;
+        sds x;
+
+        memset(data, 'x', len);
+        for (j = 0; j < len; j += n) n = write(fd, data + j, len - j);
+
+        lseek(fd, 0, SEEK_SET);
+        start = usec();
+        x = sdsempty();
+        while ((n = read(fd, buf, sizeof(buf))) > 0) x = sdscatlen(x, buf, n);
+        printf("read + sdscatlen: %zu MB in %lld usec\n", len >> 20, usec() - start);
+        sdsfree(x);
+
+        lseek(fd, 0, SEEK_SET);
+        start = usec();
+        x = sdsReadFd(sdsempty(), fd, 0, &n);
+        printf("sdsReadFd: %zu MB in %lld usec\n", len >> 20, usec() - start);
+        test_cond("sdsReadFd() 读取大文件", (size_t)n == len && sdslen(x) == len);
+        sdsfree(x);
+
+        free(data);
+        close(fd);
+        unlink(path);
     }
 
     test_report();
@@ -27,11 +27,82 @@
 #define ZIP_INT_IMM_MIN 0xf1        // 241 = 1111 0001
 #define ZIP_INT_IMM_MAX 0xfd        // 253 = 1111 1101
 
+/**
+ * 12 bit 无符号整数：编码的低4位(减去1)是值的高4位，之后的1个字节是值的低8位
+ * 0xc1 - 0xcf，可以保存 0 至 3839，代替原来需要2个字节的 ZIP_INT_16B
+ * 与共享字典一样属于扩展编码，只有 ziplistSetExtendedEncoding 打开之后插入的节点才会使用
+ */
+#define ZIP_INT_12B_MIN 0xc1        // 193 = 1100 0001
+#define ZIP_INT_12B_MAX 0xcf        // 207 = 1100 1111
+#define ZIP_INT_12B_RANGE ((ZIP_INT_12B_MAX - ZIP_INT_12B_MIN + 1) << 8)   // 3840
+
+/**
+ * 共享字典中的字符串：之后的1个字节是字符串在字典中的编号，再之后的1个字节是字符串的校验字节
+ * 字典由 ziplistDictSet 设置，所有 ziplist 共用；有节点使用之后字典只能追加，原有的编号和字符串不会改变
+ * 字典不属于 ziplist 的内容，校验字节让读取时可以发现在另一个字典下写入的节点(比如其他进程保存的 ziplist)
+ */
+#define ZIP_STR_DICT 0xe1           // 225 = 1110 0001
+#define ZIPLIST_DICT_MAX 256        // 字典最多保存的字符串数量，编号为 0 至 255
+#define ZIPLIST_DICT_MINLEN 3       // 字典节点的数据占2个字节，更短的字符串直接保存不会更长
+
 #define INT24_MAX 0x7fffff          // 8388607 = 0111 1111 1111 1111 1111 1111
 #define INT24_MIN (-INT24_MAX - 1)
 
 #define ZIP_IS_STR(enc) (((enc) & ZIP_STR_MASK) < ZIP_STR_MASK)
 
+/**
+ * 以编码的第一个字节为下标的查找表，查一次表就能得到编码的类型、编码本身占用的字节数和数据的长度
+ * 用于遍历时代替 ZIP_DECODE_LENGTH 中的分支链
+ */
+#define ZIP_ENC_TYPE_BAD 0          // 不合法的编码
+#define ZIP_ENC_TYPE_STR06 1        // 字符串，长度保存在编码的低6位，len 就是字符串的长度
+#define ZIP_ENC_TYPE_STR14 2        // 字符串，长度保存在编码的低14位
+#define ZIP_ENC_TYPE_STR32 3        // 字符串，长度保存在编码之后的4个字节中(大端)
+#define ZIP_ENC_TYPE_INT 4          // 整数，len 是整数占用的字节数
+#define ZIP_ENC_TYPE_END 5          // 列表的结束符
+#define ZIP_ENC_TYPE_DICT 6         // 共享字典中的字符串，len 是编号和校验字节占用的2个字节
+
+typedef struct zipEncodingInfo {
+    uint8_t type;                   // ZIP_ENC_TYPE_*
+    uint8_t lensize;                // 编码本身占用的字节数，只有 STR14/STR32 不为1，不合法的编码为0
+    uint8_t len;                    // 数据的长度，STR14/STR32 需要从编码中读取，这里为0
+    uint8_t encoding;               // 与 ZIP_ENTRY_ENCODING 的结果相同
+} zipEncodingInfo;
+
+extern const zipEncodingInfo zipEncodingTable[256];
+
+/**
+ * 所有 ziplist 共用的字符串字典
+ * 低基数的值(状态、国家代码、HTTP 方法等)在大量小 ziplist 中重复出现，
+ * 保存在字典中之后每个节点只需要1个字节的编号和1个字节的校验
+ */
+typedef struct ziplistDict {
+    unsigned int count;                         // 字符串的数量
+    unsigned int maxlen;                        // 最长的字符串的长度，更长的值不需要查找
+    unsigned char *str[ZIPLIST_DICT_MAX];       // 按编号保存的字符串
+    unsigned int len[ZIPLIST_DICT_MAX];         // 字符串的长度
+    unsigned char check[ZIPLIST_DICT_MAX];      // 字符串哈希值的高8位，与编号一起写入节点
+    uint16_t slots[ZIPLIST_DICT_MAX * 2];       // 插入时查找编号的开放寻址哈希表，保存 编号 + 1，0 表示空槽
+    int extended;                               // 插入时是否使用扩展编码(12 bit 整数和字典)，默认关闭
+    int used;                                   // 已经有节点使用了字典，之后字典只能追加
+} ziplistDict;
+
+extern ziplistDict zipDict;
+
+/**
+ * 取出字典节点的数据 q(编号和校验字节)对应的字符串
+ * 复杂度：O(1)
+ *
+ * 返回值：编号超出当前字典，或者校验字节与编号对应的字符串不一致(节点是在另一个字典下写入的)时返回0
+ */
+static inline __attribute__((always_inline)) int zipDictLookup(const unsigned char *q, unsigned char **s, unsigned int *len) {
+
+    if (q[0] >= zipDict.count || q[1] != zipDict.check[q[0]]) return 0;
+    *s = zipDict.str[q[0]];
+    *len = zipDict.len[q[0]];
+    return 1;
+}
+
 /**
  * 用于取出 zl 各部分值的宏
  * 所有宏复杂度都为O(1)
@@ -104,9 +175,11 @@
  *      |01pppppp|qqqqqqqq| - 2 bytes. 长度 <= 16383 字节(14 位)的字符串值
  *      |10______|qqqqqqqq|rrrrrrrr|ssssssss|tttttttt| - 5 bytes.  长度 >= 16384 字节， <= 4294967295 的字符串值
  *      |11000000| - 1 byte. 以 int16_t (2 字节)类型编码的整数
+ *      |1100xxxx|yyyyyyyy| - 2 bytes. xxxx 为 0001 至 1111，0 至 3839 的 12 位无符号整数，值为 ((xxxx - 1) << 8) | yyyyyyyy
  *      |11010000| - 1 byte. 以 int32_t (4 字节)类型编码的整数
  *      |11110000| - 1 byte. 以 int64_t (8 字节)类型编码的整数
  *      |11110000| - 1 byte.  24 位(3 字节)有符号编码整数
+ *      |11100001|cccccccc|hhhhhhhh| - 3 bytes. 共享字典中编号为 cccccccc 的字符串，hhhhhhhh 是字符串的校验字节
  *      |11111110| - 1 byte.  8 位(1 字节)有符号编码整数
  *      |1111xxxx|
  *             (介于 0000 和 1101 之间)的 4 位整数，可用于表示无符号整数 0 至 12 
@@ -129,6 +202,51 @@ typedef struct zlentry {
     unsigned char *p;               // 内容
 } zlentry;
 
+/**
+ * 批量操作时传入的元素
+ * sval 不为 NULL 时是长度为 slen 的字符串(能转换为整数时仍然保存为整数)，否则是整数 lval
+ */
+typedef struct ziplistEntry {
+    unsigned char *sval;
+    unsigned int slen;
+    long long lval;
+} ziplistEntry;
+
+/**
+ * 大 ziplist 的稀疏偏移索引，由调用者持有，与一个 ziplist 对应
+ *
+ * ziplistIndex 只能从表头或表尾逐个节点解码，访问中间的节点是 O(N)
+ * 索引每隔 ZIPLIST_SIDX_STEP 个节点记录一次节点相对 zl 的偏移量，查找时先跳到最近的采样点，
+ * 之后最多再解码 ZIPLIST_SIDX_STEP - 1 个节点
+ *
+ * 在 offset 处插入或删除节点(包括连锁更新)只会改变 offset 之后节点的位置和序号，
+ * 所以修改之后只丢弃 offset 之后的采样点，它们在下一次查找时按需重建
+ *
+ * zlbytes 和 zllen 记录最后一次同步时 ziplist 的状态，
+ * 不经过 *WithSide 函数修改 ziplist 后，必须调用 ziplistSideIndexInvalidate
+ */
+#define ZIPLIST_SIDX_STEP 32
+
+typedef struct ziplistSideIndex {
+    uint32_t zlbytes;       // 最后一次同步时 ziplist 的总字节数
+    uint16_t zllen;         // 最后一次同步时 ziplist 的节点数量
+    uint32_t count;         // 有效的采样点数量
+    uint32_t cap;           // offsets 数组的容量
+    uint32_t *offsets;      // offsets[k] 是第 k * ZIPLIST_SIDX_STEP 个节点的偏移量，递增
+} ziplistSideIndex;
+
+/**
+ * ziplist 迭代器
+ * ziplistNext + ziplistGet 会把同一个节点的头部解析两次(zipRawEntryLength 和 zipEntry)，
+ * 迭代器每个节点只解析一次头部，结果保存在 e 中，可以和值一起使用
+ */
+typedef struct ziplistIter {
+    unsigned char *zl;
+    unsigned char *next;    // 下一次要解码的节点，NULL 表示迭代结束
+    int direction;          // ZIPLIST_HEAD 从表头向表尾，ZIPLIST_TAIL 从表尾向表头
+    zlentry e;              // 最近一次返回的节点的头部，e.p 指向这个节点
+} ziplistIter;
+
 #define ZIPLIST_ENTRY_ZERO(zle) {                        \
     (zle)->prevrawlensize = (zle)->prevrawlen = 0;       \
     (zle)->lensize = (zle)->len = (zle)->headersize = 0; \
@@ -145,7 +263,49 @@ typedef struct zlentry {
     if ((encoding) < ZIP_STR_MASK) (encoding) &= ZIP_STR_MASK;  \
 } while(0)
 
-static unsigned int zipIntSize(unsigned char encoding);
+/**
+ * 返回encoding 指定的整数编码方式所需的长度
+ * 查表代替 switch，整数宽度混杂时不会因为分支预测失败而停顿
+ * 复杂度：O(1)
+ */
+static inline __attribute__((always_inline)) unsigned int zipIntSize(unsigned char encoding) {
+
+    assert(zipEncodingTable[encoding].type == ZIP_ENC_TYPE_INT);
+    return zipEncodingTable[encoding].len;
+}
+
+/**
+ * 查表解码 ptr 处的节点编码，将编码本身占用的字节数保存到 lensize，数据的长度保存到 len
+ * 整数的长度直接来自查找表，不同宽度的整数之间没有分支
+ * 最常见的短字符串(ZIP_STR_06B)的长度就是编码本身，不经过查表：
+ * 遍历是一条指针追逐的依赖链，查表会在链上多一次内存读取
+ * 只有较少见的 ZIP_STR_14B 和 ZIP_STR_32B(lensize 不为1)需要再从编码中读取长度
+ * 复杂度：O(1)
+ *
+ * 返回值：编码在查找表中的信息
+ */
+static inline __attribute__((always_inline)) const zipEncodingInfo *zipDecodeEncoding(const unsigned char *ptr, unsigned int *lensize, unsigned int *len) {
+
+    const zipEncodingInfo *info = &zipEncodingTable[ptr[0]];
+
+    if (ptr[0] < ZIP_STR_14B) {
+        *lensize = 1;
+        *len = ptr[0];
+        return info;
+    }
+    *lensize = info->lensize;
+    *len = info->len;
+    if (__builtin_expect(info->lensize != 1, 0)) {
+        if (info->type == ZIP_ENC_TYPE_STR14) {
+            *len = ((ptr[0] & 0x3f) << 8) | ptr[1];
+        } else if (info->type == ZIP_ENC_TYPE_STR32) {
+            *len = ((unsigned int)ptr[1] << 24) | (ptr[2] << 16) | (ptr[3] << 8) | ptr[4];
+        } else {
+            assert(NULL);
+        }
+    }
+    return info;
+}
 
 /**
  * 从 ptr 指针中取出节点的编码，保存节点长度所需的长度，以及节点长度
@@ -154,31 +314,11 @@ static unsigned int zipIntSize(unsigned char encoding);
  * 返回值
  *  int 编码节点所需的长度
  */
-#define ZIP_DECODE_LENGTH(ptr, encoding, lensize, len) do {     \
-    /* 取出节点的编码 */                                          \
-    ZIP_ENTRY_ENCODING((ptr), (encoding));                      \
-    if ((encoding) < ZIP_STR_MASK) {                            \
-        /* 节点保存的是字符串，取出编码 */                           \
-        if ((encoding) == ZIP_STR_06B) {                        \
-            (lensize) = 1;                                      \
-            (len) = (ptr)[0] & 0x3f;                            \
-        } else if ((encoding) == ZIP_STR_14B) {                 \
-            (lensize) = 2;                                      \
-            (len) = (((ptr)[0] & 0x3f) << 8) | (ptr)[1];        \
-        } else if ((encoding) == ZIP_STR_32B) {                 \
-            (lensize) = 5;                                      \
-            (len) = ((ptr)[1] << 24) |                          \
-                    ((ptr)[2] << 16) |                          \
-                    ((ptr)[3] << 8)  |                          \
-                    ((ptr)[4]);                                 \
-        } else {                                                \
-            assert(NULL);                                       \
-        }                                                       \
-    } else {                                                    \
-        /* 节点保存的是整数，取出编码 */                            \
-        (lensize) = 1;                                          \
-        (len) = zipIntSize(encoding);                           \
-    }                                                           \
+#define ZIP_DECODE_LENGTH(ptr, enc, lensize, len) do {          \
+    unsigned int _lensize, _len;                                \
+    (enc) = zipDecodeEncoding((ptr), &_lensize, &_len)->encoding; \
+    (lensize) = _lensize;                                       \
+    (len) = _len;                                               \
 } while (0);
 
 int zipStorePrevEntryLengthLarge(unsigned char *p, unsigned int len);
@@ -209,21 +349,54 @@ unsigned int zipStorePrevEntryLength(unsigned char *p, unsigned int len);
  *  unsigned int
  */
 #define ZIP_DECODE_PREVLEN(ptr, prevlensize, prevlen) do {  \
-    /* 取得保存前一个节点的长度所需的字节数 */                    \
-    ZIP_DECODE_PREVLENSIZE(ptr, prevlensize);               \
-    /* 获取长度值 */                                          \
-    if ((prevlensize) == 1) {                               \
+    /* 只判断一次，绝大多数节点的 prevlen 只有1个字节，分支几乎总是预测正确 */ \
+    if ((ptr)[0] < ZIP_BIG_PREVLEN) {                       \
+        (prevlensize) = 1;                                  \
+        (prevlen) = (ptr)[0];                               \
+    } else {                                                \
+        (prevlensize) = 5;                                  \
+        (prevlen) = memload32le((ptr) + 1);                 \
+    }                                                       \
+} while (0);
+
+/**
+ * 从指针 ptr 中只取出前一个节点的长度，用于不需要 prevlensize 的调用者
+ * 
+ * 复杂度：O(1)
+ * 
+ * 返回值:
+ *  unsigned int
+ */
+#define ZIP_DECODE_PREVLENONLY(ptr, prevlen) do {           \
+    if ((ptr)[0] < ZIP_BIG_PREVLEN) {                       \
         (prevlen) = (ptr)[0];                               \
-    } else if ((prevlensize) == 5) {                        \
-        assert(sizeof((prevlen)) == 4);                     \
-        memcpy(&(prevlen), ((char *)(ptr)) + 1, 4);         \
-        memrev32ifbe(&prevlen);                             \
+    } else {                                                \
+        (prevlen) = memload32le((ptr) + 1);                 \
     }                                                       \
 } while (0);
 
 int zipPrevLenByteDiff(unsigned char *p, unsigned int len);
 
-unsigned int zipRawEntryLength(unsigned char *p);
+/**
+ * 返回 p 指向的节点的空间总长度
+ * ziplistNext 等遍历操作的热点，定义为 static inline
+ * 复杂度：O(1)
+ */
+static inline __attribute__((always_inline)) unsigned int zipRawEntryLength(unsigned char *p) {
+
+    unsigned int lensize, len;
+
+    /**
+     * prevlen 的两种长度分别返回，而不是先算出 prevlensize：
+     * 后者会被编译成条件传送，读取编码之前必须等待 p[0] 的比较结果，遍历的依赖链变长
+     */
+    if (p[0] < ZIP_BIG_PREVLEN) {
+        zipDecodeEncoding(p + 1, &lensize, &len);
+        return 1 + lensize + len;
+    }
+    zipDecodeEncoding(p + 5, &lensize, &len);
+    return 5 + lensize + len;
+}
 
 int zipTryEncoding(unsigned char *entry, unsigned int entrylen, long long *v, unsigned char *encoding);
 
@@ -233,6 +406,9 @@ int64_t zipLoadInteger(unsigned char *p, unsigned char encoding);
 
 void zipEntry(unsigned char *p, zlentry *e);
 
+// 与 zipEntry 相同，同时检查节点没有越过 zl 的边界(zl 共 zlbytes 个字节)，节点不合法时返回0
+int zipEntrySafe(unsigned char *zl, size_t zlbytes, unsigned char *p, zlentry *e, int validate_prevlen);
+
 // 创建一个新的压缩列表，O(1)
 unsigned char *ziplistNew(void);
 
@@ -249,9 +425,113 @@ unsigned char *ziplistMerge(unsigned char **first, unsigned char **second);
 // 创建一个包含给定值的新节点，并将这个新节点添加到压缩列表的表头或表尾,平均O(N)，最坏O(N ^ 2)
 unsigned char *ziplistPush(unsigned char *zl, unsigned char *s, unsigned int slen, int where);
 
+// 将 n 个元素按顺序添加到表头或表尾，只重分配一次内存，平均O(N + K)，最坏O(N ^ 2)
+unsigned char *ziplistPushMany(unsigned char *zl, ziplistEntry *entries, unsigned int n, int where);
+
+// 将 n 个元素按顺序插入到 p 之前，只重分配一次内存、只移动一次数据，平均O(N + K)，最坏O(N ^ 2)
+unsigned char *ziplistInsertMany(unsigned char *zl, unsigned char *p, ziplistEntry *entries, unsigned int n);
+
+// 删除给定索引上的多个节点(索引可以不连续、无序)，一次遍历完成，O(N + KlogK)
+unsigned char *ziplistDeleteMany(unsigned char *zl, unsigned int *positions, unsigned int n);
+
 // 返回压缩列表给定索引上的节点, O(N)
 unsigned char *ziplistIndex(unsigned char *zl, int index);
 
+// 创建一个空的稀疏索引，O(1)
+ziplistSideIndex *ziplistSideIndexNew(void);
+
+// 释放稀疏索引
+void ziplistSideIndexFree(ziplistSideIndex *sidx);
+
+// zl 从偏移量 offset 开始被修改后调用，丢弃 offset 之后的采样点，O(logN)
+void ziplistSideIndexInvalidate(ziplistSideIndex *sidx, unsigned char *zl, size_t offset);
+
+// 使用稀疏索引返回给定索引上的节点，索引建立之后 O(ZIPLIST_SIDX_STEP)
+unsigned char *ziplistIndexWithSide(unsigned char *zl, ziplistSideIndex *sidx, int index);
+
+// 与 ziplistInsert 相同，同时维护稀疏索引
+unsigned char *ziplistInsertWithSide(unsigned char *zl, ziplistSideIndex *sidx, unsigned char *p, unsigned char *s, unsigned int slen);
+
+// 与 ziplistDelete 相同，同时维护稀疏索引
+unsigned char *ziplistDeleteWithSide(unsigned char *zl, ziplistSideIndex *sidx, unsigned char **p);
+
+// 与 ziplistDeleteRange 相同，使用稀疏索引定位 index
+unsigned char *ziplistDeleteRangeWithSide(unsigned char *zl, ziplistSideIndex *sidx, int index, unsigned int num);
+
+// 初始化迭代器，direction 为 ZIPLIST_HEAD 时从表头开始向后迭代，ZIPLIST_TAIL 时从表尾开始向前迭代
+void ziplistIterInit(unsigned char *zl, ziplistIter *iter, int direction);
+
+// 初始化从节点 p 开始的迭代器，p 指向结束符时向后迭代为空，向前迭代从表尾开始
+// 只向后迭代时 zl 可以为 NULL
+void ziplistIterInitAt(unsigned char *zl, unsigned char *p, ziplistIter *iter, int direction);
+
+/**
+ * 解码迭代器的下一个节点，头部保存到 iter->e，值保存到 entry
+ * 节点保存字符串时 entry->sval 和 entry->slen 指向字符串，lval 为0；否则 entry->sval 为 NULL，slen 为0，整数保存在 entry->lval
+ * 遇到无法在当前字典中解码的字典节点时迭代结束，来源不可信的 ziplist 应当先用 ziplistValidateIntegrity 检查
+ *
+ * 每个节点的头部只解析一次，同时得到下一次迭代的位置：
+ * 向后迭代时是节点的末尾，向前迭代时根据 prevlen 后退
+ * 迭代的热点，定义为 static inline，迭代器的状态可以保存在寄存器中
+ *
+ * 复杂度：O(1)
+ *
+ * 返回值：迭代结束时返回0，否则返回1
+ */
+static inline __attribute__((always_inline)) int ziplistIterNext(ziplistIter *iter, ziplistEntry *entry) {
+
+    unsigned char *p = iter->next, *q;
+    const zipEncodingInfo *info;
+    zlentry *e = &iter->e;
+
+    if (p == NULL) return 0;
+
+    /**
+     * 结束符的检查合并在 prevlen 的判断中，这样编译器只能生成分支而不是条件传送：
+     * 绝大多数节点的 prevlen 只有1个字节，分支预测正确时，解码编码不需要等待 p[0] 的比较结果
+     */
+    if (p[0] < ZIP_BIG_PREVLEN) {
+        e->prevrawlensize = 1;
+        e->prevrawlen = p[0];
+    } else if (p[0] == ZIP_END) {
+        iter->next = NULL;
+        return 0;
+    } else {
+        e->prevrawlensize = 5;
+        e->prevrawlen = memload32le(p + 1);
+    }
+
+    info = zipDecodeEncoding(p + e->prevrawlensize, &e->lensize, &e->len);
+    e->encoding = info->encoding;
+    e->headersize = e->prevrawlensize + e->lensize;
+    e->p = p;
+
+    q = p + e->headersize;
+    if (info->type == ZIP_ENC_TYPE_INT) {
+        entry->sval = NULL;
+        entry->slen = 0;
+        entry->lval = zipLoadInteger(q, info->encoding);
+    } else if (__builtin_expect(info->type == ZIP_ENC_TYPE_DICT, 0)) {
+        if (!zipDictLookup(q, &entry->sval, &entry->slen)) {
+            iter->next = NULL;
+            return 0;
+        }
+        entry->lval = 0;
+    } else {
+        entry->sval = q;
+        entry->slen = e->len;
+        entry->lval = 0;
+    }
+
+    if (iter->direction == ZIPLIST_HEAD) {
+        iter->next = q + e->len;
+    } else {
+        // 第一个节点的 prevlen 为0
+        iter->next = e->prevrawlen ? p - e->prevrawlen : NULL;
+    }
+    return 1;
+}
+
 // 返回给定节点的下一个节点，O(1)
 unsigned char *ziplistNext(unsigned char *zl, unsigned char *p);
 
@@ -283,6 +563,26 @@ unsigned int ziplistLen(unsigned char *zl);
 // 返回压缩列表目前占用的内存字节数，O(1)
 size_t ziplistBlobLen(unsigned char *zl);
 
+// 检查收到的 size 个字节是否是合法的 ziplist，deep 为0时只检查 header O(1)，否则遍历所有节点 O(N)
+int ziplistValidateIntegrity(unsigned char *zl, size_t size, int deep);
+
+/**
+ * 打开或关闭扩展编码(12 bit 整数和共享字典)，默认关闭，插入的节点与原来的格式完全相同
+ * 打开之后插入的节点只有支持扩展编码的代码才能读取；关闭只影响之后的插入，已有的节点仍然可以读取
+ */
+void ziplistSetExtendedEncoding(int enable);
+
+/**
+ * 设置所有 ziplist 共用的字符串字典，最多 ZIPLIST_DICT_MAX 个字符串，字符串会被复制
+ * 打开扩展编码之后插入的、等于字典中某个字符串的值保存为1个字节的编号和1个字节的校验
+ * 有节点使用字典之后，新的字典必须以原来的字典为前缀(只能追加)，原有的编号和 ziplistGet 返回的字符串保持有效
+ * 节点的编号或校验字节与字典不一致时，读取失败，ziplistValidateIntegrity 返回0
+ * 复杂度：O(N)，N 为字符串的总长度
+ *
+ * 返回值：成功返回1，字符串太多、有重复，或者字典已被使用而新字典不是追加时返回0，字典保持不变
+ */
+int ziplistDictSet(unsigned char **strs, unsigned int *lens, unsigned int n);
+
 void ziplistRepr(unsigned char *zl);
 
 #endif
\ No newline at end of file
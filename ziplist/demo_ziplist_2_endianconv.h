@@ -2,9 +2,17 @@
 #define __ENDIANCONV_2_H
 
 #include <stdint.h>
+#include <string.h>
 
+/**
+ * 优先使用编译器预定义的 __BYTE_ORDER__(gcc/clang)，在编译期就能确定字节序，不依赖系统头文件
+ */
 #ifndef BYTE_ORDER
-#if (BSD >= 199103)
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && defined(__ORDER_BIG_ENDIAN__)
+#define LITTLE_ENDIAN __ORDER_LITTLE_ENDIAN__
+#define BIG_ENDIAN __ORDER_BIG_ENDIAN__
+#define BYTE_ORDER __BYTE_ORDER__
+#elif (BSD >= 199103)
 # include <machine/endian.h>
 #else
 #if defined(linux) || defined(__linux__)
@@ -31,14 +39,14 @@
 #define BYTE_ORDER	BIG_ENDIAN
 #endif
 #endif /* linux */
-#endif /* BSD */
+#endif /* __BYTE_ORDER__ */
 #endif /* BYTE_ORDER */
 
 void memrev16(void *p);
 void memrev32(void *p);
 void memrev64(void *p);
 
-uint16_t intrev16(uint64_t v);
+uint16_t intrev16(uint16_t v);
 uint32_t intrev32(uint32_t v);
 uint64_t intrev64(uint64_t v);
 
@@ -54,12 +62,51 @@ uint64_t intrev64(uint64_t v);
 #define memrev16ifbe(p) memrev16(p)
 #define memrev32ifbe(p) memrev32(p)
 #define memrev64ifbe(p) memrev64(p)
-#define intrev16ifbe(v) intrev16(v)
-#define intrev32ifbe(v) intrev32(v)
-#define intrev64ifbe(v) intrev64(v)
+#define intrev16ifbe(v) __builtin_bswap16(v)
+#define intrev32ifbe(v) __builtin_bswap32(v)
+#define intrev64ifbe(v) __builtin_bswap64(v)
 #endif
 
-#if (BYTE_ORDER == BIG_ENDIAD)
+/**
+ * 按小端字节序读写 p 指向的整数，p 不需要对齐
+ * 定长的 memcpy 会被编译成一次普通的读写，字节序在编译期确定：
+ * 小端机器上没有任何额外操作，大端机器上多一条 bswap 指令，不再调用 memrev* 函数
+ * 使用 always_inline，不开优化(-O0)编译时也会内联
+ */
+static inline __attribute__((always_inline)) uint16_t memload16le(const void *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return intrev16ifbe(v);
+}
+
+static inline __attribute__((always_inline)) uint32_t memload32le(const void *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return intrev32ifbe(v);
+}
+
+static inline __attribute__((always_inline)) uint64_t memload64le(const void *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return intrev64ifbe(v);
+}
+
+static inline __attribute__((always_inline)) void memstore16le(void *p, uint16_t v) {
+    v = intrev16ifbe(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline __attribute__((always_inline)) void memstore32le(void *p, uint32_t v) {
+    v = intrev32ifbe(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline __attribute__((always_inline)) void memstore64le(void *p, uint64_t v) {
+    v = intrev64ifbe(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+#if (BYTE_ORDER == BIG_ENDIAN)
 #define htonu64(v) (v)
 #define ntohu64(v) (v)
 #else
@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "demo_ziplist_2_util.h"
+#include "demo_ziplist_2.h"
+#include "demo_ziplist_2_listpack.h"
+
+// 节点的编码，见 demo_ziplist_2_listpack.h 中的说明
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xc0
+#define LP_ENCODING_13BIT_INT 0xc0
+#define LP_ENCODING_13BIT_INT_MASK 0xe0
+#define LP_ENCODING_12BIT_STR 0xe0
+#define LP_ENCODING_12BIT_STR_MASK 0xf0
+#define LP_ENCODING_32BIT_STR 0xf0
+#define LP_ENCODING_16BIT_INT 0xf1
+#define LP_ENCODING_24BIT_INT 0xf2
+#define LP_ENCODING_32BIT_INT 0xf3
+#define LP_ENCODING_64BIT_INT 0xf4
+
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+
+// 取出/设置 listpack 占用的字节数
+#define LP_TOTAL_BYTES(lp) memload32le(lp)
+#define LP_SET_TOTAL_BYTES(lp, v) memstore32le((lp), (uint32_t)(v))
+
+// 取出/设置节点数量
+#define LP_NUM_ELEMENTS(lp) memload16le((lp) + sizeof(uint32_t))
+#define LP_SET_NUM_ELEMENTS(lp, v) memstore16le((lp) + sizeof(uint32_t), (uint16_t)(v))
+
+/**
+ * 节点数量增加 incr(可以为负数)
+ * 和 ZIPLIST_INCR_LENGTH 一样，数量等于 UINT16_MAX 表示未知，之后不再维护
+ */
+#define LP_INCR_NUM_ELEMENTS(lp, incr) {                                \
+    if (LP_NUM_ELEMENTS(lp) < UINT16_MAX) {                             \
+        long long _n = (long long)LP_NUM_ELEMENTS(lp) + (incr);         \
+        LP_SET_NUM_ELEMENTS(lp, _n < UINT16_MAX ? _n : UINT16_MAX);     \
+    }                                                                   \
+}
+
+/**
+ * 将整数 v 编码到 buf 中，返回编码后的长度
+ * 总是选择能容纳 v 的最短编码
+ */
+static uint32_t lpEncodeInteger(long long v, unsigned char *buf) {
+
+    if (v >= 0 && v <= 127) {
+        buf[0] = (unsigned char)v;
+        return 1;
+    } else if (v >= -4096 && v <= 4095) {
+        // 负数以13位补码保存
+        uint32_t uv = v < 0 ? (uint32_t)((1 << 13) + v) : (uint32_t)v;
+        buf[0] = (uv >> 8) | LP_ENCODING_13BIT_INT;
+        buf[1] = uv & 0xff;
+        return 2;
+    } else if (v >= INT16_MIN && v <= INT16_MAX) {
+        buf[0] = LP_ENCODING_16BIT_INT;
+        memstore16le(buf + 1, (uint16_t)v);
+        return 3;
+    } else if (v >= INT24_MIN && v <= INT24_MAX) {
+        buf[0] = LP_ENCODING_24BIT_INT;
+        buf[1] = (unsigned char)v;
+        memstore16le(buf + 2, (uint16_t)(v >> 8));
+        return 4;
+    } else if (v >= INT32_MIN && v <= INT32_MAX) {
+        buf[0] = LP_ENCODING_32BIT_INT;
+        memstore32le(buf + 1, (uint32_t)v);
+        return 5;
+    } else {
+        buf[0] = LP_ENCODING_64BIT_INT;
+        memstore64le(buf + 1, (uint64_t)v);
+        return 9;
+    }
+}
+
+// 将长度为 len 的字符串的编码写入 buf，返回编码的长度
+static uint32_t lpEncodeStringHeader(uint32_t len, unsigned char *buf) {
+
+    if (len <= 63) {
+        buf[0] = LP_ENCODING_6BIT_STR | len;
+        return 1;
+    } else if (len <= 4095) {
+        buf[0] = LP_ENCODING_12BIT_STR | (len >> 8);
+        buf[1] = len & 0xff;
+        return 2;
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        memstore32le(buf + 1, len);
+        return 5;
+    }
+}
+
+/**
+ * 将 <encoding><data> 的长度 l 编码为 backlen 写入 buf，返回 backlen 的长度
+ * buf 为 NULL 时只计算长度
+ * 最左边的字节保存最高的7位，其他字节的最高位设置为1，这样从右向左读取时知道是否还有更多的字节
+ */
+static uint32_t lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+
+    uint32_t n, i;
+
+    if (l <= 127) n = 1;
+    else if (l < 16383) n = 2;
+    else if (l < 2097151) n = 3;
+    else if (l < 268435455) n = 4;
+    else n = 5;
+
+    if (buf) {
+        for (i = n; i > 0; i--) {
+            buf[i - 1] = (l & 127) | (i == 1 ? 0 : 128);
+            l >>= 7;
+        }
+    }
+    return n;
+}
+
+// 从 p(backlen 的最后一个字节) 开始向左读取 backlen
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+
+    uint64_t val = 0, shift = 0;
+
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+    } while (shift <= 28);
+    return val;
+}
+
+// 返回 p 指向的节点的 <encoding><data> 的长度, O(1)
+static uint32_t lpEncodedSize(unsigned char *p) {
+
+    unsigned char enc = p[0];
+
+    if ((enc & LP_ENCODING_7BIT_UINT_MASK) == LP_ENCODING_7BIT_UINT) return 1;
+    if ((enc & LP_ENCODING_6BIT_STR_MASK) == LP_ENCODING_6BIT_STR) return 1 + (enc & 0x3f);
+    if ((enc & LP_ENCODING_13BIT_INT_MASK) == LP_ENCODING_13BIT_INT) return 2;
+    if ((enc & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR) return 2 + (((enc & 0x0f) << 8) | p[1]);
+
+    switch (enc) {
+        case LP_ENCODING_32BIT_STR: return 5 + memload32le(p + 1);
+        case LP_ENCODING_16BIT_INT: return 3;
+        case LP_ENCODING_24BIT_INT: return 4;
+        case LP_ENCODING_32BIT_INT: return 5;
+        case LP_ENCODING_64BIT_INT: return 9;
+    }
+    assert(NULL);
+    return 0;
+}
+
+// 返回 p 之后的下一个节点(或者结束符)
+static unsigned char *lpSkip(unsigned char *p) {
+
+    uint32_t l = lpEncodedSize(p);
+    return p + l + lpEncodeBacklen(NULL, l);
+}
+
+/**
+ * 解码 p 指向的节点
+ * 字符串：*sstr 指向字符串内容，*slen 保存长度
+ * 整数：*sstr 设置为 NULL，*sval 保存整数值
+ */
+static void lpDecode(unsigned char *p, unsigned char **sstr, unsigned int *slen, long long *sval) {
+
+    unsigned char enc = p[0];
+
+    *sstr = NULL;
+    if ((enc & LP_ENCODING_7BIT_UINT_MASK) == LP_ENCODING_7BIT_UINT) {
+        *sval = enc;
+    } else if ((enc & LP_ENCODING_6BIT_STR_MASK) == LP_ENCODING_6BIT_STR) {
+        *slen = enc & 0x3f;
+        *sstr = p + 1;
+    } else if ((enc & LP_ENCODING_13BIT_INT_MASK) == LP_ENCODING_13BIT_INT) {
+        uint32_t uv = ((enc & 0x1f) << 8) | p[1];
+        *sval = uv >= (1 << 12) ? (long long)uv - (1 << 13) : (long long)uv;
+    } else if ((enc & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR) {
+        *slen = ((enc & 0x0f) << 8) | p[1];
+        *sstr = p + 2;
+    } else {
+        switch (enc) {
+            case LP_ENCODING_32BIT_STR:
+                *slen = memload32le(p + 1);
+                *sstr = p + 5;
+                break;
+            case LP_ENCODING_16BIT_INT:
+                *sval = (int16_t)memload16le(p + 1);
+                break;
+            case LP_ENCODING_24BIT_INT:
+                *sval = (int32_t)(((uint32_t)p[1] << 8) | ((uint32_t)memload16le(p + 2) << 16)) >> 8;
+                break;
+            case LP_ENCODING_32BIT_INT:
+                *sval = (int32_t)memload32le(p + 1);
+                break;
+            case LP_ENCODING_64BIT_INT:
+                *sval = (int64_t)memload64le(p + 1);
+                break;
+            default:
+                assert(NULL);
+        }
+    }
+}
+
+// 和 zipTryEncoding 一样，检查字符串能否保存为整数
+static int lpTryEncoding(unsigned char *s, unsigned int slen, long long *v) {
+
+    if (slen >= 32 || slen == 0) return 0;
+    return string2ll((char *)s, slen, v);
+}
+
+/**
+ * 把一个完整的节点 <encoding><data><backlen> 写入 dst，返回节点的长度
+ * dst 为 NULL 时只计算长度
+ * isint 不为0时保存整数 v，否则保存字符串 s
+ */
+static uint32_t lpWriteEntry(unsigned char *dst, unsigned char *s, uint32_t slen, long long v, int isint) {
+
+    unsigned char buf[LP_MAX_INT_ENCODING_LEN];
+    uint32_t hdrlen, enclen;
+
+    hdrlen = isint ? lpEncodeInteger(v, buf) : lpEncodeStringHeader(slen, buf);
+    enclen = isint ? hdrlen : hdrlen + slen;
+
+    if (dst) {
+        memcpy(dst, buf, hdrlen);
+        if (!isint) memcpy(dst + hdrlen, s, slen);
+    }
+    return enclen + lpEncodeBacklen(dst ? dst + enclen : NULL, enclen);
+}
+
+/**
+ * 将节点插入到 p 之前
+ * 节点的 backlen 只描述它自己，所以只需要一次 memmove 腾出空间，不需要改写 p 之后的任何节点
+ */
+static unsigned char *__lpInsert(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, long long v, int isint) {
+
+    size_t offset = p - lp, oldbytes = LP_TOTAL_BYTES(lp);
+    uint32_t entrylen = lpWriteEntry(NULL, s, slen, v, isint);
+
+    lp = (unsigned char *)realloc(lp, oldbytes + entrylen);
+    p = lp + offset;
+
+    memmove(p + entrylen, p, oldbytes - offset);
+    lpWriteEntry(p, s, slen, v, isint);
+
+    LP_SET_TOTAL_BYTES(lp, oldbytes + entrylen);
+    LP_INCR_NUM_ELEMENTS(lp, 1);
+    return lp;
+}
+
+// 从偏移量 offset 处的节点开始删除最多 num 个节点，传入偏移量，调用者在 realloc 之后不需要再使用旧的 lp
+static unsigned char *__lpDelete(unsigned char *lp, size_t offset, unsigned int num) {
+
+    size_t bytes = LP_TOTAL_BYTES(lp);
+    unsigned char *p = lp + offset, *q = p;
+    unsigned int deleted = 0;
+
+    while (q[0] != LP_EOF && deleted < num) {
+        q = lpSkip(q);
+        deleted++;
+    }
+    if (deleted == 0) return lp;
+
+    memmove(p, q, lp + bytes - q);
+    bytes -= q - p;
+
+    LP_SET_TOTAL_BYTES(lp, bytes);
+    LP_INCR_NUM_ELEMENTS(lp, -(long long)deleted);
+    return (unsigned char *)realloc(lp, bytes);
+}
+
+// 创建一个空的 listpack
+unsigned char *lpNew(void) {
+
+    unsigned char *lp = (unsigned char *)malloc(LP_HDR_SIZE + 1);
+
+    LP_SET_TOTAL_BYTES(lp, LP_HDR_SIZE + 1);
+    LP_SET_NUM_ELEMENTS(lp, 0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+unsigned char *lpInsert(unsigned char *lp, unsigned char *p, unsigned char *s, unsigned int slen) {
+
+    long long v;
+
+    if (lpTryEncoding(s, slen, &v)) return __lpInsert(lp, p, NULL, 0, v, 1);
+    return __lpInsert(lp, p, s, slen, 0, 0);
+}
+
+unsigned char *lpPush(unsigned char *lp, unsigned char *s, unsigned int slen, int where) {
+
+    unsigned char *p = (where == LP_HEAD) ? lp + LP_HDR_SIZE : lp + LP_TOTAL_BYTES(lp) - 1;
+    return lpInsert(lp, p, s, slen);
+}
+
+unsigned char *lpFirst(unsigned char *lp) {
+
+    unsigned char *p = lp + LP_HDR_SIZE;
+    return (p[0] == LP_EOF) ? NULL : p;
+}
+
+unsigned char *lpLast(unsigned char *lp) {
+
+    return lpPrev(lp, lp + LP_TOTAL_BYTES(lp) - 1);
+}
+
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+
+    ((void) lp);
+
+    if (p[0] == LP_EOF) return NULL;
+    p = lpSkip(p);
+    return (p[0] == LP_EOF) ? NULL : p;
+}
+
+/**
+ * 前一个节点的 backlen 紧挨着 p，读出它的 <encoding><data> 长度，再加上 backlen 自身的长度，就得到前一个节点的起点
+ */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+
+    uint64_t prevlen;
+
+    if (p == lp + LP_HDR_SIZE) return NULL;
+
+    p--;
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL, prevlen);
+    return p - prevlen + 1;
+}
+
+/**
+ * 节点数量已知时，可以把负数索引换算成正数，并从离目标较近的一端开始遍历
+ */
+unsigned char *lpIndex(unsigned char *lp, int index) {
+
+    unsigned int count = LP_NUM_ELEMENTS(lp);
+    unsigned char *p;
+
+    if (count != UINT16_MAX) {
+        if (index < 0) index += count;
+        if (index < 0 || (unsigned int)index >= count) return NULL;
+        if ((unsigned int)index > count / 2) index = index - count;
+    }
+
+    if (index < 0) {
+        index = (-index) - 1;
+        p = lpLast(lp);
+        while (p && index--) p = lpPrev(lp, p);
+    } else {
+        p = lpFirst(lp);
+        while (p && index--) p = lpNext(lp, p);
+    }
+    return p;
+}
+
+unsigned int lpGet(unsigned char *p, unsigned char **sstr, unsigned int *slen, long long *sval) {
+
+    unsigned char *str;
+    unsigned int len;
+    long long val;
+
+    if (p == NULL || p[0] == LP_EOF) return 0;
+
+    lpDecode(p, &str, &len, &val);
+    if (sstr) *sstr = str;
+    if (str) {
+        if (slen) *slen = len;
+    } else {
+        if (sval) *sval = val;
+    }
+    return 1;
+}
+
+unsigned char *lpDelete(unsigned char *lp, unsigned char **p) {
+
+    size_t offset = *p - lp;
+
+    lp = __lpDelete(lp, offset, 1);
+    *p = lp + offset;
+    return lp;
+}
+
+unsigned char *lpDeleteRange(unsigned char *lp, int index, unsigned int num) {
+
+    unsigned char *p = lpIndex(lp, index);
+    return (p == NULL) ? lp : __lpDelete(lp, p - lp, num);
+}
+
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+
+    unsigned char *str;
+    unsigned int len;
+    long long val, sval;
+
+    if (p[0] == LP_EOF) return 0;
+
+    lpDecode(p, &str, &len, &val);
+    if (str) return len == slen && memcmp(str, s, slen) == 0;
+    return lpTryEncoding(s, slen, &sval) && val == sval;
+}
+
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip) {
+
+    unsigned int skipcnt = 0, len;
+    unsigned char *str;
+    long long val, vll = 0;
+    int vencoded = -1;      // -1 表示还没有尝试把 vstr 转换为整数
+
+    while (p && p[0] != LP_EOF) {
+        if (skipcnt == 0) {
+            lpDecode(p, &str, &len, &val);
+            if (str) {
+                if (len == vlen && memcmp(str, vstr, vlen) == 0) return p;
+            } else {
+                // 只在第一次遇到整数节点时转换 vstr
+                if (vencoded == -1) vencoded = lpTryEncoding(vstr, vlen, &vll);
+                if (vencoded && val == vll) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpSkip(p);
+    }
+
+    ((void) lp);
+    return NULL;
+}
+
+/**
+ * 节点中没有任何指向其他节点的信息，合并就是把较短的一个列表的节点拷贝到较长的列表中
+ */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL) {
+        return NULL;
+    }
+
+    // 不能自己合并自己
+    if (*first == *second) {
+        return NULL;
+    }
+
+    size_t first_bytes = LP_TOTAL_BYTES(*first), second_bytes = LP_TOTAL_BYTES(*second);
+    unsigned int first_len = lpLen(*first), second_len = lpLen(*second);
+    size_t bytes = first_bytes + second_bytes - LP_HDR_SIZE - 1;
+    unsigned long long len = (unsigned long long)first_len + second_len;
+    unsigned char *target;
+
+    if (first_len >= second_len) {
+        // 追加 second 的节点
+        target = (unsigned char *)realloc(*first, bytes);
+        memcpy(target + first_bytes - 1, *second + LP_HDR_SIZE, second_bytes - LP_HDR_SIZE);
+        free(*second);
+        *second = NULL;
+        *first = target;
+    } else {
+        // 把 first 的节点放到 second 的节点之前
+        target = (unsigned char *)realloc(*second, bytes);
+        memmove(target + first_bytes - 1, target + LP_HDR_SIZE, second_bytes - LP_HDR_SIZE);
+        memcpy(target + LP_HDR_SIZE, *first + LP_HDR_SIZE, first_bytes - LP_HDR_SIZE - 1);
+        free(*first);
+        *first = NULL;
+        *second = target;
+    }
+
+    LP_SET_TOTAL_BYTES(target, bytes);
+    LP_SET_NUM_ELEMENTS(target, len < UINT16_MAX ? len : UINT16_MAX);
+    return target;
+}
+
+unsigned int lpLen(unsigned char *lp) {
+
+    unsigned int len = LP_NUM_ELEMENTS(lp);
+    unsigned char *p;
+
+    if (len < UINT16_MAX) return len;
+
+    // 节点数量未知，遍历整个列表
+    len = 0;
+    for (p = lp + LP_HDR_SIZE; p[0] != LP_EOF; p = lpSkip(p)) len++;
+    if (len < UINT16_MAX) LP_SET_NUM_ELEMENTS(lp, len);
+    return len;
+}
+
+size_t lpBlobLen(unsigned char *lp) {
+
+    return LP_TOTAL_BYTES(lp);
+}
+
+/**
+ * 先遍历一次 ziplist 计算需要的空间，一次分配内存之后再依次写入节点
+ * ziplist 中的字符串节点仍然保存为字符串，整数节点保存为整数
+ */
+unsigned char *lpFromZiplist(unsigned char *zl) {
+
+    unsigned char *p, *sval, *lp, *dst;
+    unsigned int slen;
+    long long lval;
+    size_t bytes = LP_HDR_SIZE + 1;
+    unsigned long long count = 0;
+
+    for (p = ziplistIndex(zl, 0); p; p = ziplistNext(zl, p)) {
+        // 无法在当前字典中解码的字典节点
+        if (!ziplistGet(p, &sval, &slen, &lval)) return NULL;
+        bytes += lpWriteEntry(NULL, sval, slen, lval, sval == NULL);
+        count++;
+    }
+
+    lp = (unsigned char *)malloc(bytes);
+    LP_SET_TOTAL_BYTES(lp, bytes);
+    LP_SET_NUM_ELEMENTS(lp, count < UINT16_MAX ? count : UINT16_MAX);
+
+    dst = lp + LP_HDR_SIZE;
+    for (p = ziplistIndex(zl, 0); p; p = ziplistNext(zl, p)) {
+        ziplistGet(p, &sval, &slen, &lval);
+        dst += lpWriteEntry(dst, sval, slen, lval, sval == NULL);
+    }
+    dst[0] = LP_EOF;
+    return lp;
+}
+
+unsigned char *ziplistFromListpack(unsigned char *lp) {
+
+    unsigned char *zl = ziplistNew(), *p, *sval;
+    unsigned int slen;
+    long long lval;
+    char buf[32];
+
+    for (p = lpFirst(lp); p; p = lpNext(lp, p)) {
+        lpGet(p, &sval, &slen, &lval);
+        if (sval) {
+            zl = ziplistPush(zl, sval, slen, ZIPLIST_TAIL);
+        } else {
+            slen = ll2string(buf, sizeof(buf), lval);
+            zl = ziplistPush(zl, (unsigned char *)buf, slen, ZIPLIST_TAIL);
+        }
+    }
+    return zl;
+}
+
+void lpRepr(unsigned char *lp) {
+
+    unsigned char *p, *sval = NULL;
+    unsigned int slen = 0, enclen, index = 0;
+    long long lval = 0;
+
+    printf("{total bytes %u} {num entries %u}\n", LP_TOTAL_BYTES(lp), LP_NUM_ELEMENTS(lp));
+    for (p = lpFirst(lp); p; p = lpNext(lp, p)) {
+        enclen = lpEncodedSize(p);
+        printf(
+            "{\n"
+                "\tindex %2u,\n"
+                "\toffset %5ld,\n"
+                "\tencoding + data len: %5u,\n"
+                "\tbacklen size: %u\n",
+            index,
+            (long)(p - lp),
+            enclen,
+            lpEncodeBacklen(NULL, enclen));
+
+        lpGet(p, &sval, &slen, &lval);
+        if (sval) {
+            printf("\t[str]");
+            if (slen > 40) {
+                if (fwrite(sval, 40, 1, stdout) == 0) perror("fwrite");
+                printf("...");
+            } else {
+                if (slen && fwrite(sval, slen, 1, stdout) == 0) perror("fwrite");
+            }
+        } else {
+            printf("\t[int]%lld", lval);
+        }
+        printf("\n}\n");
+        index++;
+    }
+    printf("{end}\n\n");
+}
@@ -0,0 +1,103 @@
+#ifndef __LISTPACK_2_H
+#define __LISTPACK_2_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * listpack: 不保存 prevlen 的紧凑列表
+ *
+ * ziplist 的每个节点都保存前一个节点的长度(1或5个字节)，前一个节点的长度跨过 254 字节时，
+ * 当前节点的 prevlen 也要变长，进而可能影响下一个节点，这就是 __ziplistCascadeUpdate 的连锁更新，最坏 O(N^2)
+ *
+ * listpack 把节点自身的长度(backlen)保存在节点的末尾，节点的大小只取决于它自己保存的值，
+ * 插入和删除都不会改写相邻的节点，一次插入或删除最多只做一次 memmove
+ *
+ * 内存结构
+ *  <total-bytes><num-elements><entry><entry>...<entry><end>
+ *
+ *  <total-bytes> uint32_t，整个 listpack 占用的字节数
+ *  <num-elements> uint16_t，节点数量，等于 UINT16_MAX 时需要遍历整个列表才能得到长度
+ *  <end> 单字节 255，表示列表的末端
+ *
+ * <entry> 构成
+ *      <encoding><data><backlen>
+ *  <encoding>
+ *      |0xxxxxxx| - 1 byte. 0 至 127 的无符号整数，值直接保存在编码中
+ *      |10xxxxxx| - 1 byte. 长度 <= 63 字节的字符串
+ *      |110xxxxx|yyyyyyyy| - 2 bytes. -4096 至 4095 的 13 位有符号整数
+ *      |1110xxxx|yyyyyyyy| - 2 bytes. 长度 <= 4095 字节的字符串
+ *      |11110000| - 1 byte. 之后的4个字节保存字符串长度
+ *      |11110001| - 1 byte. 以 int16_t 编码的整数
+ *      |11110010| - 1 byte. 以 24 位有符号整数编码的整数
+ *      |11110011| - 1 byte. 以 int32_t 编码的整数
+ *      |11110100| - 1 byte. 以 int64_t 编码的整数
+ *  <backlen>
+ *      <encoding><data> 的长度，每个字节保存7位，从右向左读取
+ *      最左边以外的字节最高位为1，表示左边还有更多的字节。1 至 5 个字节
+ *
+ * 所有整数都以小端表示
+ */
+#define LP_HEAD 0
+#define LP_TAIL 1
+
+#define LP_HDR_SIZE 6               // 32 bit total-bytes + 16 bit num-elements
+#define LP_EOF 0xff
+
+// 创建一个新的 listpack, O(1)
+unsigned char *lpNew(void);
+
+// 创建一个包含给定值的新节点，并将这个新节点添加到表头或表尾, O(N)
+unsigned char *lpPush(unsigned char *lp, unsigned char *s, unsigned int slen, int where);
+
+// 将包含给定值的新节点插入到 p 之前，p 指向结束符时添加到表尾, O(N)。不会改写相邻的节点
+unsigned char *lpInsert(unsigned char *lp, unsigned char *p, unsigned char *s, unsigned int slen);
+
+// 返回给定索引上的节点，负数表示从表尾开始计算，超出范围时返回 NULL, O(N)
+unsigned char *lpIndex(unsigned char *lp, int index);
+
+// 返回第一个节点，列表为空时返回 NULL, O(1)
+unsigned char *lpFirst(unsigned char *lp);
+
+// 返回最后一个节点，列表为空时返回 NULL, O(1)
+unsigned char *lpLast(unsigned char *lp);
+
+// 返回给定节点的下一个节点, O(1)
+unsigned char *lpNext(unsigned char *lp, unsigned char *p);
+
+// 返回给定节点的前一个节点，p 指向结束符时返回最后一个节点, O(1)
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p);
+
+// 获取给定节点所保存的值，字符串保存到 *sstr 和 *slen，整数保存到 *sval(*sstr 设置为 NULL), O(1)
+unsigned int lpGet(unsigned char *p, unsigned char **sstr, unsigned int *slen, long long *sval);
+
+// 删除 *p 指向的节点，之后 *p 指向原来的下一个节点(或者结束符), O(N)
+unsigned char *lpDelete(unsigned char *lp, unsigned char **p);
+
+// 删除给定索引上的连续多个节点, O(N)
+unsigned char *lpDeleteRange(unsigned char *lp, int index, unsigned int num);
+
+// 检查节点的值是否等于给定的值, O(1)
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen);
+
+// 从 p 开始查找包含给定值的节点，每次比较之后跳过 skip 个节点, O(N)
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip);
+
+// 把 second 合并到 first 后面，较短的一个会被释放并设置为 NULL，返回合并后的列表, O(N)
+unsigned char *lpMerge(unsigned char **first, unsigned char **second);
+
+// 返回节点数量, 节点数量小于 65535 时 O(1)
+unsigned int lpLen(unsigned char *lp);
+
+// 返回 listpack 占用的内存字节数, O(1)
+size_t lpBlobLen(unsigned char *lp);
+
+// 根据 ziplist 创建一个保存相同元素的 listpack，有无法在当前字典中解码的节点时返回 NULL, O(N)
+unsigned char *lpFromZiplist(unsigned char *zl);
+
+// 根据 listpack 创建一个保存相同元素的 ziplist, O(N)
+unsigned char *ziplistFromListpack(unsigned char *lp);
+
+void lpRepr(unsigned char *lp);
+
+#endif
@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/time.h>
+#include "demo_ziplist_2_util.h"
 #include "demo_ziplist_2.h"
+#include "demo_ziplist_2_listpack.h"
 
 static unsigned char *createList() {
 
@@ -122,6 +125,250 @@ static void stress(int pos, int num, int maxsize, int dnum) {
 }
 
 
+/**
+ * 生成一个随机的值写入 buf，返回长度
+ * 包括各种宽度的整数，以及长度在 254 字节附近的字符串(ziplist 的 prevlen 在这里从1字节变为5字节)
+ */
+static unsigned int randomValue(unsigned char *buf) {
+
+    int i, len;
+
+    switch (rand() % 4) {
+        case 0:
+            return sprintf((char *)buf, "%d", rand() % 300 - 150);
+        case 1:
+            return sprintf((char *)buf, "%lld", ((long long)rand() << 32 | rand()) >> (rand() % 60));
+        case 2:
+            len = 245 + rand() % 15;
+            break;
+        default:
+            len = rand() % 80;
+    }
+    for (i = 0; i < len; i++) buf[i] = 'a' + rand() % 26;
+    return len;
+}
+
+// 检查 ziplist 和 listpack 按顺序保存着相同的值，并且两个方向的遍历结果一致
+static void assertSameElements(unsigned char *zl, unsigned char *lp) {
+
+    unsigned char *p, *q, *zs, *ls;
+    unsigned int zlen, llen, n = 0;
+    long long zv, lv;
+
+    assert(ziplistLen(zl) == lpLen(lp));
+
+    for (p = ziplistIndex(zl, 0), q = lpFirst(lp); p; p = ziplistNext(zl, p), q = lpNext(lp, q)) {
+        assert(q != NULL);
+        ziplistGet(p, &zs, &zlen, &zv);
+        lpGet(q, &ls, &llen, &lv);
+        assert((zs == NULL) == (ls == NULL));
+        if (zs) assert(zlen == llen && memcmp(zs, ls, zlen) == 0);
+        else assert(zv == lv);
+        n++;
+    }
+    assert(q == NULL && n == lpLen(lp));
+
+    for (q = lpLast(lp); q; q = lpPrev(lp, q)) n--;
+    assert(n == 0);
+}
+
+
+// 检查两个 ziplist 保存着相同的元素，并且表尾偏移量和每个节点的 prevlen 都正确(从表尾向前遍历能回到表头)
+static void assertSameZiplist(unsigned char *a, unsigned char *b) {
+
+    unsigned char *p, *q, *as, *bs;
+    unsigned int alen, blen, n = 0;
+    long long av, bv;
+
+    assert(ziplistLen(a) == ziplistLen(b));
+    for (p = ziplistIndex(a, 0), q = ziplistIndex(b, 0); p; p = ziplistNext(a, p), q = ziplistNext(b, q)) {
+        assert(q != NULL);
+        ziplistGet(p, &as, &alen, &av);
+        ziplistGet(q, &bs, &blen, &bv);
+        assert((as == NULL) == (bs == NULL));
+        if (as) assert(alen == blen && memcmp(as, bs, alen) == 0);
+        else assert(av == bv);
+        n++;
+    }
+    assert(q == NULL && n == ziplistLen(a));
+
+    for (p = ziplistIndex(a, -1); p; p = ziplistPrev(a, p)) n--;
+    assert(n == 0);
+    for (p = ziplistIndex(b, -1), n = ziplistLen(b); p; p = ziplistPrev(b, p)) n--;
+    assert(n == 0);
+}
+
+static unsigned char *duplicateZiplist(unsigned char *zl) {
+
+    unsigned char *copy = (unsigned char *)malloc(ziplistBlobLen(zl));
+    memcpy(copy, zl, ziplistBlobLen(zl));
+    return copy;
+}
+
+// 模拟真实数据中重复出现的字段名和枚举值，同时也是共享字典的内容
+static const char *datasetWords[] = {
+    "name", "email", "country", "status", "plan", "age", "created", "visits",
+    "US", "CN", "DE", "JP", "GB", "FR", "IN", "BR", "CA", "KR",
+    "active", "inactive", "pending", "suspended", "free", "basic", "pro", "enterprise",
+    "GET", "POST", "PUT", "DELETE", "/api/v1/users", "/api/v1/orders", "/static/app.js", "/health",
+    "USD", "EUR", "CNY", "WH-EAST", "WH-WEST", "WH-NORTH"
+};
+
+static const char *datasetNames[3] = {"user hash", "access log", "order items"};
+
+#define DATASET_WORD(first, n) ((unsigned char *)datasetWords[(first) + rand() % (n)])
+
+static unsigned char *datasetPush(unsigned char *zl, const char *s) {
+
+    return ziplistPush(zl, (unsigned char *)s, strlen(s), ZIPLIST_TAIL);
+}
+
+/**
+ * 生成一个保存真实形态数据的 ziplist
+ *  0 用户信息的 hash：8 个字段和值，包括国家代码、状态、年龄、注册年份
+ *  1 访问日志：20 条请求，每条是方法、路径、状态码、响应字节数、耗时(毫秒)
+ *  2 订单明细：10 件商品，每件是 SKU、数量、价格(分)、币种、仓库
+ */
+static unsigned char *createDatasetList(int kind) {
+
+    unsigned char *zl = ziplistNew();
+    char buf[64];
+    int i;
+
+    if (kind == 0) {
+        const char *values[8];
+        char name[16], email[32], age[8], created[8], visits[16];
+
+        sprintf(name, "user%d", rand() % 100000);
+        sprintf(email, "%s@example.com", name);
+        sprintf(age, "%d", 18 + rand() % 60);
+        sprintf(created, "%d", 2000 + rand() % 25);
+        sprintf(visits, "%d", rand() % 5000);
+        values[0] = name;
+        values[1] = email;
+        values[2] = (const char *)DATASET_WORD(8, 10);
+        values[3] = (const char *)DATASET_WORD(18, 4);
+        values[4] = (const char *)DATASET_WORD(22, 4);
+        values[5] = age;
+        values[6] = created;
+        values[7] = visits;
+        for (i = 0; i < 8; i++) {
+            zl = datasetPush(zl, datasetWords[i]);
+            zl = datasetPush(zl, values[i]);
+        }
+    } else if (kind == 1) {
+        static const int codes[6] = {200, 200, 201, 304, 404, 500};
+        for (i = 0; i < 20; i++) {
+            zl = datasetPush(zl, (const char *)DATASET_WORD(26, 4));
+            zl = datasetPush(zl, (const char *)DATASET_WORD(30, 4));
+            sprintf(buf, "%d", codes[rand() % 6]);
+            zl = datasetPush(zl, buf);
+            sprintf(buf, "%d", 100 + rand() % 3700);
+            zl = datasetPush(zl, buf);
+            sprintf(buf, "%d", 1 + rand() % 2000);
+            zl = datasetPush(zl, buf);
+        }
+    } else {
+        for (i = 0; i < 10; i++) {
+            sprintf(buf, "SKU-%05d", rand() % 100000);
+            zl = datasetPush(zl, buf);
+            sprintf(buf, "%d", 1 + rand() % 20);
+            zl = datasetPush(zl, buf);
+            sprintf(buf, "%d", 199 + rand() % 3300);
+            zl = datasetPush(zl, buf);
+            zl = datasetPush(zl, (const char *)DATASET_WORD(34, 3));
+            zl = datasetPush(zl, (const char *)DATASET_WORD(37, 3));
+        }
+    }
+    return zl;
+}
+
+// 把 datasetWords 设置为共享字典
+static int datasetDictSet(void) {
+
+    unsigned int i, n = sizeof(datasetWords) / sizeof(datasetWords[0]), lens[ZIPLIST_DICT_MAX];
+    unsigned char *strs[ZIPLIST_DICT_MAX];
+
+    for (i = 0; i < n; i++) {
+        strs[i] = (unsigned char *)datasetWords[i];
+        lens[i] = strlen(datasetWords[i]);
+    }
+    return ziplistDictSet(strs, lens, n);
+}
+
+/**
+ * 原来的 ziplistFind，每个节点都通过 ZIP_DECODE_LENGTH 解码，第一次遇到整数节点时才尝试转换给定值
+ * 用来验证 ziplistFind 的结果，并作为性能对比的基准
+ */
+unsigned char *ziplistFindReference(unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip) {
+
+    int skipcnt = 0;
+    unsigned char vencoding = 0;
+    long long vll = 0;
+
+    // 遍历整个列表
+    while (p[0] != ZIP_END) {
+        unsigned int prevlensize, encoding, lensize, len;
+        unsigned char *q;
+
+        // 编码前一个节点的长度所需的空间
+        ZIP_DECODE_PREVLENSIZE(p, prevlensize);
+        // 当前节点的长度
+        ZIP_DECODE_LENGTH(p + prevlensize, encoding, lensize, len);
+        // 保存下一个节点的地址
+        q = p + prevlensize + lensize;
+
+        if (skipcnt == 0) {
+            /* Compare current entry with specified entry */
+            // 对比字符串
+            if (ZIP_IS_STR(encoding)) {
+                if (len == vlen && memcmp(q, vstr, vlen) == 0) {
+                    return p;
+                }
+            // 对比整数
+            } else {
+                /* Find out if the searched field can be encoded. Note that
+                 * we do it only the first time, once done vencoding is set
+                 * to non-zero and vll is set to the integer value. */
+                // 对传入值进行 decode
+                if (vencoding == 0) {
+                    if (!zipTryEncoding(vstr, vlen, &vll, &vencoding)) {
+                        /* If the entry can't be encoded we set it to
+                         * UCHAR_MAX so that we don't retry again the next
+                         * time. */
+                        vencoding = UCHAR_MAX;
+                    }
+                    /* Must be non-zero by now */
+                    assert(vencoding);
+                }
+
+                /* Compare current entry with specified entry, do it only
+                 * if vencoding != UCHAR_MAX because if there is no encoding
+                 * possible for the field it can't be a valid integer. */
+                if (vencoding != UCHAR_MAX) {
+                    // 对比
+                    long long ll = zipLoadInteger(q, encoding);
+                    if (ll == vll) {
+                        return p;
+                    }
+                }
+            }
+
+            /* Reset skip count */
+            skipcnt = skip;
+        } else {
+            /* Skip entry */
+            skipcnt--;
+        }
+
+        /* Move to next entry */
+        p = q + len;
+    }
+
+    return NULL;
+}
+
+
 void test_case_1() {
 
     unsigned char *zl, *p;
@@ -570,6 +817,939 @@ void test_case_1() {
         free(zl);
     }
 
+    printf("Listpack encodings: ");
+    {
+        const char *ints[] = {"0", "127", "128", "-1", "-4096", "-4097", "4095", "4096", "32767", "-32768",
+            "8388607", "-8388608", "2147483647", "-2147483648", "9223372036854775807", "-9223372036854775808"};
+        unsigned int lens[] = {0, 1, 63, 64, 4095, 4096, 70000};
+        int nints = sizeof(ints) / sizeof(ints[0]), nlens = sizeof(lens) / sizeof(lens[0]), i;
+        unsigned char *lp = lpNew(), *big = (unsigned char *)malloc(70000), *sval;
+        unsigned int slen;
+        long long lval;
+
+        for (i = 0; i < 70000; i++) big[i] = 'a' + i % 26;
+        for (i = 0; i < nints; i++) lp = lpPush(lp, (unsigned char *)ints[i], strlen(ints[i]), LP_TAIL);
+        for (i = 0; i < nlens; i++) lp = lpPush(lp, big, lens[i], LP_TAIL);
+        // 有前导零或者空格的数字只能保存为字符串
+        lp = lpPush(lp, (unsigned char *)"0123", 4, LP_HEAD);
+        assert(lpLen(lp) == (unsigned int)(nints + nlens + 1));
+
+        for (i = 0; i < nints; i++) {
+            p = lpIndex(lp, i + 1);
+            assert(lpGet(p, &sval, &slen, &lval) && sval == NULL);
+            assert(lval == strtoll(ints[i], NULL, 10));
+            assert(lpCompare(p, (unsigned char *)ints[i], strlen(ints[i])));
+            // 负数索引指向同一个节点
+            assert(lpIndex(lp, i + 1 - (nints + nlens + 1)) == p);
+        }
+        for (i = 0; i < nlens; i++) {
+            p = lpIndex(lp, nints + 1 + i);
+            assert(lpGet(p, &sval, &slen, &lval) && sval != NULL);
+            assert(slen == lens[i] && memcmp(sval, big, slen) == 0);
+        }
+        assert(lpGet(lpFirst(lp), &sval, &slen, &lval) && slen == 4 && memcmp(sval, "0123", 4) == 0);
+        assert(lpIndex(lp, nints + nlens + 1) == NULL && lpIndex(lp, -(nints + nlens + 2)) == NULL);
+
+        assert(lpFind(lp, lpFirst(lp), (unsigned char *)"-4097", 5, 0) == lpIndex(lp, 6));
+        assert(lpFind(lp, lpFirst(lp), (unsigned char *)"0123", 4, 0) == lpFirst(lp));
+        assert(lpFind(lp, lpFirst(lp), (unsigned char *)"nope", 4, 0) == NULL);
+
+        free(big);
+        free(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Listpack matches ziplist under random operations: ");
+    {
+        unsigned char buf[300], *lp, *zl2, *lp2, *q, *sval;
+        unsigned int len, slen;
+        long long lval;
+        int round, op, idx, n;
+
+        srand(1234);
+        zl = ziplistNew();
+        lp = lpNew();
+        for (round = 0; round < 4000; round++) {
+            len = randomValue(buf);
+            n = ziplistLen(zl);
+            op = rand() % 10;
+
+            if (op < 3) {
+                zl = ziplistPush(zl, buf, len, ZIPLIST_HEAD);
+                lp = lpPush(lp, buf, len, LP_HEAD);
+            } else if (op < 6) {
+                zl = ziplistPush(zl, buf, len, ZIPLIST_TAIL);
+                lp = lpPush(lp, buf, len, LP_TAIL);
+            } else if (op < 8 && n > 0) {
+                // 插入到随机节点之前
+                idx = rand() % n;
+                zl = ziplistInsert(zl, ziplistIndex(zl, idx), buf, len);
+                lp = lpInsert(lp, lpIndex(lp, idx), buf, len);
+            } else if (op < 9 && n > 0) {
+                idx = rand() % n;
+                p = ziplistIndex(zl, idx);
+                q = lpIndex(lp, idx);
+                zl = ziplistDelete(zl, &p);
+                lp = lpDelete(lp, &q);
+            } else if (n > 0) {
+                idx = rand() % n - n;
+                len = rand() % 4;
+                zl = ziplistDeleteRange(zl, idx, len);
+                lp = lpDeleteRange(lp, idx, len);
+            }
+            assertSameElements(zl, lp);
+
+            // 查找随机选取的已有元素，两边都返回相同索引上的节点
+            if (ziplistLen(zl) > 0 && round % 16 == 0) {
+                idx = rand() % ziplistLen(zl);
+                lpGet(lpIndex(lp, idx), &sval, &slen, &lval);
+                if (sval == NULL) slen = ll2string((char *)buf, sizeof(buf), lval), sval = buf;
+                p = ziplistFind(ziplistIndex(zl, 0), sval, slen, 0);
+                q = lpFind(lp, lpFirst(lp), sval, slen, 0);
+                assert(p && q && lpCompare(q, sval, slen) && ziplistCompare(p, sval, slen));
+            }
+        }
+
+        // 双向转换。ziplist 的 prevlen 变长之后不会再缩短，所以只比较元素；listpack 的编码只取决于值，字节完全相同
+        zl2 = ziplistFromListpack(lp);
+        assertSameElements(zl2, lp);
+        lp2 = lpFromZiplist(zl2);
+        assert(lpBlobLen(lp2) == lpBlobLen(lp) && memcmp(lp2, lp, lpBlobLen(lp)) == 0);
+        free(zl2);
+
+        // 合并两个 listpack，与合并两个 ziplist 的结果相同
+        zl2 = ziplistFromListpack(lp);
+        lp2 = lpMerge(&lp2, &lp);
+        zl = ziplistMerge(&zl, &zl2);
+        assertSameElements(zl, lp2);
+        assert(lp == NULL && zl2 == NULL);
+
+        free(zl);
+        free(lp2);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Batch insert and delete match single operations: ");
+    {
+        unsigned char bufs[64][300], numbuf[32], *zl2;
+        ziplistEntry entries[64];
+        unsigned int positions[64], i, k, len, idx;
+        int round, j, last;
+
+        srand(4321);
+        for (round = 0; round < 500; round++) {
+            zl = ziplistNew();
+            len = rand() % 120;
+            for (i = 0; i < len; i++) {
+                k = randomValue(bufs[0]);
+                zl = ziplistPush(zl, bufs[0], k, ZIPLIST_TAIL);
+            }
+
+            // 随机的字符串和整数元素，整数一半以字符串传入，一半以 lval 传入
+            k = rand() % 64;
+            for (i = 0; i < k; i++) {
+                entries[i].slen = randomValue(bufs[i]);
+                entries[i].sval = bufs[i];
+                if (rand() % 2 && string2ll((char *)bufs[i], entries[i].slen, &entries[i].lval)) entries[i].sval = NULL;
+            }
+
+            // ziplistInsertMany 与逐个 ziplistInsert 的结果相同
+            idx = rand() % (len + 1);
+            zl2 = duplicateZiplist(zl);
+            p = (idx < len) ? ziplistIndex(zl, idx) : ZIPLIST_ENTRY_END(zl);
+            zl = ziplistInsertMany(zl, p, entries, k);
+
+            p = (idx < len) ? ziplistIndex(zl2, idx) : ZIPLIST_ENTRY_END(zl2);
+            for (i = 0; i < k; i++) {
+                size_t offset = p - zl2;
+                if (entries[i].sval) {
+                    zl2 = ziplistInsert(zl2, zl2 + offset, entries[i].sval, entries[i].slen);
+                } else {
+                    j = ll2string((char *)numbuf, sizeof(numbuf), entries[i].lval);
+                    zl2 = ziplistInsert(zl2, zl2 + offset, numbuf, j);
+                }
+                p = zl2 + offset;
+                p += zipRawEntryLength(p);
+            }
+            assertSameZiplist(zl, zl2);
+
+            // ziplistPushMany 与逐个 ziplistPush 的结果相同
+            j = rand() % 2 ? ZIPLIST_HEAD : ZIPLIST_TAIL;
+            zl = ziplistPushMany(zl, entries, k, j);
+            for (i = 0; i < k; i++) {
+                last = (j == ZIPLIST_HEAD) ? k - 1 - i : i;
+                if (entries[last].sval) {
+                    zl2 = ziplistPush(zl2, entries[last].sval, entries[last].slen, j);
+                } else {
+                    len = ll2string((char *)numbuf, sizeof(numbuf), entries[last].lval);
+                    zl2 = ziplistPush(zl2, numbuf, len, j);
+                }
+            }
+            assertSameZiplist(zl, zl2);
+
+            // ziplistDeleteMany 与按索引从大到小逐个删除的结果相同，重复和越界的索引被忽略
+            len = ziplistLen(zl);
+            k = rand() % 64;
+            for (i = 0; i < k; i++) positions[i] = rand() % (len + 5);
+            zl = ziplistDeleteMany(zl, positions, k);
+
+            for (idx = len; idx-- > 0; ) {
+                for (i = 0; i < k && positions[i] != idx; i++);
+                if (i < k) zl2 = ziplistDeleteRange(zl2, idx, 1);
+            }
+            assertSameZiplist(zl, zl2);
+
+            free(zl);
+            free(zl2);
+        }
+
+        // 删除之后 prevlen 需要变长：小节点夹在大节点和一串 253 字节的节点之间
+        {
+            unsigned char value[300];
+            unsigned int first = 0;
+
+            memset(value, 'x', sizeof(value));
+            zl = ziplistNew();
+            zl = ziplistPush(zl, value, 300, ZIPLIST_TAIL);
+            zl = ziplistPush(zl, value, 1, ZIPLIST_TAIL);
+            for (i = 0; i < 50; i++) zl = ziplistPush(zl, value, 250, ZIPLIST_TAIL);
+            zl2 = duplicateZiplist(zl);
+
+            first = 1;
+            zl = ziplistDeleteMany(zl, &first, 1);
+            zl2 = ziplistDeleteRange(zl2, 1, 1);
+            assertSameZiplist(zl, zl2);
+            assert(ziplistBlobLen(zl) == ziplistBlobLen(zl2));
+
+            free(zl);
+            free(zl2);
+        }
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Batch insert and delete benchmark:\n");
+    {
+        char fields[2048][32];
+        ziplistEntry entries[2048];
+        unsigned int positions[2048], i, n, sizes[3] = {64, 256, 1024};
+        long long start, t1, t2;
+        unsigned char *zl2;
+        int k;
+
+        for (k = 0; k < 3; k++) {
+            n = sizes[k];
+
+            // HSET key f1 v1 f2 v2 ...：向已有 1000 个节点的哈希添加 n 对 field/value
+            for (i = 0; i < 2 * n; i++) {
+                entries[i].slen = sprintf(fields[i], i % 2 ? "value:%u" : "field:%u", i / 2);
+                entries[i].sval = (unsigned char *)fields[i];
+            }
+            zl = ziplistNew();
+            for (i = 0; i < 1000; i++) zl = ziplistPush(zl, (unsigned char *)"existing-field", 14, ZIPLIST_TAIL);
+            zl2 = duplicateZiplist(zl);
+
+            start = usec();
+            for (i = 0; i < 2 * n; i++) zl = ziplistPush(zl, entries[i].sval, entries[i].slen, ZIPLIST_TAIL);
+            t1 = usec() - start;
+
+            start = usec();
+            zl2 = ziplistPushMany(zl2, entries, 2 * n, ZIPLIST_TAIL);
+            t2 = usec() - start;
+            assertSameZiplist(zl, zl2);
+            printf("  HSET %4u fields: ziplistPush %6lld usec, ziplistPushMany %5lld usec", n, t1, t2);
+
+            // 在表头插入，每次都要移动整个列表
+            start = usec();
+            for (i = 0; i < 2 * n; i++) zl = ziplistPush(zl, entries[2 * n - 1 - i].sval, entries[2 * n - 1 - i].slen, ZIPLIST_HEAD);
+            t1 = usec() - start;
+
+            start = usec();
+            zl2 = ziplistPushMany(zl2, entries, 2 * n, ZIPLIST_HEAD);
+            t2 = usec() - start;
+            assertSameZiplist(zl, zl2);
+            printf("; head insert %7lld vs %5lld usec", t1, t2);
+
+            // HDEL 删除 n 个分散的 field(每个 field 连同 value)
+            for (i = 0; i < n; i++) {
+                positions[2 * i] = 2 * i * 2;
+                positions[2 * i + 1] = 2 * i * 2 + 1;
+            }
+            start = usec();
+            for (i = 2 * n; i-- > 0; ) zl = ziplistDeleteRange(zl, positions[i], 1);
+            t1 = usec() - start;
+
+            start = usec();
+            zl2 = ziplistDeleteMany(zl2, positions, 2 * n);
+            t2 = usec() - start;
+            assertSameZiplist(zl, zl2);
+            printf("; HDEL %7lld vs %5lld usec\n", t1, t2);
+
+            free(zl);
+            free(zl2);
+        }
+        printf("\n");
+    }
+
+    printf("ziplistFind matches reference: ");
+    {
+        unsigned char buf[300], *needle;
+        unsigned int i, len, nlen, skip;
+        int round;
+
+        srand(777);
+        for (round = 0; round < 300; round++) {
+            zl = ziplistNew();
+            len = rand() % 200;
+            for (i = 0; i < len; i++) {
+                nlen = randomValue(buf);
+                zl = ziplistPush(zl, buf, nlen, ZIPLIST_TAIL);
+            }
+
+            // 查找已有的值、随机的值以及空字符串
+            for (i = 0; i < 20; i++) {
+                long long v;
+                needle = buf;
+                if (len && i % 2) {
+                    ziplistGet(ziplistIndex(zl, rand() % len), &needle, &nlen, &v);
+                    if (needle == NULL) needle = buf, nlen = ll2string((char *)buf, sizeof(buf), v);
+                } else {
+                    nlen = (i % 5 == 0) ? 0 : randomValue(buf);
+                }
+                skip = rand() % 3;
+                assert(ziplistFind(ZIPLIST_ENTRY_HEAD(zl), needle, nlen, skip) ==
+                    ziplistFindReference(ZIPLIST_ENTRY_HEAD(zl), needle, nlen, skip));
+            }
+            free(zl);
+        }
+        printf("SUCCESS\n\n");
+    }
+
+    printf("HGET benchmark (512 fields):\n");
+    {
+        char buf[64];
+        const char *names[3] = {"string values", "integer values", "mixed values"};
+        int k, i, lookups = 20000;
+        unsigned int *targets = (unsigned int *)malloc(sizeof(unsigned int) * lookups), hits1 = 0, hits2 = 0;
+        long long start, t1, t2;
+
+        for (k = 0; k < 3; k++) {
+            // field/value 交替保存，查找 field 时 skip 为 1
+            zl = ziplistNew();
+            for (i = 0; i < 512; i++) {
+                sprintf(buf, "field:%d", i);
+                zl = ziplistPush(zl, (unsigned char *)buf, strlen(buf), ZIPLIST_TAIL);
+                if (k == 0 || (k == 2 && i % 2)) sprintf(buf, "value-%08d", i * 7);
+                else sprintf(buf, "%d", i * 1000);
+                zl = ziplistPush(zl, (unsigned char *)buf, strlen(buf), ZIPLIST_TAIL);
+            }
+            for (i = 0; i < lookups; i++) targets[i] = rand() % 600;      // 约 15% 查找不存在的 field
+
+            start = usec();
+            for (i = 0; i < lookups; i++) {
+                int n = sprintf(buf, "field:%u", targets[i]);
+                hits1 += ziplistFindReference(ZIPLIST_ENTRY_HEAD(zl), (unsigned char *)buf, n, 1) != NULL;
+            }
+            t1 = usec() - start;
+
+            start = usec();
+            for (i = 0; i < lookups; i++) {
+                int n = sprintf(buf, "field:%u", targets[i]);
+                hits2 += ziplistFind(ZIPLIST_ENTRY_HEAD(zl), (unsigned char *)buf, n, 1) != NULL;
+            }
+            t2 = usec() - start;
+
+            assert(hits1 == hits2);
+            printf("  %-14s: reference %.2f us/lookup, ziplistFind %.2f us/lookup\n",
+                names[k], (double)t1 / lookups, (double)t2 / lookups);
+            free(zl);
+        }
+        free(targets);
+        printf("\n");
+    }
+
+    printf("Side index matches ziplistIndex under random operations: ");
+    {
+        unsigned char buf[300], *p;
+        ziplistSideIndex *sidx = ziplistSideIndexNew();
+        unsigned int len, n;
+        int i, op, round, index;
+
+        srand(4242);
+        zl = ziplistNew();
+        for (round = 0; round < 3000; round++) {
+            len = ziplistLen(zl);
+            op = rand() % 10;
+            if (op < 4 || len < 10) {
+                // 插入到随机位置(包括表头和表尾)，长度在 254 附近的值会触发连锁更新
+                n = randomValue(buf);
+                index = len ? rand() % (len + 1) : 0;
+                p = (index == (int)len) ? ZIPLIST_ENTRY_END(zl) : ziplistIndexWithSide(zl, sidx, index);
+                zl = ziplistInsertWithSide(zl, sidx, p, buf, n);
+            } else if (op < 6) {
+                p = ziplistIndexWithSide(zl, sidx, rand() % len);
+                zl = ziplistDeleteWithSide(zl, sidx, &p);
+            } else if (op < 7) {
+                zl = ziplistDeleteRangeWithSide(zl, sidx, rand() % len - len / 2, rand() % 8);
+            } else if (op < 8) {
+                // 不经过索引修改 ziplist，之后手动通知索引
+                n = randomValue(buf);
+                zl = ziplistPush(zl, buf, n, ZIPLIST_HEAD);
+                ziplistSideIndexInvalidate(sidx, zl, ZIPLIST_HEADER_SIZE);
+            } else if (op < 9) {
+                // 不经过索引也不通知索引，依靠字节数和节点数量的变化发现
+                n = randomValue(buf);
+                zl = ziplistPush(zl, buf, n, ZIPLIST_HEAD);
+            }
+
+            len = ziplistLen(zl);
+            for (i = 0; i < 20; i++) {
+                index = rand() % (2 * len + 10) - (int)len - 5;
+                assert(ziplistIndexWithSide(zl, sidx, index) == ziplistIndex(zl, index));
+            }
+        }
+        free(zl);
+        ziplistSideIndexFree(sidx);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Random index benchmark:\n");
+    {
+        unsigned char buf[300];
+        unsigned int sizes[2] = {8 * 1024, 64 * 1024}, len, n, sum1, sum2;
+        int k, i, lookups = 20000, *targets = (int *)malloc(sizeof(int) * lookups);
+        ziplistSideIndex *sidx;
+        long long start, t1, t2;
+
+        for (k = 0; k < 2; k++) {
+            zl = ziplistNew();
+            while (intrev32ifbe(ZIPLIST_BYTES(zl)) < sizes[k]) {
+                n = sprintf((char *)buf, (rand() % 2) ? "%d" : "value:%d", rand());
+                zl = ziplistPush(zl, buf, n, ZIPLIST_TAIL);
+            }
+            len = ziplistLen(zl);
+            for (i = 0; i < lookups; i++) targets[i] = rand() % len;
+            sidx = ziplistSideIndexNew();
+            ziplistIndexWithSide(zl, sidx, len - 1);        // 建立索引
+
+            sum1 = sum2 = 0;
+            start = usec();
+            for (i = 0; i < lookups; i++) sum1 += ziplistIndex(zl, targets[i])[0];
+            t1 = usec() - start;
+
+            start = usec();
+            for (i = 0; i < lookups; i++) sum2 += ziplistIndexWithSide(zl, sidx, targets[i])[0];
+            t2 = usec() - start;
+
+            assert(sum1 == sum2);
+            printf("  %2u KB, %5u entries: ziplistIndex %8.3f us/op, ziplistIndexWithSide %.3f us/op, index %u bytes\n",
+                sizes[k] / 1024, len, (double)t1 / lookups, (double)t2 / lookups,
+                (unsigned int)(sidx->count * sizeof(uint32_t)));
+            ziplistSideIndexFree(sidx);
+            free(zl);
+        }
+        free(targets);
+        printf("\n");
+    }
+
+    printf("Cascade update benchmark:\n");
+    {
+        unsigned char value[300], big[300], *lp;
+        int sizes[3] = {1000, 4000, 16000}, i, k;
+        long long start, t1, t2, t3, t4;
+
+        memset(value, 'v', sizeof(value));
+        memset(big, 'B', sizeof(big));
+
+        for (k = 0; k < 3; k++) {
+            // 每个节点正好占 253 字节(1 字节 prevlen + 2 字节编码 + 250 字节数据)
+            zl = ziplistNew();
+            lp = lpNew();
+            for (i = 0; i < sizes[k]; i++) {
+                zl = ziplistPush(zl, value, 250, ZIPLIST_TAIL);
+                lp = lpPush(lp, value, 250, LP_TAIL);
+            }
+
+            // 在表头插入一个大节点，ziplist 中后面所有节点的 prevlen 都要从1字节变为5字节
+            start = usec();
+            zl = ziplistPush(zl, big, 300, ZIPLIST_HEAD);
+            t1 = usec() - start;
+
+            start = usec();
+            lp = lpPush(lp, big, 300, LP_HEAD);
+            t2 = usec() - start;
+
+            // 再交替插入和删除一个小节点，这时 ziplist 的 prevlen 已经变长，不会再连锁更新
+            start = usec();
+            for (i = 0; i < 100; i++) {
+                zl = ziplistPush(zl, value, 10, ZIPLIST_HEAD);
+                zl = ziplistDeleteRange(zl, 0, 1);
+            }
+            t3 = usec() - start;
+
+            start = usec();
+            for (i = 0; i < 100; i++) {
+                lp = lpPush(lp, value, 10, LP_HEAD);
+                lp = lpDeleteRange(lp, 0, 1);
+            }
+            t4 = usec() - start;
+
+            printf("  %5d entries: cascading head insert ziplist %6lld usec, listpack %4lld usec; "
+                "100x push + pop ziplist %5lld usec, listpack %5lld usec; bytes ziplist %zu listpack %zu\n",
+                sizes[k], t1, t2, t3, t4, ziplistBlobLen(zl), lpBlobLen(lp));
+
+            free(zl);
+            free(lp);
+        }
+        printf("\n");
+    }
+
+    printf("zipEntrySafe matches zipEntry and stays in bounds: ");
+    {
+        unsigned char buf[300], *copy, *q;
+        unsigned int i, n, bytes, cut;
+        zlentry e1, e2;
+        int round;
+
+        srand(99);
+        for (round = 0; round < 200; round++) {
+            zl = ziplistNew();
+            n = rand() % 40;
+            for (i = 0; i < n; i++) zl = ziplistPush(zl, buf, randomValue(buf), ZIPLIST_TAIL);
+            bytes = intrev32ifbe(ZIPLIST_BYTES(zl));
+
+            // 合法的 ziplist：每个节点的解码结果都与 zipEntry 相同
+            for (p = ZIPLIST_ENTRY_HEAD(zl); p[0] != ZIP_END; p += e1.headersize + e1.len) {
+                zipEntry(p, &e1);
+                assert(zipEntrySafe(zl, bytes, p, &e2, 1));
+                assert(e1.prevrawlensize == e2.prevrawlensize && e1.prevrawlen == e2.prevrawlen);
+                assert(e1.lensize == e2.lensize && e1.len == e2.len);
+                assert(e1.headersize == e2.headersize && e1.encoding == e2.encoding && e2.p == p);
+            }
+            assert(!zipEntrySafe(zl, bytes, p, &e2, 1));
+
+            // 截断之后，越过新边界的节点都被拒绝
+            cut = ZIPLIST_HEADER_SIZE + ZIPLIST_END_SIZE + rand() % (bytes - ZIPLIST_HEADER_SIZE);
+            for (p = ZIPLIST_ENTRY_HEAD(zl); p[0] != ZIP_END; p += e1.headersize + e1.len) {
+                zipEntry(p, &e1);
+                assert(zipEntrySafe(zl, cut, p, &e2, 1) == (p + e1.headersize + e1.len <= zl + cut - 1));
+            }
+
+            // 随机改写一个字节，沿着 zipEntrySafe 遍历不会越界
+            if (n) {
+                copy = (unsigned char *)malloc(bytes);
+                memcpy(copy, zl, bytes);
+                copy[ZIPLIST_HEADER_SIZE + rand() % (bytes - ZIPLIST_HEADER_SIZE - 1)] = rand() % 256;
+                for (q = ZIPLIST_ENTRY_HEAD(copy); zipEntrySafe(copy, bytes, q, &e2, 1); q += e2.headersize + e2.len) {
+                    assert(q + e2.headersize + e2.len <= copy + bytes - 1);
+                    assert(q - e2.prevrawlen >= ZIPLIST_ENTRY_HEAD(copy));
+                }
+                free(copy);
+            }
+            free(zl);
+        }
+        printf("SUCCESS\n\n");
+    }
+
+    printf("ziplistValidateIntegrity fuzz: ");
+    {
+        unsigned char buf[300], *copy, *q, *head, *end;
+        unsigned int i, n, bytes, count, accepted = 0, rejected = 0;
+        int round, flips;
+        long long v;
+
+        srand(2024);
+        for (round = 0; round < 2000; round++) {
+            zl = ziplistNew();
+            n = rand() % 30;
+            for (i = 0; i < n; i++) zl = ziplistPush(zl, buf, randomValue(buf), ZIPLIST_TAIL);
+            bytes = intrev32ifbe(ZIPLIST_BYTES(zl));
+            assert(ziplistValidateIntegrity(zl, bytes, 0));
+            assert(ziplistValidateIntegrity(zl, bytes, 1));
+            // 大小与 header 不一致
+            assert(!ziplistValidateIntegrity(zl, bytes - 1, 0));
+            assert(!ziplistValidateIntegrity(zl, bytes + 1, 0));
+
+            // 随机改写 1 到 3 个字节(包括 header)，复制到大小恰好的内存中，越界读取才有意义
+            copy = (unsigned char *)malloc(bytes);
+            memcpy(copy, zl, bytes);
+            for (flips = 1 + rand() % 3; flips > 0; flips--) copy[rand() % bytes] = rand() % 256;
+
+            if (!ziplistValidateIntegrity(copy, bytes, 1)) {
+                rejected++;
+            } else {
+                // 通过检查的 ziplist 两个方向的遍历都停留在边界之内，并且节点数量一致
+                accepted++;
+                head = ZIPLIST_ENTRY_HEAD(copy);
+                end = ZIPLIST_ENTRY_END(copy);
+                count = 0;
+                for (q = ziplistIndex(copy, 0); q; q = ziplistNext(copy, q)) {
+                    assert(q >= head && q < end);
+                    ziplistGet(q, &p, &i, &v);
+                    if (p) assert(p + i <= end);
+                    count++;
+                }
+                assert(count == ziplistLen(copy));
+                for (q = ziplistPrev(copy, end); q; q = ziplistPrev(copy, q)) {
+                    assert(q >= head && q < end);
+                    count--;
+                }
+                assert(count == 0);
+            }
+            free(copy);
+            free(zl);
+        }
+        assert(accepted > 0 && rejected > 0);
+        printf("SUCCESS (%u corrupted copies rejected, %u harmless ones accepted)\n\n", rejected, accepted);
+    }
+
+    printf("ziplistValidateIntegrity throughput:\n");
+    {
+        unsigned char buf[32];
+        unsigned int sizes[2] = {8 * 1024, 64 * 1024}, bytes, n;
+        int k, round, rounds = 200;
+        long long start, t1, t2, sum = 0;
+
+        for (k = 0; k < 2; k++) {
+            zl = ziplistNew();
+            while (intrev32ifbe(ZIPLIST_BYTES(zl)) < sizes[k]) {
+                n = sprintf((char *)buf, (rand() % 2) ? "%d" : "value:%d", rand());
+                zl = ziplistPush(zl, buf, n, ZIPLIST_TAIL);
+            }
+            bytes = intrev32ifbe(ZIPLIST_BYTES(zl));
+            n = ziplistLen(zl);
+
+            start = usec();
+            for (round = 0; round < rounds * 1000; round++) sum += ziplistValidateIntegrity(zl, bytes, 0);
+            t1 = usec() - start;
+
+            start = usec();
+            for (round = 0; round < rounds; round++) sum += ziplistValidateIntegrity(zl, bytes, 1);
+            t2 = usec() - start;
+
+            printf("  %2u KB, %5u entries: header %.1f ns, deep %.1f us (%.2f ns/entry, %.0f MB/s)\n",
+                sizes[k] / 1024, n, (double)t1 / rounds, (double)t2 / rounds,
+                t2 * 1000.0 / ((double)rounds * n), (double)bytes * rounds / t2);
+            free(zl);
+        }
+        assert(sum == (long long)rounds * 1001 * 2);
+        printf("\n");
+    }
+
+    printf("ziplistIter matches ziplistNext/ziplistPrev + ziplistGet: ");
+    {
+        unsigned char buf[300], *vstr;
+        unsigned int i, n, vlen, start;
+        long long vlong;
+        int round, dir;
+        ziplistIter iter;
+        ziplistEntry entry;
+
+        srand(45);
+        for (round = 0; round < 300; round++) {
+            zl = ziplistNew();
+            n = rand() % 60;
+            for (i = 0; i < n; i++) zl = ziplistPush(zl, buf, randomValue(buf), ZIPLIST_TAIL);
+
+            // 从表头、表尾以及随机位置开始，两个方向都与原来的遍历方式一致
+            for (dir = ZIPLIST_HEAD; dir <= ZIPLIST_TAIL; dir++) {
+                start = n ? rand() % n : 0;
+                for (i = 0; i < 2; i++) {
+                    if (i == 0) {
+                        ziplistIterInit(zl, &iter, dir);
+                        p = ziplistIndex(zl, dir == ZIPLIST_HEAD ? 0 : -1);
+                    } else {
+                        p = ziplistIndex(zl, start);
+                        ziplistIterInitAt(zl, p ? p : ZIPLIST_ENTRY_END(zl), &iter, dir);
+                        if (!p && dir == ZIPLIST_TAIL) p = ziplistIndex(zl, -1);
+                    }
+                    while (ziplistIterNext(&iter, &entry)) {
+                        assert(p != NULL && iter.e.p == p);
+                        assert(ziplistGet(p, &vstr, &vlen, &vlong));
+                        assert(vstr == entry.sval);
+                        if (vstr) assert(vlen == entry.slen);
+                        else assert(vlong == entry.lval);
+                        p = (dir == ZIPLIST_HEAD) ? ziplistNext(zl, p) : ziplistPrev(zl, p);
+                    }
+                    assert(p == NULL);
+                    assert(!ziplistIterNext(&iter, &entry));
+                }
+            }
+            free(zl);
+        }
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Iteration benchmark:\n");
+    {
+        const char *kinds[4] = {"small int", "large int", "string", "mixed"};
+        char buf[32];
+        unsigned char *vstr;
+        unsigned int vlen;
+        long long vlong, sum = 0, start, t;
+        int k, i, round, rounds = 100, entries = 10000;
+
+        srand(1234);
+        for (k = 0; k < 4; k++) {
+            zl = ziplistNew();
+            for (i = 0; i < entries; i++) {
+                // mixed 随机混合前三种，编码的分支无法预测
+                int kind = (k == 3) ? rand() % 3 : k;
+                if (kind == 0) sprintf(buf, "%d", i % 30000);
+                else if (kind == 1) sprintf(buf, "%lld", 100000000000LL + i);
+                else sprintf(buf, "value:%d", i);
+                zl = ziplistPush(zl, (unsigned char*)buf, strlen(buf), ZIPLIST_TAIL);
+            }
+
+            // ziplistNext + ziplistGet 遍历整个列表
+            start = usec();
+            for (round = 0; round < rounds; round++) {
+                p = ziplistIndex(zl, 0);
+                while (p) {
+                    ziplistGet(p, &vstr, &vlen, &vlong);
+                    sum += vstr ? vlen : vlong;
+                    p = ziplistNext(zl, p);
+                }
+            }
+            t = usec() - start;
+
+            printf("  %-9s: ziplistNext + ziplistGet %.2f ns/entry", kinds[k], t * 1000.0 / ((double)rounds * entries));
+
+            // ziplistIter 每个节点只解析一次头部
+            ziplistIter iter;
+            ziplistEntry entry;
+            start = usec();
+            for (round = 0; round < rounds; round++) {
+                ziplistIterInit(zl, &iter, ZIPLIST_HEAD);
+                while (ziplistIterNext(&iter, &entry)) {
+                    sum += entry.sval ? entry.slen : entry.lval;
+                }
+            }
+            t = usec() - start;
+
+            printf(", ziplistIter %.2f ns/entry", t * 1000.0 / ((double)rounds * entries));
+
+            unsigned char *lp = lpFromZiplist(zl);
+            start = usec();
+            for (round = 0; round < rounds; round++) {
+                for (p = lpFirst(lp); p; p = lpNext(lp, p)) {
+                    lpGet(p, &vstr, &vlen, &vlong);
+                    sum += vstr ? vlen : vlong;
+                }
+            }
+            t = usec() - start;
+
+            printf(", lpNext + lpGet %.2f ns/entry\n", t * 1000.0 / ((double)rounds * entries));
+            free(lp);
+            free(zl);
+        }
+        assert(sum != 0);
+        printf("\n");
+    }
+
+    printf("12 bit integer and dictionary encodings: ");
+    {
+        long long values[10] = {127, 128, 255, 256, 1000, 3839, 3840, -1, -129, 0};
+        unsigned char *vstr, *copy, *lp, *kept, *strs[ZIPLIST_DICT_MAX + 1];
+        unsigned int i, k, vlen, keptlen, lens[ZIPLIST_DICT_MAX + 1];
+        long long vlong;
+        char buf[32];
+        zlentry e;
+        ziplistIter iter;
+        ziplistEntry entry = {NULL, 0, 0};
+
+        // 打开扩展编码之后，128 至 3839 使用 12 bit 编码，节点只占 1 + 2 个字节；关闭时与原来的格式相同
+        for (k = 0; k < 2; k++) {
+            ziplistSetExtendedEncoding(k == 0);
+            zl = ziplistNew();
+            for (i = 0; i < 10; i++) {
+                sprintf(buf, "%lld", values[i]);
+                zl = ziplistPush(zl, (unsigned char *)buf, strlen(buf), ZIPLIST_TAIL);
+            }
+            for (i = 0; i < 10; i++) {
+                p = ziplistIndex(zl, i);
+                zipEntry(p, &e);
+                if (k == 0 && values[i] >= 128 && values[i] < 3840) {
+                    assert(e.encoding == ZIP_INT_12B_MIN + (values[i] >> 8) && e.headersize + e.len == 3);
+                } else {
+                    assert(e.encoding < ZIP_INT_12B_MIN || e.encoding > ZIP_INT_12B_MAX);
+                }
+                assert(ziplistGet(p, &vstr, &vlen, &vlong) && vstr == NULL && vlong == values[i]);
+                sprintf(buf, "%lld", values[i]);
+                assert(ziplistCompare(p, (unsigned char *)buf, strlen(buf)));
+            }
+            assert(ziplistValidateIntegrity(zl, ziplistBlobLen(zl), 1));
+            free(zl);
+        }
+
+        // 整数、重复和过多的字符串不能放入字典，失败时字典保持不变
+        strs[0] = (unsigned char *)"42";
+        lens[0] = 2;
+        assert(!ziplistDictSet(strs, lens, 1));
+        strs[0] = strs[1] = (unsigned char *)"dup";
+        lens[0] = lens[1] = 3;
+        assert(!ziplistDictSet(strs, lens, 2));
+        for (i = 0; i <= ZIPLIST_DICT_MAX; i++) {
+            strs[i] = (unsigned char *)"x";
+            lens[i] = 1;
+        }
+        assert(!ziplistDictSet(strs, lens, ZIPLIST_DICT_MAX + 1));
+        assert(zipDict.count == 0);
+
+        // 没有打开扩展编码时不使用字典，字典可以随意替换
+        strs[0] = (unsigned char *)"pending";
+        lens[0] = 7;
+        assert(ziplistDictSet(strs, lens, 1));
+        zl = ziplistPush(ziplistNew(), strs[0], lens[0], ZIPLIST_TAIL);
+        assert(ziplistIndex(zl, 0)[1] != ZIP_STR_DICT && !zipDict.used);
+        free(zl);
+        assert(datasetDictSet());
+
+        // 关闭和打开扩展编码生成的相同数据，通过 ziplistGet 和 ziplistIter 读出的值完全一致
+        for (k = 0; k < 3; k++) {
+            for (i = 0; i < 50; i++) {
+                unsigned char *plain, *dict;
+                unsigned int ndict = 0;
+
+                srand(460 + k * 100 + i);
+                ziplistSetExtendedEncoding(1);
+                dict = createDatasetList(k);
+                srand(460 + k * 100 + i);
+                ziplistSetExtendedEncoding(0);
+                plain = createDatasetList(k);
+                ziplistSetExtendedEncoding(1);
+
+                assertSameZiplist(plain, dict);
+                assert(ziplistValidateIntegrity(dict, ziplistBlobLen(dict), 1));
+                assert(ziplistBlobLen(dict) < ziplistBlobLen(plain));
+
+                ziplistIterInit(dict, &iter, ZIPLIST_HEAD);
+                p = ziplistIndex(plain, 0);
+                while (ziplistIterNext(&iter, &entry)) {
+                    if (iter.e.encoding == ZIP_STR_DICT) {
+                        ndict++;
+                        assert(ziplistCompare(iter.e.p, entry.sval, entry.slen));
+                        assert(ziplistFind(ziplistIndex(dict, 0), entry.sval, entry.slen, 0) != NULL);
+                    }
+                    assert(ziplistGet(p, &vstr, &vlen, &vlong));
+                    assert((vstr == NULL) == (entry.sval == NULL));
+                    if (vstr) assert(vlen == entry.slen && memcmp(vstr, entry.sval, vlen) == 0);
+                    else assert(vlong == entry.lval);
+                    p = ziplistNext(plain, p);
+                }
+                assert(p == NULL && ndict > 0);
+
+                // listpack 转换回来之后仍然使用字典
+                lp = lpFromZiplist(dict);
+                assertSameElements(dict, lp);
+                copy = ziplistFromListpack(lp);
+                assert(ziplistBlobLen(copy) == ziplistBlobLen(dict) && memcmp(copy, dict, ziplistBlobLen(dict)) == 0);
+                free(copy);
+                free(lp);
+                free(plain);
+                free(dict);
+            }
+        }
+        assert(zipDict.used);
+
+        // 批量插入同样使用字典
+        ziplistEntry many[3] = {{(unsigned char *)"pending", 7, 0}, {NULL, 0, 2024}, {(unsigned char *)"not in dict", 11, 0}};
+        zl = ziplistPushMany(ziplistNew(), many, 3, ZIPLIST_TAIL);
+        copy = ziplistNew();
+        copy = ziplistPush(copy, (unsigned char *)"pending", 7, ZIPLIST_TAIL);
+        copy = ziplistPush(copy, (unsigned char *)"2024", 4, ZIPLIST_TAIL);
+        copy = ziplistPush(copy, (unsigned char *)"not in dict", 11, ZIPLIST_TAIL);
+        assert(ziplistBlobLen(zl) == ziplistBlobLen(copy) && memcmp(zl, copy, ziplistBlobLen(zl)) == 0);
+        assert(ziplistIndex(zl, 0)[1] == ZIP_STR_DICT);
+        free(copy);
+
+        // 字典已被使用：改变已有编号的字典被拒绝，只在末尾追加时原有的编号和字符串指针仍然有效
+        assert(ziplistGet(ziplistIndex(zl, 0), &kept, &keptlen, &vlong) && keptlen == 7);
+        for (i = 0; i < sizeof(datasetWords) / sizeof(datasetWords[0]); i++) {
+            strs[i] = (unsigned char *)datasetWords[i];
+            lens[i] = strlen(datasetWords[i]);
+        }
+        // "pending" 和 "suspended" 交换编号
+        strs[20] = (unsigned char *)datasetWords[21];
+        lens[20] = strlen(datasetWords[21]);
+        strs[21] = (unsigned char *)datasetWords[20];
+        lens[21] = strlen(datasetWords[20]);
+        assert(!ziplistDictSet(strs, lens, i));
+        strs[20] = (unsigned char *)datasetWords[20];
+        lens[20] = strlen(datasetWords[20]);
+        strs[21] = (unsigned char *)datasetWords[21];
+        lens[21] = strlen(datasetWords[21]);
+        assert(!ziplistDictSet(strs, lens, 1));
+        assert(!ziplistDictSet(NULL, NULL, 0));
+        assert(zipDict.count == i);
+        strs[i] = (unsigned char *)"archived";
+        lens[i] = 8;
+        assert(ziplistDictSet(strs, lens, i + 1));
+        assert(ziplistValidateIntegrity(zl, ziplistBlobLen(zl), 1));
+        assert(ziplistGet(ziplistIndex(zl, 0), &vstr, &vlen, &vlong) && vstr == kept && memcmp(kept, "pending", 7) == 0);
+
+        // 编号超出字典，或者校验字节不一致的节点：检查失败，读取返回0，迭代停止，不与任何值相等
+        for (k = 0; k < 2; k++) {
+            copy = (unsigned char *)malloc(ziplistBlobLen(zl));
+            memcpy(copy, zl, ziplistBlobLen(zl));
+            p = ziplistIndex(copy, 0);
+            if (k == 0) p[2] = 0xff;
+            else p[3] ^= 0xff;
+            assert(!ziplistValidateIntegrity(copy, ziplistBlobLen(copy), 1));
+            assert(!ziplistGet(p, &vstr, &vlen, &vlong));
+            assert(!ziplistCompare(p, (unsigned char *)"pending", 7));
+            assert(ziplistFind(p, (unsigned char *)"pending", 7, 0) == NULL);
+            ziplistIterInit(copy, &iter, ZIPLIST_HEAD);
+            assert(!ziplistIterNext(&iter, &entry));
+            assert(lpFromZiplist(copy) == NULL);
+            free(copy);
+        }
+        free(zl);
+
+        // 字典保留到进程结束，关闭扩展编码之后的插入不再使用它
+        ziplistSetExtendedEncoding(0);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Encoding size on real-looking datasets (1000 ziplists each):\n");
+    {
+        unsigned int k, i, n12;
+        size_t plain, dict;
+        zlentry e;
+
+        for (k = 0; k < 3; k++) {
+            // 不使用扩展编码，与原来的格式相同
+            plain = 0;
+            srand(4600 + k);
+            for (i = 0; i < 1000; i++) {
+                zl = createDatasetList(k);
+                plain += ziplistBlobLen(zl);
+                free(zl);
+            }
+
+            // 使用 12 bit 整数和字典，相同的数据
+            ziplistSetExtendedEncoding(1);
+            dict = 0;
+            n12 = 0;
+            srand(4600 + k);
+            for (i = 0; i < 1000; i++) {
+                zl = createDatasetList(k);
+                dict += ziplistBlobLen(zl);
+                for (p = ziplistIndex(zl, 0); p; p = ziplistNext(zl, p)) {
+                    zipEntry(p, &e);
+                    if (e.encoding >= ZIP_INT_12B_MIN && e.encoding <= ZIP_INT_12B_MAX) n12++;
+                }
+                free(zl);
+            }
+            ziplistSetExtendedEncoding(0);
+
+            // 每个 12 bit 整数原来需要 ZIP_INT_16B 的2个字节，节省1个字节
+            printf("  %-11s: int16 only %7zu bytes, 12 bit %7zu bytes (-%4.1f%%), 12 bit + dictionary %7zu bytes (-%4.1f%%)\n",
+                datasetNames[k], plain, plain - n12, n12 * 100.0 / plain,
+                dict, (plain - dict) * 100.0 / plain);
+        }
+        printf("\n");
+    }
+
     printf("Stress with variable ziplist size:\n");
     {
         stress(ZIPLIST_HEAD, 100000, 16384, 256);